@@ -1,16 +1,35 @@
 #include "app.h"
 
+#include "arena.h"
+#include "canvas.h"
+#include "damage.h"
 #include "display.h"
+#include "document.h"
 #include "draw.h"
+#include "export.h"
+#include "floodfill.h"
+#include "history.h"
+#include "input.h"
+#include "overlay.h"
+#include "polyfill.h"
+#include "profile.h"
+#include "scene.h"
+#include "tiles.h"
 #include "ui.h"
 
 #include <X11/keysym.h>
-#include <stdlib.h>
 #include <math.h>
-#include <string.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
 
 #define POLY_SNAP_DIST 12
 
+// Bucket tolerances the T key steps through.
+static const int fill_tolerances[] = {0, 16, 48, 96};
+#define FILL_TOLERANCE_COUNT (int)(sizeof(fill_tolerances) / sizeof(fill_tolerances[0]))
+
 static void
 apply_snap_mode(int snap_mode, int x0, int y0, int* x1, int* y1)
 {
@@ -49,15 +68,367 @@ choose_snap_mode(int x0, int y0, int x1, int y1)
     return 2;     // diag
 }
 
+static uint32_t
+current_color(const InputState* state)
+{
+    return pack_rgb(state->color_r, state->color_g, state->color_b);
+}
+
+static uint16_t
+current_style(const InputState* state)
+{
+    return SHAPE_STYLE(state->thickness, state->line_style);
+}
+
+static Stroke
+current_stroke(const InputState* state)
+{
+    return stroke_make(current_color(state), state->thickness, state->line_style);
+}
+
+#define PREVIEW_COLOR pack_rgb(120, 120, 120)
+
+// With a canvas, committed strokes, their previews and history all live on it and the
+// window only shows it (see canvas_sync); tools then work in canvas coordinates.
+static DisplayContext*
+draw_target(DisplayContext* ctx, InputState* state)
+{
+    return state->canvas ? &state->canvas->ctx : ctx;
+}
+
+static void
+event_point(const InputState* state, int wx, int wy, int* x, int* y)
+{
+    if (state->canvas)
+    {
+        canvas_from_window(state->canvas, wx, wy, x, y);
+        return;
+    }
+    *x = wx;
+    *y = wy;
+}
+
+// Rubber-band previews use the current pen in grey.
+static Stroke
+preview_stroke(const InputState* state)
+{
+    return stroke_make(PREVIEW_COLOR, state->thickness, state->line_style);
+}
+
+// Grows the in-progress polygon by one vertex, always keeping a spare slot for the cursor
+// vertex of the preview.
+static bool
+push_poly_vertex(InputState* state, int x, int y)
+{
+    int need = state->poly_count + 2;
+    if (need > state->poly_cap)
+    {
+        int cap = state->poly_cap ? state->poly_cap : 64;
+        while (cap < need)
+            cap *= 2;
+
+        int32_t* px = realloc(state->poly_x, (size_t)cap * sizeof(int32_t));
+        if (!px)
+            return false;
+        state->poly_x = px;
+        int32_t* py = realloc(state->poly_y, (size_t)cap * sizeof(int32_t));
+        if (!py)
+            return false;
+        state->poly_y = py;
+        state->poly_cap = cap;
+    }
+
+    state->poly_x[state->poly_count] = x;
+    state->poly_y[state->poly_count] = y;
+    state->poly_count++;
+    return true;
+}
+
+// The rule the open polygon was begun with; changing it mid-polygon applies to the next one.
+static int
+open_polygon_fill(const InputState* state)
+{
+    const PolygonList* l = &state->scene.polygons;
+    return l->count > 0 ? SHAPE_FILL_RULE(l->style[l->count - 1]) : FILL_NONE;
+}
+
+// Likewise the pen: edges are drawn the way the scene recorded the polygon, so replay matches
+// them even if the colour or style changed since it was begun.
+static Stroke
+open_polygon_stroke(const InputState* state)
+{
+    const PolygonList* l = &state->scene.polygons;
+    if (l->count == 0)
+        return current_stroke(state);
+    uint16_t style = l->style[l->count - 1];
+    return stroke_make(l->color[l->count - 1], SHAPE_THICKNESS(style), SHAPE_LINE_STYLE(style));
+}
+
+// Pulls the next polygon vertex onto the first one when close enough to close the polygon,
+// or else onto any vertex already drawn nearby. The last vertex is never a target.
+static void
+snap_polygon_vertex(const InputState* state, int* x, int* y)
+{
+    int n = state->poly_count;
+    int64_t dx = *x - state->poly_x[0];
+    int64_t dy = *y - state->poly_y[0];
+    if (n >= 2 && dx * dx + dy * dy <= POLY_SNAP_DIST * POLY_SNAP_DIST)
+    {
+        *x = state->poly_x[0];
+        *y = state->poly_y[0];
+        return;
+    }
+
+    int vx, vy;
+    if (scene_nearest_vertex(&state->scene, *x, *y, POLY_SNAP_DIST, &vx, &vy) &&
+        (vx != state->poly_x[n - 1] || vy != state->poly_y[n - 1]))
+    {
+        *x = vx;
+        *y = vy;
+    }
+}
+
+// Fills the finished polygon if it has a rule and closes its action.
+static void
+finish_polygon(DisplayContext* ctx, InputState* state)
+{
+    Stroke pen = open_polygon_stroke(state);
+    fill_polygon(ctx,
+        state->poly_x,
+        state->poly_y,
+        state->poly_count,
+        open_polygon_fill(state),
+        pen.color);
+    history_end(&state->history, ctx, &state->scene);
+    state->have_first = false;
+    state->poly_count = 0;
+}
+
+// Floods the region under (x, y) with the current colour and commits the filled runs as
+// 1-pixel lines, so replay, saving and undo treat the fill like any drawn shape. On a canvas
+// only the part in view is filled.
+static void
+bucket_fill(DisplayContext* ctx, InputState* state, int x, int y)
+{
+    DisplayContext* dc = draw_target(ctx, state);
+    Rect area = state->canvas ? canvas_visible(state->canvas, ctx) : dc->clip;
+
+    history_begin(&state->history, dc, &state->scene);
+    int* spans;
+    int count = flood_fill(dc,
+        area,
+        x,
+        y,
+        current_color(state),
+        state->fill_tolerance,
+        arena_frame(),
+        &spans);
+    scene_add_lines(&state->scene,
+        spans,
+        NULL,
+        current_color(state),
+        count,
+        SHAPE_STYLE(1, LINE_STYLE_SOLID));
+    history_end(&state->history, dc, &state->scene);
+}
+
 #define MAX_HANDLERS 32
 static EventHandler handlers[MAX_HANDLERS];
+static const char* handler_names[MAX_HANDLERS];
 static int handler_count = 0;
 
+// 0 presents after every event; otherwise app_run paces presentation to this rate.
+static int target_fps = 0;
+
+// Start of the work that the next presented frame will show; 0 when profiling is off.
+static int64_t frame_start = 0;
+
 void
-register_handler(EventHandler h)
+register_handler(EventHandler h, const char* name)
 {
     if (handler_count < MAX_HANDLERS)
+    {
+        handler_names[handler_count] = name;
         handlers[handler_count++] = h;
+    }
+}
+
+void
+app_set_target_fps(int fps)
+{
+    target_fps = fps > 0 ? fps : 0;
+}
+
+// Where Ctrl+S saves the drawing.
+static const char* document_path = "drawing.srd";
+
+void
+app_set_document(const char* path)
+{
+    document_path = path;
+}
+
+// A canvas's pixels are not stored: checking them for content would read all of it, and
+// loading rasterizes only what the shapes cover anyway.
+static void
+save_document(const DisplayContext* ctx, const InputState* state)
+{
+    if (!document_save(document_path, &state->scene, state->canvas ? NULL : ctx))
+        fprintf(stderr, "%s: cannot save document\n", document_path);
+}
+
+// Where Ctrl+E writes the picture.
+static const char* image_path = "drawing.png";
+
+// The committed pixels (all of a canvas) are written in the background; drawing goes on
+// meanwhile and the file keeps the picture as it was at the key press.
+static void
+export_image(DisplayContext* ctx, InputState* state)
+{
+    DisplayContext* dc = draw_target(ctx, state);
+    if (export_busy())
+        fprintf(stderr, "%s: the previous export is still being written\n", image_path);
+    else if (!export_start(dc, dc->clip, image_path))
+        fprintf(stderr, "%s: cannot export image\n", image_path);
+}
+
+static void
+present_frame(DisplayContext* ctx)
+{
+    if (damage_empty(ctx))
+        return;
+    if (profile_stats_visible())
+        render_stats(ctx);
+
+    size_t upload = 0;
+    for (int i = 0; i < ctx->damage.count; ++i)
+    {
+        Rect r = ctx->damage.rects[i];
+        upload += (size_t)(r.x1 - r.x0) * (size_t)(r.y1 - r.y0) * sizeof(uint32_t);
+    }
+
+    int64_t t = profile_begin();
+    render_frame(ctx);
+    profile_end("render_frame", t);
+    profile_frame(frame_start, upload);
+    frame_start = 0;
+}
+
+// Handlers call this once their changes are in fb.data (or the canvas). In paced mode the
+// loop presents accumulated damage at the next frame instead.
+static void
+present(DisplayContext* ctx, InputState* state)
+{
+    if (state->canvas)
+        canvas_sync(state->canvas, ctx);
+    if (target_fps == 0)
+        present_frame(ctx);
+}
+
+void
+handle_expose(XEvent* e, DisplayContext* ctx, InputState* state)
+{
+    if (e->type != Expose)
+        return;
+
+    XExposeEvent* ex = &e->xexpose;
+    damage_rect(ctx, ex->x, ex->y, ex->x + ex->width, ex->y + ex->height);
+    if (ex->count == 0)
+        present(ctx, state);
+}
+
+// The bar's rows stay out of the clip whatever size the window had before.
+static void
+resize_window(DisplayContext* ctx, int w, int h)
+{
+    display_resize(ctx, w, h);
+    ctx->clip.y0 = UI_BAR_H < ctx->h ? UI_BAR_H : ctx->h;
+    ui_resize(ctx);
+}
+
+// Only the scene survives a resize: the new framebuffer is re-rasterized from it. A drag
+// sends a stream of these, so everything queued is coalesced into the last size.
+void
+handle_configure(XEvent* e, DisplayContext* ctx, InputState* state)
+{
+    if (e->type != ConfigureNotify)
+        return;
+
+    XConfigureEvent c = e->xconfigure;
+    XEvent next;
+    while (XCheckTypedWindowEvent(ctx->dpy, ctx->win, ConfigureNotify, &next))
+        c = next.xconfigure;
+    if (c.width == ctx->w && c.height == ctx->h)
+        return;
+
+    // A canvas keeps its pixels and history through a resize; only the view is redrawn.
+    if (state->canvas)
+    {
+        overlay_clear(ctx);
+        resize_window(ctx, c.width, c.height);
+        state->canvas->view_changed = true;
+        render_ui(ctx, state);
+        present(ctx, state);
+        return;
+    }
+
+    // An action in progress is split at the resize, since its tiles refer to the old grid.
+    bool open = state->have_first;
+    history_end(&state->history, ctx, &state->scene);
+    overlay_clear(ctx);
+
+    resize_window(ctx, c.width, c.height);
+    history_resize(&state->history, ctx);
+
+    clear_framebuffer(ctx);
+    render_scene_tiled(&state->scene, ctx);
+    render_ui(ctx, state);
+    if (open)
+        history_begin(&state->history, ctx, &state->scene);
+    present(ctx, state);
+}
+
+// Ctrl+Z undoes, Ctrl+Y or Ctrl+Shift+Z redoes. A half-finished line, circle or polygon
+// counts as an action of its own and is dropped along with its preview.
+static void
+handle_history_key(KeySym sym, unsigned int mods, DisplayContext* ctx, InputState* state)
+{
+    DisplayContext* dc = draw_target(ctx, state);
+    if (sym == XK_y || (mods & ShiftMask))
+        history_redo(&state->history, dc, &state->scene);
+    else
+        history_undo(&state->history, dc, &state->scene);
+
+    overlay_clear(dc);
+    state->have_first = false;
+    state->poly_count = 0;
+    present(ctx, state);
+}
+
+// Arrows pan a quarter of the window, +/- zoom about its centre and 0 goes back to 1:1.
+static bool
+handle_view_key(KeySym sym, const DisplayContext* ctx, InputState* state)
+{
+    Canvas* c = state->canvas;
+    int cx = ctx->w / 2;
+    int cy = (ctx->clip.y0 + ctx->h) / 2;
+    if (sym == XK_Left)
+        canvas_pan(c, -ctx->w / 4, 0);
+    else if (sym == XK_Right)
+        canvas_pan(c, ctx->w / 4, 0);
+    else if (sym == XK_Up)
+        canvas_pan(c, 0, -ctx->h / 4);
+    else if (sym == XK_Down)
+        canvas_pan(c, 0, ctx->h / 4);
+    else if (sym == XK_plus || sym == XK_equal || sym == XK_KP_Add)
+        canvas_zoom(c, 1, cx, cy);
+    else if (sym == XK_minus || sym == XK_KP_Subtract)
+        canvas_zoom(c, -1, cx, cy);
+    else if (sym == XK_0)
+        canvas_zoom(c, -c->zoom, cx, cy);
+    else
+        return false;
+    return true;
 }
 
 void
@@ -67,17 +438,84 @@ handle_keypress(XEvent* e, DisplayContext* ctx, InputState* state)
         return;
 
     KeySym sym = XLookupKeysym(&e->xkey, 0);
-    if (sym == XK_Escape || sym == XK_q)
+    if ((e->xkey.state & ControlMask) && (sym == XK_z || sym == XK_y))
+        handle_history_key(sym, e->xkey.state, ctx, state);
+    else if ((e->xkey.state & ControlMask) && sym == XK_s)
+        save_document(ctx, state);
+    else if ((e->xkey.state & ControlMask) && sym == XK_e)
+        export_image(ctx, state);
+    else if (sym == XK_Escape || sym == XK_q)
         state->running = false;
+    else if (state->canvas && handle_view_key(sym, ctx, state))
+    {
+        present(ctx, state);
+    }
     else if (sym == XK_c || sym == XK_C)
     {
-        clear_framebuffer(ctx);
+        DisplayContext* dc = draw_target(ctx, state);
+        history_begin(&state->history, dc, &state->scene);
+        if (state->canvas)
+            canvas_clear(state->canvas);
+        else
+            clear_framebuffer(ctx);
+        overlay_clear(dc);
+        scene_clear(&state->scene);
+        history_end(&state->history, dc, &state->scene);
         state->have_first = false;
+        state->poly_count = 0;
+        render_ui(ctx, state);
+        present(ctx, state);
+    }
+    else if (sym == XK_f || sym == XK_F)
+    {
+        state->fill_rule = (state->fill_rule + 1) % 3;
+        render_ui(ctx, state);
+        present(ctx, state);
+    }
+    else if (sym == XK_t || sym == XK_T)
+    {
+        int i = 0;
+        while (i < FILL_TOLERANCE_COUNT && fill_tolerances[i] != state->fill_tolerance)
+            i++;
+        state->fill_tolerance = fill_tolerances[(i + 1) % FILL_TOLERANCE_COUNT];
+        render_ui(ctx, state);
+        present(ctx, state);
+    }
+    else if (sym == XK_r || sym == XK_R)
+    {
+        // Re-rasterize the canvas from the display list (on a canvas, the part in view).
+        if (state->canvas)
+        {
+            canvas_rasterize_visible(state->canvas, ctx, &state->scene);
+        }
+        else
+        {
+            clear_framebuffer(ctx);
+            render_scene_tiled(&state->scene, ctx);
+        }
         render_ui(ctx, state);
-        render_frame(ctx);
+        present(ctx, state);
     }
 }
 
+// On a canvas the middle button drags the view and the wheel zooms about the pointer.
+static bool
+handle_view_button(const XEvent* e, InputState* state)
+{
+    Canvas* c = state->canvas;
+    int x = e->xbutton.x;
+    int y = e->xbutton.y;
+    if (e->xbutton.button == Button2)
+        canvas_from_window(c, x, y, &state->pan_x, &state->pan_y);
+    else if (e->xbutton.button == Button4)
+        canvas_zoom(c, 1, x, y);
+    else if (e->xbutton.button == Button5)
+        canvas_zoom(c, -1, x, y);
+    else
+        return false;
+    return true;
+}
+
 void
 handle_click(XEvent* e, DisplayContext* ctx, InputState* state)
 {
@@ -87,16 +525,56 @@ handle_click(XEvent* e, DisplayContext* ctx, InputState* state)
     int x = e->xbutton.x;
     int y = e->xbutton.y;
 
+    if (state->canvas && handle_view_button(e, state))
+    {
+        present(ctx, state);
+        return;
+    }
+
+    DisplayContext* dc = draw_target(ctx, state);
+    int tool = state->tool;
     if (ui_handle_click(x, y, ctx, state))
+    {
+        // Switching tools finishes an open polygon as it stands, so its rule and action are
+        // settled the same way on screen and in replay.
+        if (state->tool != tool && state->poly_count > 0)
+        {
+            overlay_clear(dc);
+            finish_polygon(dc, state);
+        }
+        present(ctx, state);
         return;
+    }
+
+    event_point(state, x, y, &x, &y);
+    Stroke pen = current_stroke(state);
 
-    // Tool: point
+    // Tool: brush. The press stamps the pen and opens a polyline that motion with the button
+    // held extends (see extend_brush); the release closes the action.
     if (state->tool == 0)
     {
-        put_pixel_thick(ctx, x, y, state->thickness, state->color_r, state->color_g, state->color_b);
-        memcpy(ctx->fb.saved, ctx->fb.data, (size_t)ctx->w * (size_t)ctx->h * sizeof(uint32_t));
+        history_begin(&state->history, dc, &state->scene);
+        stroke_point(dc, &pen, x, y);
+        scene_add_point(&state->scene, x, y, current_color(state), current_style(state));
+        scene_begin_polygon(&state->scene,
+            x,
+            y,
+            current_color(state),
+            SHAPE_WITH_FILL(current_style(state), FILL_NONE));
+        state->x0 = x;
+        state->y0 = y;
+        state->have_first = true;
         render_ui(ctx, state);
-        render_frame(ctx);
+        present(ctx, state);
+        return;
+    }
+
+    // Tool: bucket
+    if (state->tool == 4)
+    {
+        bucket_fill(ctx, state, x, y);
+        render_ui(ctx, state);
+        present(ctx, state);
         return;
     }
 
@@ -107,8 +585,8 @@ handle_click(XEvent* e, DisplayContext* ctx, InputState* state)
         {
             if (state->poly_count >= 3)
             {
-                // restore preview base then draw closing edge and commit
-                memcpy(ctx->fb.data, ctx->fb.saved, (size_t)ctx->w * (size_t)ctx->h * sizeof(uint32_t));
+                // drop the preview edge, then draw the closing edge
+                overlay_clear(dc);
                 int x0 = state->poly_x[state->poly_count - 1];
                 int y0 = state->poly_y[state->poly_count - 1];
                 int x1 = state->poly_x[0];
@@ -117,37 +595,35 @@ handle_click(XEvent* e, DisplayContext* ctx, InputState* state)
                 if (e->xbutton.state & ShiftMask)
                     snap_to_axis(x0, y0, &x1, &y1);
 
-                if (state->line_style == 2)
-                    draw_dotted_line(ctx, x0, y0, x1, y1, state->color_r, state->color_g, state->color_b);
-                else if (state->line_style == 1)
-                    draw_dashed_line_thick(
-                        ctx, x0, y0, x1, y1, state->thickness, 6, 4, state->color_r, state->color_g, state->color_b
-                    );
-                else
-                    draw_line_thick(
-                        ctx, x0, y0, x1, y1, state->thickness, state->color_r, state->color_g, state->color_b
-                    );
-
-                state->have_first = false;
-                state->poly_count = 0;
-                memcpy(ctx->fb.saved, ctx->fb.data, (size_t)ctx->w * (size_t)ctx->h * sizeof(uint32_t));
+                if (!push_poly_vertex(state, x1, y1))
+                    return;
+                pen = open_polygon_stroke(state);
+                stroke_line(dc, &pen, x0, y0, x1, y1);
+
+                scene_extend_polygon(&state->scene, x1, y1);
+                finish_polygon(dc, state);
                 render_ui(ctx, state);
-                render_frame(ctx);
+                present(ctx, state);
             }
             return;
         }
 
         if (state->poly_count == 0)
         {
-            state->poly_x[0] = x;
-            state->poly_y[0] = y;
-            state->poly_count = 1;
+            if (!push_poly_vertex(state, x, y))
+                return;
             state->have_first = true;
 
-            put_pixel_thick(ctx, x, y, state->thickness, state->color_r, state->color_g, state->color_b);
-            memcpy(ctx->fb.saved, ctx->fb.data, (size_t)ctx->w * (size_t)ctx->h * sizeof(uint32_t));
+            history_begin(&state->history, dc, &state->scene);
+            stroke_point(dc, &pen, x, y);
+            scene_add_point(&state->scene, x, y, current_color(state), current_style(state));
+            scene_begin_polygon(&state->scene,
+                x,
+                y,
+                current_color(state),
+                SHAPE_WITH_FILL(current_style(state), state->fill_rule));
             render_ui(ctx, state);
-            render_frame(ctx);
+            present(ctx, state);
             return;
         }
 
@@ -157,52 +633,25 @@ handle_click(XEvent* e, DisplayContext* ctx, InputState* state)
         int x1 = x;
         int y1 = y;
 
-        // Snap to first vertex if close enough (helps closing the polygon)
-        if (state->poly_count >= 2)
-        {
-            int fx = state->poly_x[0];
-            int fy = state->poly_y[0];
-            int ddx = x1 - fx;
-            int ddy = y1 - fy;
-            if ((ddx * ddx + ddy * ddy) <= (POLY_SNAP_DIST * POLY_SNAP_DIST))
-            {
-                x1 = fx;
-                y1 = fy;
-            }
-        }
+        snap_polygon_vertex(state, &x1, &y1);
 
         if (e->xbutton.state & ShiftMask)
             snap_to_axis(x0, y0, &x1, &y1);
 
-        memcpy(ctx->fb.data, ctx->fb.saved, (size_t)ctx->w * (size_t)ctx->h * sizeof(uint32_t));
-
-        if (state->line_style == 2)
-            draw_dotted_line(ctx, x0, y0, x1, y1, state->color_r, state->color_g, state->color_b);
-        else if (state->line_style == 1)
-            draw_dashed_line_thick(
-                ctx, x0, y0, x1, y1, state->thickness, 6, 4, state->color_r, state->color_g, state->color_b
-            );
-        else
-            draw_line_thick(ctx, x0, y0, x1, y1, state->thickness, state->color_r, state->color_g, state->color_b);
+        if (!push_poly_vertex(state, x1, y1))
+            return;
+        overlay_clear(dc);
 
-        if (state->poly_count < 256)
-        {
-            state->poly_x[state->poly_count] = x1;
-            state->poly_y[state->poly_count] = y1;
-            state->poly_count++;
-        }
+        pen = open_polygon_stroke(state);
+        stroke_line(dc, &pen, x0, y0, x1, y1);
+        scene_extend_polygon(&state->scene, x1, y1);
 
         // If we snapped to the first vertex, close and finish immediately
         if (x1 == state->poly_x[0] && y1 == state->poly_y[0] && state->poly_count >= 4)
-        {
-            state->have_first = false;
-            state->poly_count = 0;
-        }
+            finish_polygon(dc, state);
 
-        // commit as new base
-        memcpy(ctx->fb.saved, ctx->fb.data, (size_t)ctx->w * (size_t)ctx->h * sizeof(uint32_t));
         render_ui(ctx, state);
-        render_frame(ctx);
+        present(ctx, state);
         return;
     }
 
@@ -212,13 +661,15 @@ handle_click(XEvent* e, DisplayContext* ctx, InputState* state)
         state->y0 = y;
         state->have_first = true;
 
-    put_pixel_thick(ctx, x, y, state->thickness, state->color_r, state->color_g, state->color_b);
-        memcpy(ctx->fb.saved, ctx->fb.data, (size_t)ctx->w * (size_t)ctx->h * sizeof(uint32_t));
-        render_frame(ctx);
+        // The action runs from this stamp to the click that commits the shape.
+        history_begin(&state->history, dc, &state->scene);
+        stroke_point(dc, &pen, x, y);
+        scene_add_point(&state->scene, x, y, current_color(state), current_style(state));
+        present(ctx, state);
         return;
     }
 
-    memcpy(ctx->fb.data, ctx->fb.saved, (size_t)ctx->w * (size_t)ctx->h * sizeof(uint32_t));
+    overlay_clear(dc);
 
     if (e->xbutton.state & ShiftMask)
         snap_to_axis(state->x0, state->y0, &x, &y);
@@ -229,61 +680,66 @@ handle_click(XEvent* e, DisplayContext* ctx, InputState* state)
         int dx = x - state->x0;
         int dy = y - state->y0;
         int r = (int)(sqrt((double)dx * (double)dx + (double)dy * (double)dy) + 0.5);
-        bool dashed = (state->line_style != 0);
-        draw_circle(ctx,
+        if (state->fill_rule != FILL_NONE)
+            fill_circle(dc, state->x0, state->y0, r, current_color(state));
+        stroke_circle(dc, &pen, state->x0, state->y0, r);
+        scene_add_circle(&state->scene,
             state->x0,
             state->y0,
             r,
-            state->thickness,
-            dashed,
-            state->color_r,
-            state->color_g,
-            state->color_b);
+            current_color(state),
+            SHAPE_WITH_FILL(current_style(state), state->fill_rule));
+        history_end(&state->history, dc, &state->scene);
 
         state->have_first = false;
         render_ui(ctx, state);
-        render_frame(ctx);
+        present(ctx, state);
         return;
     }
 
-    if (state->line_style == 2)
-    {
-        draw_dotted_line(ctx, state->x0, state->y0, x, y, state->color_r, state->color_g, state->color_b);
-    }
-    else if (state->line_style == 1)
-    {
-        draw_dashed_line_thick(
-            ctx,
-            state->x0,
-            state->y0,
-            x,
-            y,
-            state->thickness,
-            6,
-            4,
-            state->color_r,
-            state->color_g,
-            state->color_b
-        );
-    }
-    else
-    {
-        draw_line_thick(
-            ctx,
-            state->x0,
-            state->y0,
-            x,
-            y,
-            state->thickness,
-            state->color_r,
-            state->color_g,
-            state->color_b
-        );
-    }
+    stroke_line(dc, &pen, state->x0, state->y0, x, y);
+    scene_add_line(
+        &state->scene, state->x0, state->y0, x, y, current_color(state), current_style(state)
+    );
+    history_end(&state->history, dc, &state->scene);
 
     state->have_first = false;
     render_ui(ctx, state);
-    render_frame(ctx);
+    present(ctx, state);
+}
+
+// Commits the brush segment from the previous sample to (x, y) straight into the target:
+// replay draws the polyline edge by edge with the same pen, so nothing drawn so far is touched
+// again and the work, damage and history snapshots follow the segment alone.
+static void
+extend_brush(DisplayContext* ctx, InputState* state, int x, int y)
+{
+    if (x == state->x0 && y == state->y0)
+        return;
+
+    DisplayContext* dc = draw_target(ctx, state);
+    Stroke pen = open_polygon_stroke(state);
+    stroke_line(dc, &pen, state->x0, state->y0, x, y);
+    scene_extend_polygon(&state->scene, x, y);
+    state->x0 = x;
+    state->y0 = y;
+    present(ctx, state);
+}
+
+void
+handle_release(XEvent* e, DisplayContext* ctx, InputState* state)
+{
+    if (e->type != ButtonRelease || state->tool != 0 || !state->have_first)
+        return;
+
+    DisplayContext* dc = draw_target(ctx, state);
+    int x, y;
+    event_point(state, e->xbutton.x, e->xbutton.y, &x, &y);
+    extend_brush(ctx, state, x, y);
+    history_end(&state->history, dc, &state->scene);
+    state->have_first = false;
+    render_ui(ctx, state);
+    present(ctx, state);
 }
 
 void
@@ -291,13 +747,28 @@ handle_motion(XEvent* e, DisplayContext* ctx, InputState* state)
 {
     if (e->type != MotionNotify)
         return;
+
+    if (state->canvas && (e->xmotion.state & Button2Mask))
+    {
+        canvas_grab(state->canvas, state->pan_x, state->pan_y, e->xmotion.x, e->xmotion.y);
+        present(ctx, state);
+        return;
+    }
     if (!state->have_first)
         return;
 
-    int x = e->xmotion.x;
-    int y = e->xmotion.y;
+    DisplayContext* dc = draw_target(ctx, state);
+    int x, y;
+    event_point(state, e->xmotion.x, e->xmotion.y, &x, &y);
 
-    memcpy(ctx->fb.data, ctx->fb.saved, (size_t)ctx->w * (size_t)ctx->h * sizeof(uint32_t));
+    if (state->tool == 0)
+    {
+        extend_brush(ctx, state, x, y);
+        return;
+    }
+
+    overlay_begin(dc);
+    Stroke pen = preview_stroke(state);
 
     // Shift snapping: lock snap direction to avoid jitter near thresholds
     bool shift_down = (e->xmotion.state & ShiftMask) != 0;
@@ -320,19 +791,7 @@ handle_motion(XEvent* e, DisplayContext* ctx, InputState* state)
         int x1 = x;
         int y1 = y;
 
-        // Snap preview to first vertex when close
-        if (state->poly_count >= 2)
-        {
-            int fx = state->poly_x[0];
-            int fy = state->poly_y[0];
-            int ddx = x1 - fx;
-            int ddy = y1 - fy;
-            if ((ddx * ddx + ddy * ddy) <= (POLY_SNAP_DIST * POLY_SNAP_DIST))
-            {
-                x1 = fx;
-                y1 = fy;
-            }
-        }
+        snap_polygon_vertex(state, &x1, &y1);
 
         if (shift_down)
         {
@@ -342,43 +801,172 @@ handle_motion(XEvent* e, DisplayContext* ctx, InputState* state)
             apply_snap_mode(state->snap_mode, x0, y0, &x1, &y1);
         }
 
-        if (state->line_style == 2)
-            draw_dotted_line(ctx, x0, y0, x1, y1, 120, 120, 120);
-        else if (state->line_style == 1)
-            draw_dashed_line_thick(ctx, x0, y0, x1, y1, state->thickness, 6, 4, 120, 120, 120);
-        else
-            draw_line_thick(ctx, x0, y0, x1, y1, state->thickness, 120, 120, 120);
+        // The spare slot past the last vertex holds the cursor for the preview fill.
+        if (state->poly_count >= 2)
+        {
+            state->poly_x[state->poly_count] = x1;
+            state->poly_y[state->poly_count] = y1;
+            fill_polygon(dc,
+                state->poly_x,
+                state->poly_y,
+                state->poly_count + 1,
+                open_polygon_fill(state),
+                PREVIEW_COLOR);
+        }
+        stroke_line(dc, &pen, x0, y0, x1, y1);
     }
     else if (state->tool == 2)
     {
         int dx = x - state->x0;
         int dy = y - state->y0;
         int r = (int)(sqrt((double)dx * (double)dx + (double)dy * (double)dy) + 0.5);
-        bool dashed = (state->line_style != 0);
-        draw_circle(ctx, state->x0, state->y0, r, state->thickness, dashed, 120, 120, 120);
+        if (state->fill_rule != FILL_NONE)
+            fill_circle(dc, state->x0, state->y0, r, PREVIEW_COLOR);
+        stroke_circle(dc, &pen, state->x0, state->y0, r);
     }
     else
     {
-        if (state->line_style == 2)
-            draw_dotted_line(ctx, state->x0, state->y0, x, y, 120, 120, 120);
-        else if (state->line_style == 1)
-            draw_dashed_line_thick(ctx, state->x0, state->y0, x, y, state->thickness, 6, 4, 120, 120, 120);
-        else
-            draw_line_thick(ctx, state->x0, state->y0, x, y, state->thickness, 120, 120, 120);
+        stroke_line(dc, &pen, state->x0, state->y0, x, y);
     }
 
+    overlay_end(dc);
     render_ui(ctx, state);
-    render_frame(ctx);
+    present(ctx, state);
+}
+
+static void
+dispatch(XEvent* e, DisplayContext* ctx, InputState* state)
+{
+    if (frame_start == 0)
+        frame_start = profile_begin();
+
+    for (int i = 0; i < handler_count; i++)
+    {
+        int64_t t = profile_begin();
+        handlers[i](e, ctx, state);
+        profile_end(handler_names[i], t);
+    }
+
+    // Scratch memory lasts for one event; its blocks carry over to the next.
+    arena_reset(arena_frame());
+}
+
+static int64_t
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Next queued event: the window connection first, then records from the input thread.
+static bool
+next_event(DisplayContext* ctx, XEvent* e)
+{
+    while (XPending(ctx->dpy))
+    {
+        XNextEvent(ctx->dpy, e);
+        if (!display_consume_event(ctx, e))
+            return true;
+    }
+    return input_next(ctx, e);
+}
+
+// Sleeps until either source may have an event or timeout_ms passes (-1 waits forever). Only
+// call once next_event has come up empty.
+static void
+wait_for_events(DisplayContext* ctx, int timeout_ms)
+{
+    if (XEventsQueued(ctx->dpy, QueuedAfterFlush) > 0)
+        return;
+
+    int64_t t = profile_begin();
+    struct pollfd pfd[2] = {
+        {ConnectionNumber(ctx->dpy), POLLIN, 0},
+        {input_wakeup_fd(), POLLIN, 0},
+    };
+    poll(pfd, pfd[1].fd >= 0 ? 2 : 1, timeout_ms);
+    profile_end("wait", t);
+}
+
+// Drains the queue each wakeup, keeping only the latest MotionNotify of a run of motion
+// events, and presents at most once per frame interval.
+static void
+app_run_paced(DisplayContext* ctx, InputState* state)
+{
+    const int64_t frame_ns = 1000000000 / target_fps;
+    int64_t next_frame = now_ns();
+
+    XEvent motion;
+    bool have_motion = false;
+
+    while (state->running)
+    {
+        int timeout_ms = -1;
+        if (have_motion || !damage_empty(ctx))
+        {
+            int64_t wait = next_frame - now_ns();
+            timeout_ms = wait > 0 ? (int)((wait + 999999) / 1000000) : 0;
+        }
+        wait_for_events(ctx, timeout_ms);
+
+        XEvent e;
+        while (state->running && next_event(ctx, &e))
+        {
+            if (e.type == MotionNotify)
+            {
+                motion = e;
+                have_motion = true;
+                continue;
+            }
+
+            // Keep ordering: a click must see the pointer position that preceded it.
+            if (have_motion)
+            {
+                dispatch(&motion, ctx, state);
+                have_motion = false;
+            }
+            dispatch(&e, ctx, state);
+        }
+
+        int64_t now = now_ns();
+        if (now < next_frame)
+            continue;
+
+        if (have_motion)
+        {
+            dispatch(&motion, ctx, state);
+            have_motion = false;
+        }
+        if (!damage_empty(ctx))
+        {
+            present_frame(ctx);
+            next_frame += frame_ns;
+            if (next_frame < now)
+                next_frame = now + frame_ns;
+        }
+        else
+        {
+            next_frame = now;
+        }
+    }
 }
 
 void
 app_run(DisplayContext* ctx, InputState* state)
 {
+    if (target_fps > 0)
+    {
+        app_run_paced(ctx, state);
+        return;
+    }
+
     while (state->running)
     {
         XEvent e;
-        XNextEvent(ctx->dpy, &e);
-        for (int i = 0; i < handler_count; i++)
-            handlers[i](&e, ctx, state);
+        if (next_event(ctx, &e))
+            dispatch(&e, ctx, state);
+        else
+            wait_for_events(ctx, -1);
     }
 }
@@ -4,10 +4,17 @@
 
 typedef void (*EventHandler)(XEvent*, DisplayContext*, InputState*);
 
-void register_handler(EventHandler h);
+// `name` labels the handler in profiles and must be a string literal.
+void register_handler(EventHandler h, const char* name);
+void app_set_target_fps(int fps);
+// Ctrl+S saves the drawing there (default drawing.srd); the path must outlive the app.
+void app_set_document(const char* path);
 
+void handle_expose(XEvent* e, DisplayContext* ctx, InputState* state);
+void handle_configure(XEvent* e, DisplayContext* ctx, InputState* state);
 void handle_keypress(XEvent* e, DisplayContext* ctx, InputState* state);
 void handle_click(XEvent* e, DisplayContext* ctx, InputState* state);
 void handle_motion(XEvent* e, DisplayContext* ctx, InputState* state);
+void handle_release(XEvent* e, DisplayContext* ctx, InputState* state);
 
 void app_run(DisplayContext* ctx, InputState* state);
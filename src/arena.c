@@ -0,0 +1,209 @@
+#include "arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGN 16
+
+// Most events need far less; larger requests get a block of their own.
+#define ARENA_BLOCK_BYTES (64 * 1024)
+
+// Blocks kept across arena_reset; a one-off large replay goes back to the heap.
+#define ARENA_RETAIN_BYTES (4 * 1024 * 1024)
+
+#define ARENA_POOL_MIN 16
+
+static Arena frame_arena;
+static ArenaCounters counters;
+
+Arena*
+arena_frame(void)
+{
+    return &frame_arena;
+}
+
+ArenaCounters
+arena_counters(void)
+{
+    return counters;
+}
+
+static size_t
+align_up(size_t bytes)
+{
+    return (bytes + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+// The header is padded so block data keeps the alignment of malloc'd memory.
+static uint8_t*
+block_data(ArenaBlock* b)
+{
+    return (uint8_t*)b + align_up(sizeof(ArenaBlock));
+}
+
+// Makes the block after `current` one with room for bytes: the next kept block if it is big
+// enough, else a new one linked in at that point.
+static ArenaBlock*
+next_block(Arena* a, size_t bytes)
+{
+    ArenaBlock* next = a->current ? a->current->next : a->first;
+    if (next && next->size >= bytes)
+    {
+        next->used = 0;
+        return next;
+    }
+
+    size_t size = bytes > ARENA_BLOCK_BYTES ? bytes : ARENA_BLOCK_BYTES;
+    ArenaBlock* b = malloc(align_up(sizeof(ArenaBlock)) + size);
+    if (!b)
+        return NULL;
+    b->size = size;
+    b->used = 0;
+    b->next = next;
+    if (a->current)
+        a->current->next = b;
+    else
+        a->first = b;
+    counters.blocks++;
+    counters.reserved += size;
+    return b;
+}
+
+void*
+arena_alloc(Arena* a, size_t bytes)
+{
+    bytes = align_up(bytes > 0 ? bytes : 1);
+    ArenaBlock* b = a->current;
+    if (!b || b->size - b->used < bytes)
+    {
+        b = next_block(a, bytes);
+        if (!b)
+            return NULL;
+        a->current = b;
+    }
+
+    void* p = block_data(b) + b->used;
+    b->used += bytes;
+    counters.allocs++;
+    return p;
+}
+
+void*
+arena_resize(Arena* a, void* p, size_t old_bytes, size_t bytes)
+{
+    ArenaBlock* b = a->current;
+    if (p && b)
+    {
+        size_t start = (size_t)((uint8_t*)p - block_data(b));
+        if ((uint8_t*)p >= block_data(b) && start + align_up(old_bytes) == b->used &&
+            align_up(bytes > 0 ? bytes : 1) <= b->size - start)
+        {
+            b->used = start + align_up(bytes > 0 ? bytes : 1);
+            return p;
+        }
+    }
+
+    void* q = arena_alloc(a, bytes);
+    if (q && p)
+        memcpy(q, p, old_bytes < bytes ? old_bytes : bytes);
+    return q;
+}
+
+ArenaMark
+arena_mark(const Arena* a)
+{
+    return (ArenaMark){a->current, a->current ? a->current->used : 0};
+}
+
+void
+arena_release(Arena* a, ArenaMark mark)
+{
+    a->current = mark.block;
+    if (mark.block)
+        mark.block->used = mark.used;
+}
+
+void
+arena_reset(Arena* a)
+{
+    size_t kept = 0;
+    ArenaBlock** link = &a->first;
+    while (*link)
+    {
+        ArenaBlock* b = *link;
+        if (kept + b->size <= ARENA_RETAIN_BYTES)
+        {
+            kept += b->size;
+            link = &b->next;
+            continue;
+        }
+        *link = b->next;
+        counters.reserved -= b->size;
+        free(b);
+    }
+    a->current = NULL;
+}
+
+void
+arena_free(Arena* a)
+{
+    ArenaBlock* b = a->first;
+    while (b)
+    {
+        ArenaBlock* next = b->next;
+        counters.reserved -= b->size;
+        free(b);
+        b = next;
+    }
+    memset(a, 0, sizeof(*a));
+}
+
+static int
+pool_class(size_t bytes)
+{
+    int c = 0;
+    while (c + 1 < ARENA_POOL_CLASSES && ((size_t)ARENA_POOL_MIN << c) < bytes)
+        ++c;
+    return c;
+}
+
+void*
+arena_pool_alloc(Arena* a, size_t bytes)
+{
+    int c = pool_class(bytes);
+    void* p = a->free_lists[c];
+    if (p)
+    {
+        memcpy(&a->free_lists[c], p, sizeof(void*));
+        counters.allocs++;
+        return p;
+    }
+    return arena_alloc(a, (size_t)ARENA_POOL_MIN << c);
+}
+
+void
+arena_pool_free(Arena* a, void* p, size_t bytes)
+{
+    if (!p)
+        return;
+    int c = pool_class(bytes);
+    memcpy(p, &a->free_lists[c], sizeof(void*));
+    a->free_lists[c] = p;
+}
+
+void*
+arena_pool_resize(Arena* a, void* p, size_t old_bytes, size_t bytes)
+{
+    if (p && pool_class(old_bytes) == pool_class(bytes))
+        return p;
+
+    void* q = arena_pool_alloc(a, bytes);
+    if (!q)
+        return NULL;
+    if (p)
+    {
+        memcpy(q, p, old_bytes < bytes ? old_bytes : bytes);
+        arena_pool_free(a, p, old_bytes);
+    }
+    return q;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "types.h"
+
+// Bump allocation from a chain of blocks that are kept when the arena is rewound, so code
+// that allocates on every event settles into reusing the same memory instead of calling
+// malloc. Allocations are 16-byte aligned and uninitialized. Main thread only.
+
+// Scratch memory for the current event; app_run resets it after each one. Callers that may
+// run outside the event loop (batch, document loading) release what they took with a mark.
+Arena* arena_frame(void);
+
+void* arena_alloc(Arena* a, size_t bytes);
+// Grows (or shrinks) p, the arena's newest allocation of old_bytes, in place when the block
+// has room; otherwise moves it. Other pointers into the arena stay valid either way.
+void* arena_resize(Arena* a, void* p, size_t old_bytes, size_t bytes);
+
+ArenaMark arena_mark(const Arena* a);
+// Forgets every allocation made since the mark; their blocks are reused.
+void arena_release(Arena* a, ArenaMark mark);
+// Forgets everything and gives blocks past ARENA_RETAIN_BYTES back to the heap.
+void arena_reset(Arena* a);
+void arena_free(Arena* a);
+
+// Power-of-two size classes with free lists on top of an arena, for long-lived data that
+// grows and shrinks piecemeal (the scene's per-document arena). Never mixed with marks.
+void* arena_pool_alloc(Arena* a, size_t bytes);
+void arena_pool_free(Arena* a, void* p, size_t bytes);
+// Moves an arena_pool_alloc'd block of old_bytes to one of `bytes`, keeping the contents.
+void* arena_pool_resize(Arena* a, void* p, size_t old_bytes, size_t bytes);
+
+// Process totals for the stats overlay.
+typedef struct
+{
+    uint64_t allocs; // arena_alloc and arena_pool_alloc calls
+    uint64_t blocks; // blocks taken from the heap
+    size_t reserved; // bytes currently held in blocks
+} ArenaCounters;
+
+ArenaCounters arena_counters(void);
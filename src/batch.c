@@ -0,0 +1,413 @@
+#include "batch.h"
+
+#include "arena.h"
+#include "document.h"
+#include "export.h"
+#include "floodfill.h"
+#include "framebuffer.h"
+#include "scene.h"
+#include "tiles.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BATCH_DEFAULT_W 600
+#define BATCH_DEFAULT_H 800
+#define BATCH_MAX_ARGS 4096
+
+typedef struct
+{
+    const char* path;
+    int line;
+
+    DisplayContext ctx;
+    bool ready;
+    int w, h;
+
+    // Shapes are queued in a scene and rasterized tile-parallel whenever the canvas is
+    // needed as a whole (clear, save, end of script). Those before `rendered` are already
+    // in the pixels; the scene keeps them until the next clear for `write`.
+    Scene scene;
+    int rendered;
+    uint32_t color;
+    int thickness;
+    int line_style;
+    int fill_rule;
+} Batch;
+
+static bool
+fail(const Batch* b, const char* message)
+{
+    fprintf(stderr, "%s:%d: %s\n", b->path, b->line, message);
+    return false;
+}
+
+static bool
+ensure_canvas(Batch* b)
+{
+    if (b->ready)
+        return true;
+
+    b->ctx = init_offscreen(b->w, b->h);
+    if (!b->ctx.fb.data)
+        return fail(b, "cannot allocate canvas");
+    b->ready = true;
+    return true;
+}
+
+static void
+flush(Batch* b)
+{
+    int first = b->scene.first;
+    b->scene.first = b->rendered;
+    render_scene_tiled(&b->scene, &b->ctx);
+    b->scene.first = first;
+    b->rendered = b->scene.count;
+}
+
+static bool
+parse_ints(const Batch* b, char** args, int count, int* out)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        char* end;
+        long v = strtol(args[i], &end, 10);
+        if (end == args[i] || *end != '\0' || v < -1000000 || v > 1000000)
+            return fail(b, "expected an integer");
+        out[i] = (int)v;
+    }
+    return true;
+}
+
+static bool
+parse_rgb(const Batch* b, char** args, uint32_t* color)
+{
+    int c[3];
+    if (!parse_ints(b, args, 3, c))
+        return false;
+    for (int i = 0; i < 3; ++i)
+        if (c[i] < 0 || c[i] > 255)
+            return fail(b, "colour components must be 0-255");
+    *color = pack_rgb((uint8_t)c[0], (uint8_t)c[1], (uint8_t)c[2]);
+    return true;
+}
+
+// `lines` and `circles` submit every shape on the line at once, in the current pen.
+static bool
+run_bulk(Batch* b, char** args, int argc, bool circles)
+{
+    int per = circles ? 3 : 4;
+    if (argc == 0 || argc % per != 0)
+        return fail(b, circles ? "usage: circles CX CY R ..." : "usage: lines X0 Y0 X1 Y1 ...");
+
+    Arena* scratch = arena_frame();
+    ArenaMark mark = arena_mark(scratch);
+    int* v = arena_alloc(scratch, (size_t)argc * sizeof(int));
+    bool ok = v && parse_ints(b, args, argc, v);
+    if (ok)
+    {
+        uint16_t style = SHAPE_STYLE(b->thickness, b->line_style);
+        int count = argc / per;
+        int added = circles ? scene_add_circles(&b->scene,
+                                  v,
+                                  NULL,
+                                  b->color,
+                                  count,
+                                  SHAPE_WITH_FILL(style, b->fill_rule))
+                            : scene_add_lines(&b->scene, v, NULL, b->color, count, style);
+        ok = added == count || fail(b, "out of memory");
+    }
+    else if (!v)
+    {
+        fail(b, "out of memory");
+    }
+    arena_release(scratch, mark);
+    return ok;
+}
+
+// `bucket X Y [TOL]` needs the pixels as drawn so far, so the queue is flushed first; the
+// filled runs join the scene as lines that count as rendered.
+static bool
+run_bucket(Batch* b, char** args, int argc)
+{
+    int v[3] = {0, 0, 0};
+    if ((argc != 2 && argc != 3) || !parse_ints(b, args, argc, v))
+        return fail(b, "usage: bucket X Y [TOL]");
+    if (v[2] < 0 || v[2] > 255)
+        return fail(b, "tolerance must be 0-255");
+
+    flush(b);
+    Arena* scratch = arena_frame();
+    ArenaMark mark = arena_mark(scratch);
+    int* spans;
+    Rect all = {0, 0, b->w, b->h};
+    int count = flood_fill(&b->ctx, all, v[0], v[1], b->color, v[2], scratch, &spans);
+    int added = scene_add_lines(&b->scene,
+        spans,
+        NULL,
+        b->color,
+        count,
+        SHAPE_STYLE(1, LINE_STYLE_SOLID));
+    arena_release(scratch, mark);
+    b->rendered = b->scene.count;
+    return added == count || fail(b, "out of memory");
+}
+
+static bool
+run_polygon(Batch* b, char** args, int argc)
+{
+    if (argc < 4 || argc % 2 != 0)
+        return fail(b, "polygon needs at least two X Y pairs");
+
+    uint16_t style = SHAPE_WITH_FILL(SHAPE_STYLE(b->thickness, b->line_style), b->fill_rule);
+    int v[2];
+    for (int i = 0; i < argc; i += 2)
+    {
+        if (!parse_ints(b, &args[i], 2, v))
+            return false;
+        if (i == 0)
+            scene_begin_polygon(&b->scene, v[0], v[1], b->color, style);
+        else
+            scene_extend_polygon(&b->scene, v[0], v[1]);
+    }
+
+    if (argc >= 6)
+    {
+        parse_ints(b, args, 2, v);
+        scene_extend_polygon(&b->scene, v[0], v[1]);
+    }
+    return true;
+}
+
+static bool
+run_command(Batch* b, char** args, int argc)
+{
+    const char* cmd = args[0];
+    char** a = &args[1];
+    int n = argc - 1;
+    int v[4];
+
+    if (strcmp(cmd, "size") == 0)
+    {
+        if (n != 2 || !parse_ints(b, a, 2, v))
+            return fail(b, "usage: size W H");
+        if (b->ready)
+            return fail(b, "size must come before drawing");
+        if (v[0] <= 0 || v[1] <= 0 || v[0] > 1 << 15 || v[1] > 1 << 15)
+            return fail(b, "canvas size out of range");
+        b->w = v[0];
+        b->h = v[1];
+        return true;
+    }
+    if (strcmp(cmd, "color") == 0)
+    {
+        if (n != 3)
+            return fail(b, "usage: color R G B");
+        return parse_rgb(b, a, &b->color);
+    }
+    if (strcmp(cmd, "thickness") == 0)
+    {
+        if (n != 1 || !parse_ints(b, a, 1, v))
+            return fail(b, "usage: thickness N");
+        if (v[0] < 1 || v[0] > 255)
+            return fail(b, "thickness must be 1-255");
+        b->thickness = v[0];
+        return true;
+    }
+    if (strcmp(cmd, "style") == 0)
+    {
+        if (n == 1 && strcmp(a[0], "solid") == 0)
+            b->line_style = 0;
+        else if (n == 1 && strcmp(a[0], "dashed") == 0)
+            b->line_style = 1;
+        else if (n == 1 && strcmp(a[0], "dotted") == 0)
+            b->line_style = 2;
+        else if (n == 1 && strcmp(a[0], "aa") == 0)
+            b->line_style = LINE_STYLE_AA;
+        else
+            return fail(b, "usage: style solid|dashed|dotted|aa");
+        return true;
+    }
+    if (strcmp(cmd, "fill") == 0)
+    {
+        if (n == 1 && strcmp(a[0], "none") == 0)
+            b->fill_rule = FILL_NONE;
+        else if (n == 1 && strcmp(a[0], "evenodd") == 0)
+            b->fill_rule = FILL_EVEN_ODD;
+        else if (n == 1 && strcmp(a[0], "nonzero") == 0)
+            b->fill_rule = FILL_NON_ZERO;
+        else
+            return fail(b, "usage: fill none|evenodd|nonzero");
+        return true;
+    }
+
+    if (!ensure_canvas(b))
+        return false;
+
+    uint16_t style = SHAPE_STYLE(b->thickness, b->line_style);
+    if (strcmp(cmd, "clear") == 0)
+    {
+        uint32_t c;
+        if (n != 3)
+            return fail(b, "usage: clear R G B");
+        if (!parse_rgb(b, a, &c))
+            return false;
+        scene_free(&b->scene);
+        b->rendered = 0;
+        uint8_t cr, cg, cb;
+        unpack_rgb(c, &cr, &cg, &cb);
+        fill_framebuffer(&b->ctx, cr, cg, cb);
+    }
+    else if (strcmp(cmd, "point") == 0)
+    {
+        if (n != 2 || !parse_ints(b, a, 2, v))
+            return fail(b, "usage: point X Y");
+        scene_add_point(&b->scene, v[0], v[1], b->color, style);
+    }
+    else if (strcmp(cmd, "line") == 0)
+    {
+        if (n != 4 || !parse_ints(b, a, 4, v))
+            return fail(b, "usage: line X0 Y0 X1 Y1");
+        scene_add_line(&b->scene, v[0], v[1], v[2], v[3], b->color, style);
+    }
+    else if (strcmp(cmd, "circle") == 0)
+    {
+        if (n != 3 || !parse_ints(b, a, 3, v))
+            return fail(b, "usage: circle CX CY R");
+        scene_add_circle(
+            &b->scene, v[0], v[1], v[2], b->color, SHAPE_WITH_FILL(style, b->fill_rule)
+        );
+    }
+    else if (strcmp(cmd, "lines") == 0 || strcmp(cmd, "circles") == 0)
+    {
+        return run_bulk(b, a, n, cmd[0] == 'c');
+    }
+    else if (strcmp(cmd, "polygon") == 0)
+    {
+        return run_polygon(b, a, n);
+    }
+    else if (strcmp(cmd, "bucket") == 0)
+    {
+        return run_bucket(b, a, n);
+    }
+    else if (strcmp(cmd, "save") == 0)
+    {
+        if (n != 1)
+            return fail(b, "usage: save PATH");
+        flush(b);
+        // Encoded while the script goes on; what it draws next is copied around the export.
+        if (!export_wait())
+            return fail(b, "previous save failed");
+        if (!export_start(&b->ctx, b->ctx.clip, a[0]))
+            return fail(b, "cannot write image");
+    }
+    else if (strcmp(cmd, "write") == 0)
+    {
+        if (n != 1)
+            return fail(b, "usage: write PATH");
+        flush(b);
+        if (!document_save(a[0], &b->scene, &b->ctx))
+            return fail(b, "cannot write document");
+    }
+    else if (strcmp(cmd, "read") == 0)
+    {
+        if (n != 1)
+            return fail(b, "usage: read PATH");
+        if (!document_load(a[0], &b->scene, NULL))
+            return fail(b, "cannot read document");
+    }
+    else
+    {
+        return fail(b, "unknown command");
+    }
+    return true;
+}
+
+// Splits line in place on whitespace, stopping at a '#' comment.
+static int
+split_args(char* line, char** args, int max)
+{
+    int argc = 0;
+    char* p = line;
+    while (*p && argc < max)
+    {
+        while (isspace((unsigned char)*p))
+            p++;
+        if (!*p || *p == '#')
+            break;
+        args[argc++] = p;
+        while (*p && !isspace((unsigned char)*p))
+            p++;
+        if (*p)
+            *p++ = '\0';
+    }
+    return argc;
+}
+
+bool
+batch_run(const char* script_path, const char* out_path)
+{
+    Batch b = {
+        .path = script_path,
+        .w = BATCH_DEFAULT_W,
+        .h = BATCH_DEFAULT_H,
+        .color = pack_rgb(255, 255, 255),
+        .thickness = 1,
+    };
+
+    FILE* f = fopen(script_path, "r");
+    if (!f)
+    {
+        fprintf(stderr, "%s: cannot open script\n", script_path);
+        return false;
+    }
+
+    char** args = malloc(BATCH_MAX_ARGS * sizeof(char*));
+    char* line = NULL;
+    size_t line_cap = 0;
+    bool ok = args != NULL;
+    while (ok && getline(&line, &line_cap, f) >= 0)
+    {
+        b.line++;
+        int argc = split_args(line, args, BATCH_MAX_ARGS);
+        if (argc == BATCH_MAX_ARGS)
+            ok = fail(&b, "too many arguments");
+        else if (argc > 0)
+            ok = run_command(&b, args, argc);
+    }
+    free(line);
+    free(args);
+    fclose(f);
+
+    if (ok && ensure_canvas(&b))
+    {
+        flush(&b);
+        if (!export_wait())
+        {
+            ok = false;
+        }
+        else if (!export_start(&b.ctx, b.ctx.clip, out_path))
+        {
+            fprintf(stderr, "%s: cannot write image\n", out_path);
+            ok = false;
+        }
+        else
+        {
+            ok = export_wait();
+        }
+    }
+    else
+    {
+        ok = false;
+    }
+
+    if (!export_wait())
+        ok = false;
+    scene_free(&b.scene);
+    arena_free(arena_frame());
+    if (b.ready)
+        cleanup_offscreen(&b.ctx);
+    return ok;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Runs a draw script on an offscreen target with no X server and no event loop, then writes
+// the result to out_path, as PNG when it ends in ".png" and as PPM otherwise. One command per
+// line, '#' starts a comment:
+//
+//   size W H              canvas size, before anything is drawn (default 600 x 800)
+//   clear R G B           fill the canvas
+//   color R G B           pen colour for later shapes
+//   thickness N           pen width
+//   style solid|dashed|dotted|aa
+//   fill none|evenodd|nonzero     interior rule for later polygons; circles fill with either
+//   point X Y
+//   line X0 Y0 X1 Y1
+//   circle CX CY R        outline, on a disc unless `fill none`
+//   lines X0 Y0 X1 Y1 ...           any number of lines in one submission
+//   circles CX CY R ...             any number of circles, filled like `circle`
+//   polygon X0 Y0 X1 Y1 X2 Y2 ...   closed outline, filled unless `fill none`
+//   bucket X Y [TOL]      flood the region around X Y, channels within TOL (default 0)
+//   save PATH             write the canvas so far (PNG or PPM by extension), in the background
+//   write PATH            save the shapes since the last clear (and the pixels) as a document
+//   read PATH             draw the shapes of a document (see document.h)
+//
+// Errors are reported on stderr as path:line: message. Returns true on success.
+bool batch_run(const char* script_path, const char* out_path);
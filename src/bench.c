@@ -0,0 +1,401 @@
+// soft_renderer_bench: times each rasterizer over seeded random workloads on an offscreen
+// target. Pixel counts come from a calibration pass that records every primitive into the
+// overlay, so Mpix/s and cycles/pixel are per pixel actually written, including overdraw.
+
+#include "damage.h"
+#include "draw.h"
+#include "framebuffer.h"
+#include "kernels.h"
+#include "overlay.h"
+#include "parallel.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#else
+#define HAVE_TSC 0
+#endif
+
+#define BENCH_DEFAULT_W 1920
+#define BENCH_DEFAULT_H 1080
+#define BENCH_PRIMS 4096
+#define BENCH_DEFAULT_MIN_MS 200
+
+typedef enum
+{
+    PRIM_LINE,
+    PRIM_LINE_THICK,
+    PRIM_DASHED,
+    PRIM_LINE_AA,
+    PRIM_CIRCLE,
+    PRIM_CIRCLE_AA,
+    PRIM_DISC,
+    PRIM_FILL,
+} PrimKind;
+
+typedef enum
+{
+    SIZE_SHORT, // lines up to 16 px, radii 1-16
+    SIZE_MEDIUM, // radii 16-128
+    SIZE_LONG, // lines up to the canvas size, radii 128-512
+} SizeClass;
+
+typedef struct
+{
+    const char* name;
+    PrimKind kind;
+    SizeClass size;
+    int thickness;
+    bool clipped;
+} BenchCase;
+
+static const BenchCase cases[] = {
+    {"line/short", PRIM_LINE, SIZE_SHORT, 1, false},
+    {"line/long", PRIM_LINE, SIZE_LONG, 1, false},
+    {"line/long/clipped", PRIM_LINE, SIZE_LONG, 1, true},
+    {"line_thick/short/t3", PRIM_LINE_THICK, SIZE_SHORT, 3, false},
+    {"line_thick/short/t6", PRIM_LINE_THICK, SIZE_SHORT, 6, false},
+    {"line_thick/long/t1", PRIM_LINE_THICK, SIZE_LONG, 1, false},
+    {"line_thick/long/t3", PRIM_LINE_THICK, SIZE_LONG, 3, false},
+    {"line_thick/long/t6", PRIM_LINE_THICK, SIZE_LONG, 6, false},
+    {"line_thick/long/t6/clipped", PRIM_LINE_THICK, SIZE_LONG, 6, true},
+    {"dashed/long/t1", PRIM_DASHED, SIZE_LONG, 1, false},
+    {"dashed/long/t3", PRIM_DASHED, SIZE_LONG, 3, false},
+    {"dashed/long/t6", PRIM_DASHED, SIZE_LONG, 6, false},
+    {"dashed/long/t6/clipped", PRIM_DASHED, SIZE_LONG, 6, true},
+    {"line_aa/short/t1", PRIM_LINE_AA, SIZE_SHORT, 1, false},
+    {"line_aa/long/t1", PRIM_LINE_AA, SIZE_LONG, 1, false},
+    {"line_aa/long/t6", PRIM_LINE_AA, SIZE_LONG, 6, false},
+    {"line_aa/long/t6/clipped", PRIM_LINE_AA, SIZE_LONG, 6, true},
+    {"circle/small/t1", PRIM_CIRCLE, SIZE_SHORT, 1, false},
+    {"circle/medium/t1", PRIM_CIRCLE, SIZE_MEDIUM, 1, false},
+    {"circle/large/t1", PRIM_CIRCLE, SIZE_LONG, 1, false},
+    {"circle/medium/t3", PRIM_CIRCLE, SIZE_MEDIUM, 3, false},
+    {"circle/medium/t6", PRIM_CIRCLE, SIZE_MEDIUM, 6, false},
+    {"circle/large/t6/clipped", PRIM_CIRCLE, SIZE_LONG, 6, true},
+    {"circle_aa/medium/t1", PRIM_CIRCLE_AA, SIZE_MEDIUM, 1, false},
+    {"circle_aa/medium/t6", PRIM_CIRCLE_AA, SIZE_MEDIUM, 6, false},
+    {"circle_aa/large/t6/clipped", PRIM_CIRCLE_AA, SIZE_LONG, 6, true},
+    {"disc/small", PRIM_DISC, SIZE_SHORT, 1, false},
+    {"disc/medium", PRIM_DISC, SIZE_MEDIUM, 1, false},
+    {"disc/large/clipped", PRIM_DISC, SIZE_LONG, 1, true},
+    {"fill_framebuffer", PRIM_FILL, SIZE_LONG, 1, false},
+};
+
+#define CASE_COUNT ((int)(sizeof(cases) / sizeof(cases[0])))
+
+typedef struct
+{
+    int a, b, c, d; // x0 y0 x1 y1, or cx cy radius
+    uint32_t color;
+} Prim;
+
+typedef struct
+{
+    const BenchCase* bench;
+    long long prims;
+    long long pixels;
+    double seconds;
+    double cycles;
+} BenchResult;
+
+static uint64_t rng_state;
+
+// xorshift64*: fast and reproducible across platforms for a given seed.
+static uint32_t
+rng_next(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (uint32_t)((rng_state * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+// Uniform in [lo, hi].
+static int
+rng_range(int lo, int hi)
+{
+    return lo + (int)(rng_next() % (uint32_t)(hi - lo + 1));
+}
+
+static void
+generate(const BenchCase* bc, int w, int h, Prim* prims)
+{
+    int pad = bc->thickness;
+    for (int i = 0; i < BENCH_PRIMS; ++i)
+    {
+        Prim* p = &prims[i];
+        p->color = rng_next() & 0xffffff;
+
+        if (bc->kind == PRIM_CIRCLE || bc->kind == PRIM_CIRCLE_AA || bc->kind == PRIM_DISC)
+        {
+            int lo = bc->size == SIZE_SHORT ? 1 : bc->size == SIZE_MEDIUM ? 16 : 128;
+            int hi = bc->size == SIZE_SHORT ? 16 : bc->size == SIZE_MEDIUM ? 128 : 512;
+            int r = rng_range(lo, hi);
+            if (bc->clipped)
+            {
+                p->a = rng_range(-w / 4, w + w / 4);
+                p->b = rng_range(-h / 4, h + h / 4);
+            }
+            else
+            {
+                int max_r = (w < h ? w : h) / 2 - pad - 1;
+                if (r > max_r)
+                    r = max_r;
+                p->a = rng_range(r + pad, w - 1 - r - pad);
+                p->b = rng_range(r + pad, h - 1 - r - pad);
+            }
+            p->c = r;
+            continue;
+        }
+
+        // Lines: random dx, dy signs and magnitudes cover every octant.
+        if (bc->clipped)
+        {
+            p->a = rng_range(-w / 2, w + w / 2);
+            p->b = rng_range(-h / 2, h + h / 2);
+            p->c = rng_range(-w / 2, w + w / 2);
+            p->d = rng_range(-h / 2, h + h / 2);
+        }
+        else if (bc->size == SIZE_SHORT)
+        {
+            p->a = rng_range(16 + pad, w - 17 - pad);
+            p->b = rng_range(16 + pad, h - 17 - pad);
+            p->c = p->a + rng_range(-16, 16);
+            p->d = p->b + rng_range(-16, 16);
+        }
+        else
+        {
+            p->a = rng_range(pad, w - 1 - pad);
+            p->b = rng_range(pad, h - 1 - pad);
+            p->c = rng_range(pad, w - 1 - pad);
+            p->d = rng_range(pad, h - 1 - pad);
+        }
+    }
+}
+
+static void
+draw_prim(DisplayContext* ctx, const BenchCase* bc, const Prim* p)
+{
+    uint8_t r = (uint8_t)(p->color >> 16);
+    uint8_t g = (uint8_t)(p->color >> 8);
+    uint8_t b = (uint8_t)p->color;
+
+    switch (bc->kind)
+    {
+    case PRIM_LINE:
+        draw_line(ctx, p->a, p->b, p->c, p->d, r, g, b);
+        break;
+    case PRIM_LINE_THICK:
+        draw_line_thick(ctx, p->a, p->b, p->c, p->d, bc->thickness, r, g, b);
+        break;
+    case PRIM_DASHED:
+        draw_dashed_line_thick(ctx, p->a, p->b, p->c, p->d, bc->thickness, 6, 4, r, g, b);
+        break;
+    case PRIM_LINE_AA:
+    {
+        Stroke pen = stroke_make(p->color, bc->thickness, LINE_STYLE_AA);
+        stroke_line(ctx, &pen, p->a, p->b, p->c, p->d);
+        break;
+    }
+    case PRIM_CIRCLE:
+        draw_circle(ctx, p->a, p->b, p->c, bc->thickness, false, r, g, b);
+        break;
+    case PRIM_CIRCLE_AA:
+    {
+        Stroke pen = stroke_make(p->color, bc->thickness, LINE_STYLE_AA);
+        stroke_circle(ctx, &pen, p->a, p->b, p->c);
+        break;
+    }
+    case PRIM_DISC:
+        fill_circle(ctx, p->a, p->b, p->c, p->color);
+        break;
+    case PRIM_FILL:
+        fill_framebuffer(ctx, r, g, b);
+        break;
+    }
+}
+
+// Pixels written by one pass over the workload, counted from the spans each primitive leaves
+// in the overlay.
+static long long
+count_pixels(DisplayContext* ctx, const BenchCase* bc, const Prim* prims)
+{
+    long long pixels = 0;
+    for (int i = 0; i < BENCH_PRIMS; ++i)
+    {
+        overlay_begin(ctx);
+        draw_prim(ctx, bc, &prims[i]);
+        overlay_end(ctx);
+        for (int s = 0; s < ctx->overlay.count; ++s)
+            pixels += ctx->overlay.spans[s].x1 - ctx->overlay.spans[s].x0;
+        overlay_clear(ctx);
+    }
+    damage_reset(ctx);
+    return pixels;
+}
+
+static double
+now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static uint64_t
+read_cycles(void)
+{
+#if HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static BenchResult
+run_case(DisplayContext* ctx, const BenchCase* bc, Prim* prims, double min_seconds)
+{
+    generate(bc, ctx->w, ctx->h, prims);
+
+    // fill_framebuffer touches the whole canvas; a handful of calls per pass is plenty.
+    int per_pass = bc->kind == PRIM_FILL ? 16 : BENCH_PRIMS;
+    long long pixels_per_pass = bc->kind == PRIM_FILL ? (long long)ctx->w * ctx->h * per_pass
+                                                      : count_pixels(ctx, bc, prims);
+
+    BenchResult res = {bc, 0, 0, 0.0, 0.0};
+    double start = now_seconds();
+    uint64_t cycles_start = read_cycles();
+    do
+    {
+        for (int i = 0; i < per_pass; ++i)
+            draw_prim(ctx, bc, &prims[i]);
+        // A presented frame would reset damage; keep merging cost representative.
+        damage_reset(ctx);
+        res.prims += per_pass;
+        res.pixels += pixels_per_pass;
+        res.seconds = now_seconds() - start;
+    } while (res.seconds < min_seconds);
+    res.cycles = (double)(read_cycles() - cycles_start);
+    return res;
+}
+
+static void
+print_text(const BenchResult* results, int count)
+{
+    printf("%-28s %12s %10s %10s %10s\n", "case", "prims", "Mpix/s", "ns/prim", "cyc/px");
+    for (int i = 0; i < count; ++i)
+    {
+        const BenchResult* r = &results[i];
+        double mpix = r->pixels / r->seconds * 1e-6;
+        double ns = r->seconds * 1e9 / (double)r->prims;
+        double cpp = r->pixels > 0 ? r->cycles / (double)r->pixels : 0.0;
+        printf("%-28s %12lld %10.1f %10.1f ", r->bench->name, r->prims, mpix, ns);
+        if (HAVE_TSC)
+            printf("%10.2f\n", cpp);
+        else
+            printf("%10s\n", "-");
+    }
+}
+
+static void
+print_json(const BenchResult* results, int count, int w, int h, uint64_t seed)
+{
+    printf("{\n");
+    printf(
+        "  \"width\": %d,\n  \"height\": %d,\n  \"seed\": %llu,\n", w, h, (unsigned long long)seed
+    );
+    printf("  \"kernels\": \"%s\",\n  \"threads\": %d,\n", kernels_name(), parallel_threads());
+    printf("  \"cycles\": \"%s\",\n", HAVE_TSC ? "tsc" : "unavailable");
+    printf("  \"results\": [\n");
+    for (int i = 0; i < count; ++i)
+    {
+        const BenchResult* r = &results[i];
+        printf("    {\"name\": \"%s\", \"prims\": %lld, \"pixels\": %lld, \"seconds\": %.6f, "
+               "\"mpix_per_s\": %.3f, \"ns_per_prim\": %.3f, ",
+            r->bench->name,
+            r->prims,
+            r->pixels,
+            r->seconds,
+            r->pixels / r->seconds * 1e-6,
+            r->seconds * 1e9 / (double)r->prims);
+        if (HAVE_TSC && r->pixels > 0)
+            printf("\"cycles_per_px\": %.4f}", r->cycles / (double)r->pixels);
+        else
+            printf("\"cycles_per_px\": null}");
+        printf("%s\n", i + 1 < count ? "," : "");
+    }
+    printf("  ]\n}\n");
+}
+
+static int
+usage(const char* argv0)
+{
+    fprintf(stderr,
+        "usage: %s [--json] [--seed N] [--size WxH] [--min-ms N] [--filter SUBSTRING]\n",
+        argv0);
+    return 2;
+}
+
+int
+main(int argc, char** argv)
+{
+    bool json = false;
+    uint64_t seed = 1;
+    int w = BENCH_DEFAULT_W;
+    int h = BENCH_DEFAULT_H;
+    int min_ms = BENCH_DEFAULT_MIN_MS;
+    const char* filter = NULL;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--json") == 0)
+            json = true;
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+            seed = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc)
+        {
+            if (sscanf(argv[++i], "%dx%d", &w, &h) != 2 || w < 64 || h < 64)
+                return usage(argv[0]);
+        }
+        else if (strcmp(argv[i], "--min-ms") == 0 && i + 1 < argc)
+            min_ms = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+            filter = argv[++i];
+        else
+            return usage(argv[0]);
+    }
+
+    DisplayContext ctx = init_offscreen(w, h);
+    Prim* prims = malloc(BENCH_PRIMS * sizeof(Prim));
+    BenchResult results[CASE_COUNT];
+    if (!ctx.fb.data || !prims)
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    int count = 0;
+    for (int i = 0; i < CASE_COUNT; ++i)
+    {
+        if (filter && !strstr(cases[i].name, filter))
+            continue;
+        // Every case sees the same stream for a given seed, independent of the filter.
+        rng_state = (seed + (uint64_t)i) * 0x9E3779B97F4A7C15ULL | 1;
+        results[count++] = run_case(&ctx, &cases[i], prims, min_ms * 1e-3);
+    }
+
+    if (json)
+        print_json(results, count, w, h, seed);
+    else
+        print_text(results, count);
+
+    free(prims);
+    cleanup_offscreen(&ctx);
+    return 0;
+}
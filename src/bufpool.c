@@ -0,0 +1,94 @@
+#include "bufpool.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define POOL_MIN_CLASS 4096
+#define POOL_HUGE_PAGE ((size_t)2 << 20)
+#define POOL_MAX_CACHED 8
+
+typedef struct
+{
+    void* data;
+    size_t capacity;
+} PoolEntry;
+
+// Oldest first; a full cache frees its oldest entry.
+static PoolEntry cached[POOL_MAX_CACHED];
+static int cached_count;
+
+size_t
+pool_size_class(size_t bytes)
+{
+    size_t base = POOL_MIN_CLASS;
+    while (base * 2 <= bytes)
+        base *= 2;
+
+    size_t size = base;
+    for (int quarter = 1; size < bytes && quarter <= 4; ++quarter)
+        size = base + base / 4 * (size_t)quarter;
+
+    if (size >= POOL_HUGE_PAGE)
+        size = (size + POOL_HUGE_PAGE - 1) / POOL_HUGE_PAGE * POOL_HUGE_PAGE;
+    return size;
+}
+
+void*
+pool_acquire(size_t bytes, size_t* capacity)
+{
+    size_t size = pool_size_class(bytes);
+
+    // Smallest cached buffer that fits without wasting more than one doubling.
+    int best = -1;
+    for (int i = 0; i < cached_count; ++i)
+    {
+        size_t c = cached[i].capacity;
+        if (c >= bytes && c <= 2 * size && (best < 0 || c < cached[best].capacity))
+            best = i;
+    }
+    if (best >= 0)
+    {
+        void* data = cached[best].data;
+        *capacity = cached[best].capacity;
+        cached_count--;
+        memmove(&cached[best],
+            &cached[best + 1],
+            (size_t)(cached_count - best) * sizeof(PoolEntry));
+        return data;
+    }
+
+    bool huge = size >= POOL_HUGE_PAGE;
+    void* data = aligned_alloc(huge ? POOL_HUGE_PAGE : 64, size);
+    if (!data)
+        return NULL;
+#ifdef MADV_HUGEPAGE
+    if (huge)
+        madvise(data, size, MADV_HUGEPAGE);
+#endif
+    *capacity = size;
+    return data;
+}
+
+void
+pool_release(void* data, size_t capacity)
+{
+    if (!data)
+        return;
+    if (cached_count == POOL_MAX_CACHED)
+    {
+        free(cached[0].data);
+        memmove(&cached[0], &cached[1], (size_t)(POOL_MAX_CACHED - 1) * sizeof(PoolEntry));
+        cached_count--;
+    }
+    cached[cached_count++] = (PoolEntry){data, capacity};
+}
+
+void
+pool_drain(void)
+{
+    for (int i = 0; i < cached_count; ++i)
+        free(cached[i].data);
+    cached_count = 0;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stddef.h>
+
+// Pixel buffers that come and go with the window size. Requests round up to a size class
+// (four per doubling, whole 2 MiB pages once that large) and released buffers are kept for
+// reuse, so a drag-resize settles into a handful of allocations instead of one per event.
+// Large buffers are 2 MiB aligned and advised for transparent huge pages. Main thread only.
+size_t pool_size_class(size_t bytes);
+
+// Returns at least `bytes` of uninitialized memory, and its usable size in *capacity, or NULL.
+void* pool_acquire(size_t bytes, size_t* capacity);
+void pool_release(void* data, size_t capacity);
+
+// Frees every cached buffer.
+void pool_drain(void);
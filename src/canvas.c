@@ -0,0 +1,493 @@
+#include "canvas.h"
+
+#include "damage.h"
+#include "framebuffer.h"
+#include "kernels.h"
+#include "overlay.h"
+#include "tiles.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define CANVAS_DEFAULT_MB 256
+#define CANVAS_MIN_RESIDENT 16
+#define CANVAS_TILE_BYTES ((size_t)CANVAS_TILE_W * CANVAS_TILE_H * sizeof(uint32_t))
+
+// How far the view may be panned past the top and left edges.
+#define CANVAS_PAN_MARGIN 256
+
+// Window pixels outside the canvas.
+#define BACKDROP pack_rgb(48, 48, 48)
+
+#define TILE_RESIDENT 1
+#define TILE_WRITTEN 2
+
+static Rect
+tile_rect(const Canvas* c, int t)
+{
+    int x0 = (t % c->tiles_x) * CANVAS_TILE_W;
+    int y0 = (t / c->tiles_x) * CANVAS_TILE_H;
+    int y1 = y0 + CANVAS_TILE_H < c->ctx.h ? y0 + CANVAS_TILE_H : c->ctx.h;
+    return (Rect){x0, y0, x0 + CANVAS_TILE_W, y1};
+}
+
+static void
+lru_unlink(Canvas* c, int t)
+{
+    int prev = c->lru_prev[t];
+    int next = c->lru_next[t];
+    if (prev >= 0)
+        c->lru_next[prev] = next;
+    else
+        c->lru_head = next;
+    if (next >= 0)
+        c->lru_prev[next] = prev;
+    else
+        c->lru_tail = prev;
+}
+
+static void
+lru_push_front(Canvas* c, int t)
+{
+    c->lru_prev[t] = -1;
+    c->lru_next[t] = c->lru_head;
+    if (c->lru_head >= 0)
+        c->lru_prev[c->lru_head] = t;
+    else
+        c->lru_tail = t;
+    c->lru_head = t;
+}
+
+// Unmaps the pages of a tile. Dirty ones stay in the page cache until written back, so the
+// next access reads the same pixels back from the file.
+static void
+evict(Canvas* c, int t)
+{
+    lru_unlink(c, t);
+    c->tile_flags[t] &= (uint8_t)~TILE_RESIDENT;
+    c->resident--;
+
+    Rect r = tile_rect(c, t);
+    for (int y = r.y0; y < r.y1; ++y)
+        madvise(&c->ctx.fb.data[(size_t)y * (size_t)c->ctx.w + (size_t)r.x0],
+            CANVAS_TILE_W * sizeof(uint32_t),
+            MADV_DONTNEED);
+}
+
+static int
+tiles_under(Rect area)
+{
+    if (area.x1 <= area.x0 || area.y1 <= area.y0)
+        return 0;
+    int tx = (area.x1 - 1) / CANVAS_TILE_W - area.x0 / CANVAS_TILE_W + 1;
+    int ty = (area.y1 - 1) / CANVAS_TILE_H - area.y0 / CANVAS_TILE_H + 1;
+    return tx * ty;
+}
+
+// Marks the tiles under `area` as most recently used, evicting past the cap. Zoomed out the
+// view can sample more tiles than the cap allows, so it is raised to the view: otherwise
+// a composite would evict the tiles it is about to read.
+static void
+touch(Canvas* c, Rect area, bool written)
+{
+    if (area.x1 <= area.x0 || area.y1 <= area.y0)
+        return;
+
+    int cap = c->resident_cap > c->view_tiles ? c->resident_cap : c->view_tiles;
+    int tx0 = area.x0 / CANVAS_TILE_W;
+    int tx1 = (area.x1 - 1) / CANVAS_TILE_W;
+    int ty0 = area.y0 / CANVAS_TILE_H;
+    int ty1 = (area.y1 - 1) / CANVAS_TILE_H;
+    for (int ty = ty0; ty <= ty1; ++ty)
+    {
+        for (int tx = tx0; tx <= tx1; ++tx)
+        {
+            int t = ty * c->tiles_x + tx;
+            if (written)
+                c->tile_flags[t] |= TILE_WRITTEN;
+
+            if (c->tile_flags[t] & TILE_RESIDENT)
+            {
+                if (c->lru_head != t)
+                {
+                    lru_unlink(c, t);
+                    lru_push_front(c, t);
+                }
+                continue;
+            }
+
+            c->tile_flags[t] |= TILE_RESIDENT;
+            lru_push_front(c, t);
+            c->resident++;
+            while (c->resident > cap)
+                evict(c, c->lru_tail);
+        }
+    }
+}
+
+static void
+canvas_hook(void* user, DisplayContext* ctx, Rect area)
+{
+    (void)ctx;
+    touch(user, area, true);
+}
+
+static int
+open_backing(const char* path)
+{
+    if (path)
+        return open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+
+    const char* dir = getenv("TMPDIR");
+    char name[4096];
+    snprintf(name, sizeof(name), "%s/soft_renderer-canvas-XXXXXX", dir && *dir ? dir : "/tmp");
+    int fd = mkstemp(name);
+    if (fd >= 0)
+        unlink(name);
+    return fd;
+}
+
+bool
+canvas_open(Canvas* c, int w, int h, const char* path)
+{
+    memset(c, 0, sizeof(*c));
+    c->fd = -1;
+    if (w <= 0 || h <= 0 || w > CANVAS_MAX_SIDE || h > CANVAS_MAX_SIDE)
+        return false;
+    w = (w + CANVAS_TILE_W - 1) / CANVAS_TILE_W * CANVAS_TILE_W;
+
+    int fd = open_backing(path);
+    if (fd < 0)
+        return false;
+
+    // A freshly truncated file is all holes: black pixels that cost nothing until written.
+    size_t bytes = (size_t)w * (size_t)h * sizeof(uint32_t);
+    void* map = MAP_FAILED;
+    if (ftruncate(fd, (off_t)bytes) == 0)
+        map = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        close(fd);
+        return false;
+    }
+
+    framebuffer_attach(&c->ctx, w, h, map);
+    c->fd = fd;
+    c->map_bytes = bytes;
+    c->lru_head = -1;
+    c->lru_tail = -1;
+
+    c->tiles_x = w / CANVAS_TILE_W;
+    c->tiles_y = (h + CANVAS_TILE_H - 1) / CANVAS_TILE_H;
+    size_t tiles = (size_t)c->tiles_x * (size_t)c->tiles_y;
+    c->tile_flags = calloc(tiles, 1);
+    c->lru_prev = malloc(tiles * sizeof(int32_t));
+    c->lru_next = malloc(tiles * sizeof(int32_t));
+
+    const char* mb = getenv("SOFT_RENDERER_CANVAS_MB");
+    int cap_mb = mb ? atoi(mb) : CANVAS_DEFAULT_MB;
+    if (cap_mb <= 0)
+        cap_mb = CANVAS_DEFAULT_MB;
+    size_t cap = ((size_t)cap_mb << 20) / CANVAS_TILE_BYTES;
+    c->resident_cap = cap < CANVAS_MIN_RESIDENT ? CANVAS_MIN_RESIDENT : (int)cap;
+
+    if (!c->tile_flags || !c->lru_prev || !c->lru_next
+        || !damage_add_hook(&c->ctx, canvas_hook, c))
+    {
+        canvas_close(c);
+        return false;
+    }
+    return true;
+}
+
+void
+canvas_close(Canvas* c)
+{
+    damage_remove_hook(&c->ctx, canvas_hook, c);
+    if (c->ctx.fb.data)
+        munmap(c->ctx.fb.data, c->map_bytes);
+    if (c->fd >= 0)
+        close(c->fd);
+    overlay_free(&c->ctx);
+    free(c->tile_flags);
+    free(c->lru_prev);
+    free(c->lru_next);
+    memset(c, 0, sizeof(*c));
+    c->fd = -1;
+}
+
+// Canvas offset shown at window offset v.
+static int
+to_canvas(int v, int zoom)
+{
+    return zoom >= 0 ? v >> zoom : v * (1 << -zoom);
+}
+
+// First window offset showing canvas offset d or beyond.
+static int
+to_window(int d, int zoom)
+{
+    if (zoom >= 0)
+        return d * (1 << zoom);
+    int k = -zoom;
+    return d >= 0 ? (d + (1 << k) - 1) >> k : -((-d) >> k);
+}
+
+static Rect
+window_rect(const Canvas* c, Rect r)
+{
+    return (Rect){to_window(r.x0 - c->view_x, c->zoom),
+        to_window(r.y0 - c->view_y, c->zoom),
+        to_window(r.x1 - c->view_x, c->zoom),
+        to_window(r.y1 - c->view_y, c->zoom)};
+}
+
+// Canvas pixels sampled by the window rect r, clamped to the canvas.
+static Rect
+canvas_rect(const Canvas* c, Rect r)
+{
+    Rect v = {c->view_x + to_canvas(r.x0, c->zoom),
+        c->view_y + to_canvas(r.y0, c->zoom),
+        c->view_x + to_canvas(r.x1 - 1, c->zoom) + 1,
+        c->view_y + to_canvas(r.y1 - 1, c->zoom) + 1};
+    if (v.x0 < 0)
+        v.x0 = 0;
+    if (v.y0 < 0)
+        v.y0 = 0;
+    if (v.x1 > c->ctx.w)
+        v.x1 = c->ctx.w;
+    if (v.y1 > c->ctx.h)
+        v.y1 = c->ctx.h;
+    if (v.x1 <= v.x0 || v.y1 <= v.y0)
+        return (Rect){0, 0, 0, 0};
+    return v;
+}
+
+void
+canvas_from_window(const Canvas* c, int wx, int wy, int* x, int* y)
+{
+    *x = c->view_x + to_canvas(wx, c->zoom);
+    *y = c->view_y + to_canvas(wy, c->zoom);
+}
+
+Rect
+canvas_visible(const Canvas* c, const DisplayContext* win)
+{
+    if (win->clip.x1 <= win->clip.x0 || win->clip.y1 <= win->clip.y0)
+        return (Rect){0, 0, 0, 0};
+    return canvas_rect(c, win->clip);
+}
+
+static void
+move_view(Canvas* c, int x, int y)
+{
+    if (x > c->ctx.w - 1)
+        x = c->ctx.w - 1;
+    if (x < -CANVAS_PAN_MARGIN)
+        x = -CANVAS_PAN_MARGIN;
+    if (y > c->ctx.h - 1)
+        y = c->ctx.h - 1;
+    if (y < -CANVAS_PAN_MARGIN)
+        y = -CANVAS_PAN_MARGIN;
+    if (x == c->view_x && y == c->view_y)
+        return;
+
+    c->view_x = x;
+    c->view_y = y;
+    c->view_changed = true;
+}
+
+void
+canvas_pan(Canvas* c, int dx, int dy)
+{
+    move_view(c, c->view_x + to_canvas(dx, c->zoom), c->view_y + to_canvas(dy, c->zoom));
+}
+
+void
+canvas_grab(Canvas* c, int x, int y, int wx, int wy)
+{
+    move_view(c, x - to_canvas(wx, c->zoom), y - to_canvas(wy, c->zoom));
+}
+
+void
+canvas_zoom(Canvas* c, int steps, int wx, int wy)
+{
+    int zoom = c->zoom + steps;
+    if (zoom < CANVAS_ZOOM_MIN)
+        zoom = CANVAS_ZOOM_MIN;
+    if (zoom > CANVAS_ZOOM_MAX)
+        zoom = CANVAS_ZOOM_MAX;
+    if (zoom == c->zoom)
+        return;
+
+    int x, y;
+    canvas_from_window(c, wx, wy, &x, &y);
+    c->zoom = zoom;
+    c->view_changed = true;
+    canvas_grab(c, x, y, wx, wy);
+}
+
+void
+canvas_clear(Canvas* c)
+{
+    int tiles = c->tiles_x * c->tiles_y;
+    for (int t = 0; t < tiles; ++t)
+    {
+        if (!(c->tile_flags[t] & TILE_WRITTEN))
+            continue;
+
+        Rect r = tile_rect(c, t);
+        damage_rect(&c->ctx, r.x0, r.y0, r.x1, r.y1);
+        for (int y = r.y0; y < r.y1; ++y)
+            fill_span(&c->ctx, y, r.x0, r.x1, pack_rgb(0, 0, 0));
+        c->tile_flags[t] &= (uint8_t)~TILE_WRITTEN;
+    }
+}
+
+void
+canvas_rasterize_visible(Canvas* c, const DisplayContext* win, const Scene* scene)
+{
+    Rect v = canvas_visible(c, win);
+    if (v.x1 <= v.x0)
+        return;
+
+    Rect clip = c->ctx.clip;
+    c->ctx.clip = v;
+    damage_rect(&c->ctx, v.x0, v.y0, v.x1, v.y1);
+    for (int y = v.y0; y < v.y1; ++y)
+        fill_span(&c->ctx, y, v.x0, v.x1, pack_rgb(0, 0, 0));
+    render_scene_tiled(scene, &c->ctx);
+    c->ctx.clip = clip;
+}
+
+// One window row at zoom 0: a slice of canvas row `src` starting at canvas column x.
+static void
+copy_row(uint32_t* dst, const uint32_t* src, int x, int n, int w)
+{
+    int left = x < 0 ? (-x < n ? -x : n) : 0;
+    int right = w - x < n ? (w - x > left ? w - x : left) : n;
+    span_fill32(dst, BACKDROP, (size_t)left);
+    span_copy32(&dst[left], &src[x + left], (size_t)(right - left));
+    span_fill32(&dst[right], BACKDROP, (size_t)(n - right));
+}
+
+// Redraws the window rect r from the canvas. Only the canvas pixels in view are read, so
+// only their pages are faulted in.
+static void
+composite(Canvas* c, DisplayContext* win, Rect r)
+{
+    const Rect* clip = &win->clip;
+    if (r.x0 < clip->x0)
+        r.x0 = clip->x0;
+    if (r.y0 < clip->y0)
+        r.y0 = clip->y0;
+    if (r.x1 > clip->x1)
+        r.x1 = clip->x1;
+    if (r.y1 > clip->y1)
+        r.y1 = clip->y1;
+    if (r.x1 <= r.x0 || r.y1 <= r.y0)
+        return;
+
+    damage_rect(win, r.x0, r.y0, r.x1, r.y1);
+    c->view_tiles = tiles_under(canvas_rect(c, *clip));
+    touch(c, canvas_rect(c, r), false);
+
+    int n = r.x1 - r.x0;
+    const uint32_t* prev = NULL;
+    int prev_y = 0;
+    for (int wy = r.y0; wy < r.y1; ++wy)
+    {
+        uint32_t* dst = &win->fb.data[(size_t)wy * (size_t)win->w + (size_t)r.x0];
+        int y = c->view_y + to_canvas(wy, c->zoom);
+        if (y < 0 || y >= c->ctx.h)
+        {
+            span_fill32(dst, BACKDROP, (size_t)n);
+            prev = NULL;
+            continue;
+        }
+
+        // Zoomed in, runs of window rows show the same canvas row.
+        if (prev && prev_y == y)
+        {
+            span_copy32(dst, prev, (size_t)n);
+            continue;
+        }
+
+        const uint32_t* src = &c->ctx.fb.data[(size_t)y * (size_t)c->ctx.w];
+        if (c->zoom == 0)
+        {
+            copy_row(dst, src, c->view_x + r.x0, n, c->ctx.w);
+        }
+        else
+        {
+            for (int i = 0; i < n; ++i)
+            {
+                int x = c->view_x + to_canvas(r.x0 + i, c->zoom);
+                dst[i] = x >= 0 && x < c->ctx.w ? src[x] : BACKDROP;
+            }
+        }
+        prev = dst;
+        prev_y = y;
+    }
+}
+
+// Window pixels covering canvas pixels [d0, d1) along one axis. Zoomed out, a run that holds
+// no sampled pixel would map to nothing; it gets the window pixel it falls in instead, so thin
+// previews stay visible.
+static void
+window_extent(int d0, int d1, int zoom, int* w0, int* w1)
+{
+    *w0 = to_window(d0, zoom);
+    *w1 = to_window(d1, zoom);
+    if (*w1 <= *w0)
+        *w0 = *w1 - 1;
+}
+
+// The canvas overlay is never composited into the canvas itself; its spans go through
+// the view into win's overlay, which render_frame composites as usual.
+static void
+sync_preview(const Canvas* c, DisplayContext* win)
+{
+    const Overlay* o = &c->ctx.overlay;
+    if (o->count == 0)
+    {
+        overlay_clear(win);
+        return;
+    }
+
+    overlay_begin(win);
+    for (int i = 0; i < o->count; ++i)
+    {
+        const Span* s = &o->spans[i];
+        int wy0, wy1, wx0, wx1;
+        window_extent(s->y - c->view_y, s->y + 1 - c->view_y, c->zoom, &wy0, &wy1);
+        window_extent(s->x0 - c->view_x, s->x1 - c->view_x, c->zoom, &wx0, &wx1);
+        for (int wy = wy0; wy < wy1; ++wy)
+            overlay_push_blend(win, wy, wx0, wx1, s->color, s->alpha);
+    }
+    overlay_end(win);
+}
+
+void
+canvas_sync(Canvas* c, DisplayContext* win)
+{
+    bool changed = c->view_changed || !damage_empty(&c->ctx);
+    if (c->view_changed)
+    {
+        composite(c, win, win->clip);
+    }
+    else
+    {
+        for (int i = 0; i < c->ctx.damage.count; ++i)
+            composite(c, win, window_rect(c, c->ctx.damage.rects[i]));
+    }
+
+    c->view_changed = false;
+    damage_reset(&c->ctx);
+    if (changed)
+        sync_preview(c, win);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "types.h"
+
+// Residency is tracked per tile of CANVAS_TILE_H rows by one 4 KiB page column, the smallest
+// piece of the row-major mapping that can be dropped from memory on its own.
+#define CANVAS_TILE_W 1024
+#define CANVAS_TILE_H 64
+
+// Pixel indices are int, so each side stays well inside 2^31 pixels in total.
+#define CANVAS_MAX_SIDE 32768
+
+#define CANVAS_ZOOM_MIN -3
+#define CANVAS_ZOOM_MAX 3
+
+// Maps a w x h canvas (w rounded up to whole tiles) from a sparse file at `path`, or from an
+// unlinked temporary file when it is NULL, cleared to black. Pages are only read in once drawn
+// on or shown; past SOFT_RENDERER_CANVAS_MB (default 256) of tiles, or the tiles the view
+// shows if that is more, the least recently used ones are dropped and paged back from the file
+// when needed. Returns false on failure.
+bool canvas_open(Canvas* c, int w, int h, const char* path);
+void canvas_close(Canvas* c);
+
+// Canvas pixel shown at window pixel (wx, wy).
+void canvas_from_window(const Canvas* c, int wx, int wy, int* x, int* y);
+
+// Canvas area shown inside the clip rect of win.
+Rect canvas_visible(const Canvas* c, const DisplayContext* win);
+
+// Moves the view by (dx, dy) window pixels.
+void canvas_pan(Canvas* c, int dx, int dy);
+// Moves the view so canvas pixel (x, y) shows at window pixel (wx, wy), as far as it can.
+void canvas_grab(Canvas* c, int x, int y, int wx, int wy);
+// Zooms by `steps` doublings, keeping the canvas pixel under (wx, wy) in place.
+void canvas_zoom(Canvas* c, int steps, int wx, int wy);
+
+// Blackens every tile drawn on so far, through damage_rect so history records the clear,
+// without paging in the rest of the canvas.
+void canvas_clear(Canvas* c);
+
+// Re-rasterizes the visible part of the canvas from the scene.
+void canvas_rasterize_visible(Canvas* c, const DisplayContext* win, const Scene* scene);
+
+// Brings win up to date with the canvas: composites what was damaged since the last sync
+// (all of the view once it changed) and maps the canvas previews into win's overlay.
+void canvas_sync(Canvas* c, DisplayContext* win);
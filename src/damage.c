@@ -0,0 +1,190 @@
+#include "damage.h"
+
+static long
+rect_area(Rect r)
+{
+    return (long)(r.x1 - r.x0) * (long)(r.y1 - r.y0);
+}
+
+static Rect
+rect_union(Rect a, Rect b)
+{
+    Rect u;
+    u.x0 = a.x0 < b.x0 ? a.x0 : b.x0;
+    u.y0 = a.y0 < b.y0 ? a.y0 : b.y0;
+    u.x1 = a.x1 > b.x1 ? a.x1 : b.x1;
+    u.y1 = a.y1 > b.y1 ? a.y1 : b.y1;
+    return u;
+}
+
+static long
+rect_overlap(Rect a, Rect b)
+{
+    int x0 = a.x0 > b.x0 ? a.x0 : b.x0;
+    int y0 = a.y0 > b.y0 ? a.y0 : b.y0;
+    int x1 = a.x1 < b.x1 ? a.x1 : b.x1;
+    int y1 = a.y1 < b.y1 ? a.y1 : b.y1;
+    if (x1 <= x0 || y1 <= y0)
+        return 0;
+    return (long)(x1 - x0) * (long)(y1 - y0);
+}
+
+static bool
+rect_contains(Rect outer, Rect inner)
+{
+    return inner.x0 >= outer.x0 && inner.y0 >= outer.y0 && inner.x1 <= outer.x1 &&
+           inner.y1 <= outer.y1;
+}
+
+// Pixels that merging a and b into their bounding box would upload without being damaged.
+static long
+merge_waste(Rect a, Rect b)
+{
+    return rect_area(rect_union(a, b)) - rect_area(a) - rect_area(b) + rect_overlap(a, b);
+}
+
+static void
+remove_rect(Damage* d, int i)
+{
+    d->rects[i] = d->rects[d->count - 1];
+    d->count--;
+}
+
+// Folds rect i into any other rect it can be merged with cheaply, repeating until stable.
+static void
+coalesce_from(Damage* d, int i)
+{
+    bool merged = true;
+    while (merged)
+    {
+        merged = false;
+        for (int j = 0; j < d->count; ++j)
+        {
+            if (j == i)
+                continue;
+            if (d->coalesce_px >= 0 && merge_waste(d->rects[i], d->rects[j]) > d->coalesce_px)
+                continue;
+
+            d->rects[i] = rect_union(d->rects[i], d->rects[j]);
+            remove_rect(d, j);
+            if (i == d->count)
+                i = j;
+            merged = true;
+            break;
+        }
+    }
+}
+
+// The list is full: merge the cheapest pair to make room.
+static void
+merge_cheapest_pair(Damage* d)
+{
+    int best_i = 0;
+    int best_j = 1;
+    long best = -1;
+    for (int i = 0; i < d->count; ++i)
+    {
+        for (int j = i + 1; j < d->count; ++j)
+        {
+            long waste = merge_waste(d->rects[i], d->rects[j]);
+            if (best < 0 || waste < best)
+            {
+                best = waste;
+                best_i = i;
+                best_j = j;
+            }
+        }
+    }
+
+    d->rects[best_i] = rect_union(d->rects[best_i], d->rects[best_j]);
+    remove_rect(d, best_j);
+}
+
+void
+damage_rect(DisplayContext* ctx, int x0, int y0, int x1, int y1)
+{
+    if (x0 < 0)
+        x0 = 0;
+    if (y0 < 0)
+        y0 = 0;
+    if (x1 > ctx->w)
+        x1 = ctx->w;
+    if (y1 > ctx->h)
+        y1 = ctx->h;
+    if (x1 <= x0 || y1 <= y0)
+        return;
+
+    Damage* d = &ctx->damage;
+    Rect r = {x0, y0, x1, y1};
+
+    if (ctx->write_hook_count > 0 && !ctx->overlay.active)
+        for (int i = 0; i < ctx->write_hook_count; ++i)
+            ctx->write_hooks[i].fn(ctx->write_hooks[i].user, ctx, r);
+
+    // Fast path: per-pixel writers keep hitting the rect they just grew.
+    if (d->count > 0 && rect_contains(d->rects[d->count - 1], r))
+        return;
+    for (int i = 0; i < d->count; ++i)
+        if (rect_contains(d->rects[i], r))
+            return;
+
+    if (d->count == DAMAGE_MAX_RECTS)
+        merge_cheapest_pair(d);
+
+    d->rects[d->count++] = r;
+    coalesce_from(d, d->count - 1);
+}
+
+void
+damage_all(DisplayContext* ctx)
+{
+    ctx->damage.count = 0;
+    damage_rect(ctx, 0, 0, ctx->w, ctx->h);
+}
+
+void
+damage_reset(DisplayContext* ctx)
+{
+    ctx->damage.count = 0;
+}
+
+bool
+damage_empty(const DisplayContext* ctx)
+{
+    return ctx->damage.count == 0;
+}
+
+Rect
+damage_bounds(const DisplayContext* ctx)
+{
+    const Damage* d = &ctx->damage;
+    Rect b = {0, 0, 0, 0};
+    for (int i = 0; i < d->count; ++i)
+        b = i == 0 ? d->rects[0] : rect_union(b, d->rects[i]);
+    return b;
+}
+
+bool
+damage_add_hook(DisplayContext* ctx, WriteHook fn, void* user)
+{
+    if (ctx->write_hook_count == MAX_WRITE_HOOKS)
+        return false;
+
+    ctx->write_hooks[ctx->write_hook_count++] = (WriteHookSlot){fn, user};
+    return true;
+}
+
+void
+damage_remove_hook(DisplayContext* ctx, WriteHook fn, void* user)
+{
+    for (int i = 0; i < ctx->write_hook_count; ++i)
+    {
+        if (ctx->write_hooks[i].fn != fn || ctx->write_hooks[i].user != user)
+            continue;
+
+        for (int j = i + 1; j < ctx->write_hook_count; ++j)
+            ctx->write_hooks[j - 1] = ctx->write_hooks[j];
+        ctx->write_hook_count--;
+        return;
+    }
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "types.h"
+
+// Damage is accumulated in framebuffer coordinates as half-open rects and consumed by
+// render_frame. Everything that writes into fb.data reports the area it touches first.
+void damage_rect(DisplayContext* ctx, int x0, int y0, int x1, int y1);
+void damage_all(DisplayContext* ctx);
+void damage_reset(DisplayContext* ctx);
+
+bool damage_empty(const DisplayContext* ctx);
+Rect damage_bounds(const DisplayContext* ctx);
+
+// Write hooks see every reported area before it is modified (never overlay previews).
+bool damage_add_hook(DisplayContext* ctx, WriteHook fn, void* user);
+void damage_remove_hook(DisplayContext* ctx, WriteHook fn, void* user);
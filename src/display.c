@@ -1,9 +1,17 @@
 #include "display.h"
 
+#include "bufpool.h"
+#include "damage.h"
+#include "kernels.h"
+#include "overlay.h"
+#include "parallel.h"
+
 #include <X11/Xutil.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
 
 static void
 terminate(const char* message)
@@ -11,127 +19,672 @@ terminate(const char* message)
     fprintf(stderr, "execution terminated, reason: %s\n", message);
 }
 
-static Framebuffer
-init_framebuffer(int w, int h)
+// The window's visual, chosen by choose_visual. 32-bit visuals in either channel order are
+// drawn in natively; any other layout is packed from the framebuffer into the image at upload.
+static Visual* visual;
+static int visual_depth;
+static int visual_bpp;
+static SpanPackFn visual_pack; // NULL when framebuffer pixels are the visual's own
+static Colormap colormap;      // only for a visual other than the default
+
+static Bool
+is_shm_completion(Display* dpy, XEvent* e, XPointer arg)
 {
-    uint32_t* data = calloc((size_t)w * (size_t)h, sizeof(uint32_t));
-    uint32_t* saved = calloc((size_t)w * (size_t)h, sizeof(uint32_t));
+    (void)dpy;
+    return e->type == *(int*)arg;
+}
 
-    Framebuffer fb;
-    fb.data = data;
-    fb.saved = saved;
+bool
+display_consume_event(DisplayContext* ctx, const XEvent* e)
+{
+    if (!ctx->use_shm || e->type != ctx->shm_completion)
+        return false;
 
-    return fb;
+    const XShmCompletionEvent* done = (const XShmCompletionEvent*)e;
+    for (int i = 0; i < ctx->buffer_count; ++i)
+        if (ctx->buffers[i].shm->shmseg == done->shmseg)
+            ctx->buffers[i].busy = false;
+    return true;
 }
 
-void
-fill_framebuffer(const DisplayContext* ctx, uint8_t r, uint8_t g, uint8_t b)
+// The idle buffer holding the newest frame needs the least repair. With every buffer still
+// in flight, waits for the next completion (they arrive in presentation order).
+static int
+pick_back_buffer(DisplayContext* ctx)
 {
-    uint32_t color = pack_rgb(r, g, b);
-    for (int i = 0; i < ctx->w * ctx->h; ++i)
-        ctx->fb.data[i] = color;
+    XEvent e;
+    while (XCheckIfEvent(ctx->dpy, &e, is_shm_completion, (XPointer)&ctx->shm_completion))
+        display_consume_event(ctx, &e);
+
+    for (;;)
+    {
+        int best = -1;
+        for (int i = 0; i < ctx->buffer_count; ++i)
+        {
+            const PresentBuffer* b = &ctx->buffers[i];
+            if (!b->busy && (best < 0 || b->frame > ctx->buffers[best].frame))
+                best = i;
+        }
+        if (best >= 0)
+            return best;
+
+        XIfEvent(ctx->dpy, &e, is_shm_completion, (XPointer)&ctx->shm_completion);
+        display_consume_event(ctx, &e);
+    }
 }
 
-void
-clear_framebuffer(const DisplayContext* ctx)
+static void
+copy_rect(DisplayContext* ctx, uint32_t* dst, const uint32_t* src, Rect r)
+{
+    if (r.x1 <= r.x0 || r.y1 <= r.y0)
+        return;
+    for (int y = r.y0; y < r.y1; ++y)
+    {
+        size_t row = (size_t)y * (size_t)ctx->w + (size_t)r.x0;
+        span_copy32(&dst[row], &src[row], (size_t)(r.x1 - r.x0));
+    }
+}
+
+// Brings buffers[to] up to the frame just presented from buffers[from]: the areas damaged in
+// the frames it missed, plus the preview it was presented with. Only a buffer too far behind
+// (or never drawn) is copied whole.
+static void
+repair_buffer(DisplayContext* ctx, int from, int to)
+{
+    PresentBuffer* dst = &ctx->buffers[to];
+    const uint32_t* src_px = (const uint32_t*)ctx->buffers[from].shm->shmaddr;
+    uint32_t* dst_px = (uint32_t*)dst->shm->shmaddr;
+
+    if (dst->frame == 0 || ctx->frame - dst->frame > PRESENT_HISTORY)
+    {
+        copy_rect(ctx, dst_px, src_px, (Rect){0, 0, ctx->w, ctx->h});
+    }
+    else
+    {
+        copy_rect(ctx, dst_px, src_px, dst->baked);
+        for (uint64_t f = dst->frame + 1; f <= ctx->frame; ++f)
+        {
+            const Damage* d = &ctx->presented[f % PRESENT_HISTORY];
+            for (int i = 0; i < d->count; ++i)
+                copy_rect(ctx, dst_px, src_px, d->rects[i]);
+        }
+    }
+    dst->baked = (Rect){0, 0, 0, 0};
+    dst->frame = ctx->frame;
+}
+
+static void
+render_frame_shm(DisplayContext* ctx)
 {
-    fill_framebuffer(ctx, 0, 0, 0);
+    const Damage* d = &ctx->damage;
+    int front = ctx->current;
+    PresentBuffer* b = &ctx->buffers[front];
+    for (int i = 0; i < d->count; ++i)
+    {
+        Rect r = d->rects[i];
+        // Requests complete in order, so only the last one needs to report back.
+        XShmPutImage(
+            ctx->dpy,
+            ctx->win,
+            ctx->gc,
+            b->img,
+            r.x0,
+            r.y0,
+            r.x0,
+            r.y0,
+            (unsigned)(r.x1 - r.x0),
+            (unsigned)(r.y1 - r.y0),
+            i == d->count - 1
+        );
+    }
+    XFlush(ctx->dpy);
+
+    ctx->frame++;
+    ctx->presented[ctx->frame % PRESENT_HISTORY] = *d;
+    b->busy = true;
+    b->frame = ctx->frame;
+    b->baked = ctx->overlay.under_count > 0 ? ctx->overlay.bounds : (Rect){0, 0, 0, 0};
+
+    // The server reads the front buffer from now on; drawing continues in a back buffer
+    // (with one buffer, in the front one once the server is done with it).
+    int back = pick_back_buffer(ctx);
+    if (back != front)
+        repair_buffer(ctx, front, back);
+    ctx->current = back;
+    ctx->img = ctx->buffers[back].img;
+    ctx->fb.data = (uint32_t*)ctx->buffers[back].shm->shmaddr;
+}
+
+static void
+pack_rect(DisplayContext* ctx, Rect r)
+{
+    int bytes = visual_bpp / 8;
+    for (int y = r.y0; y < r.y1; ++y)
+    {
+        char* dst = ctx->img->data + (size_t)y * (size_t)ctx->img->bytes_per_line;
+        visual_pack(dst + (size_t)r.x0 * (size_t)bytes,
+            &ctx->fb.data[(size_t)y * (size_t)ctx->w + (size_t)r.x0],
+            (size_t)(r.x1 - r.x0));
+    }
+}
+
+static void
+render_frame_xlib(DisplayContext* ctx)
+{
+    const Damage* d = &ctx->damage;
+    for (int i = 0; i < d->count; ++i)
+    {
+        Rect r = d->rects[i];
+        if (visual_pack)
+            pack_rect(ctx, r);
+        XPutImage(
+            ctx->dpy,
+            ctx->win,
+            ctx->gc,
+            ctx->img,
+            r.x0,
+            r.y0,
+            r.x0,
+            r.y0,
+            (unsigned)(r.x1 - r.x0),
+            (unsigned)(r.y1 - r.y0)
+        );
+    }
 }
 
 void
 render_frame(DisplayContext* ctx)
 {
-    XPutImage(ctx->dpy, ctx->win, ctx->gc, ctx->img, 0, 0, 0, 0, ctx->w, ctx->h);
+    if (damage_empty(ctx))
+        return;
+
+    overlay_composite(ctx);
+    if (ctx->use_shm)
+        render_frame_shm(ctx);
+    else
+        render_frame_xlib(ctx);
+    // With SHM this lands in the new back buffer, which the repair copied the preview into.
+    overlay_restore(ctx);
+
+    damage_reset(ctx);
 }
 
-DisplayContext
-init_display(int w, int h)
+static bool shm_attach_failed;
+
+static int
+shm_error_handler(Display* dpy, XErrorEvent* e)
 {
-    Display* dpy = XOpenDisplay(NULL);
-    if (!dpy)
-        terminate("cannot open display");
+    (void)dpy;
+    (void)e;
+    shm_attach_failed = true;
+    return 0;
+}
 
-    int screen = DefaultScreen(dpy);
+// Segments given up by a resize stay attached for the next one. They are sized by the
+// bufpool classes, so a drag-resize keeps landing on segments it already has.
+#define SHM_POOL_MAX 4
+
+typedef struct
+{
+    XShmSegmentInfo* shm;
+    size_t capacity;
+} ShmSegment;
+
+// Oldest first; a full pool destroys its oldest segment.
+static ShmSegment shm_pool[SHM_POOL_MAX];
+static int shm_pool_count;
+
+// Creates a shared segment of `size` bytes and attaches it to the server. Returns NULL when
+// that fails (e.g. remote displays).
+static XShmSegmentInfo*
+create_segment(Display* dpy, size_t size)
+{
+    XShmSegmentInfo* shm = calloc(1, sizeof(*shm));
+    if (!shm)
+        return NULL;
+
+    shm->shmid = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600);
+    if (shm->shmid < 0)
+    {
+        free(shm);
+        return NULL;
+    }
+
+    shm->shmaddr = shmat(shm->shmid, NULL, 0);
+    if (shm->shmaddr == (char*)-1)
+    {
+        shmctl(shm->shmid, IPC_RMID, NULL);
+        free(shm);
+        return NULL;
+    }
+    shm->readOnly = False;
+
+    shm_attach_failed = false;
+    XErrorHandler old_handler = XSetErrorHandler(shm_error_handler);
+    Status attached = XShmAttach(dpy, shm);
+    XSync(dpy, False);
+    XSetErrorHandler(old_handler);
+
+    // Marked for removal now so the segment goes away with the last detach, even on a crash.
+    shmctl(shm->shmid, IPC_RMID, NULL);
+
+    if (!attached || shm_attach_failed)
+    {
+        shmdt(shm->shmaddr);
+        free(shm);
+        return NULL;
+    }
+    return shm;
+}
+
+static void
+destroy_segment(Display* dpy, XShmSegmentInfo* shm)
+{
+    // The server keeps its own mapping until it processes the detach.
+    XShmDetach(dpy, shm);
+    shmdt(shm->shmaddr);
+    free(shm);
+}
 
-    Window win = XCreateSimpleWindow(
+static XShmSegmentInfo*
+acquire_segment(Display* dpy, size_t bytes, size_t* capacity)
+{
+    size_t size = pool_size_class(bytes);
+
+    int best = -1;
+    for (int i = 0; i < shm_pool_count; ++i)
+    {
+        size_t c = shm_pool[i].capacity;
+        if (c >= bytes && c <= 2 * size && (best < 0 || c < shm_pool[best].capacity))
+            best = i;
+    }
+    if (best >= 0)
+    {
+        XShmSegmentInfo* shm = shm_pool[best].shm;
+        *capacity = shm_pool[best].capacity;
+        shm_pool_count--;
+        memmove(&shm_pool[best],
+            &shm_pool[best + 1],
+            (size_t)(shm_pool_count - best) * sizeof(ShmSegment));
+        return shm;
+    }
+
+    XShmSegmentInfo* shm = create_segment(dpy, size);
+    if (shm)
+        *capacity = size;
+    return shm;
+}
+
+static void
+release_segment(Display* dpy, XShmSegmentInfo* shm, size_t capacity)
+{
+    if (shm_pool_count == SHM_POOL_MAX)
+    {
+        destroy_segment(dpy, shm_pool[0].shm);
+        memmove(&shm_pool[0], &shm_pool[1], (size_t)(SHM_POOL_MAX - 1) * sizeof(ShmSegment));
+        shm_pool_count--;
+    }
+    shm_pool[shm_pool_count++] = (ShmSegment){shm, capacity};
+}
+
+static void
+drain_segments(Display* dpy)
+{
+    for (int i = 0; i < shm_pool_count; ++i)
+        destroy_segment(dpy, shm_pool[i].shm);
+    shm_pool_count = 0;
+}
+
+// Creates a w x h presentation image over a pooled shared segment, which may be larger
+// than the image. Returns false (leaving *b cleared) if the segment or the image fails.
+static bool
+create_shm_buffer(Display* dpy, int w, int h, PresentBuffer* b)
+{
+    memset(b, 0, sizeof(*b));
+
+    size_t bytes = (size_t)w * (size_t)h * sizeof(uint32_t);
+    b->shm = acquire_segment(dpy, bytes, &b->capacity);
+    if (!b->shm)
+        return false;
+
+    b->img = XShmCreateImage(
         dpy,
-        RootWindow(dpy, screen),
-        100,
-        100,
+        visual,
+        (unsigned)visual_depth,
+        ZPixmap,
+        b->shm->shmaddr,
+        b->shm,
         (unsigned)w,
-        (unsigned)h,
-        1,
-        BlackPixel(dpy, screen),
-        WhitePixel(dpy, screen)
+        (unsigned)h
     );
 
-    XSelectInput(dpy, win, ExposureMask | KeyPressMask | ButtonPressMask | PointerMotionMask);
-    XMapWindow(dpy, win);
+    // The rasterizers assume tightly packed 32-bit rows.
+    if (!b->img || b->img->bits_per_pixel != 32 ||
+        b->img->bytes_per_line != w * (int)sizeof(uint32_t))
+    {
+        if (b->img)
+        {
+            b->img->data = NULL;
+            XDestroyImage(b->img);
+        }
+        release_segment(dpy, b->shm, b->capacity);
+        memset(b, 0, sizeof(*b));
+        return false;
+    }
+    return true;
+}
+
+static void
+destroy_shm_buffer(Display* dpy, PresentBuffer* b)
+{
+    b->img->data = NULL;
+    XDestroyImage(b->img);
+    release_segment(dpy, b->shm, b->capacity);
+    memset(b, 0, sizeof(*b));
+}
 
-    Framebuffer fb = init_framebuffer(w, h);
+// Gives ctx up to `want` SHM buffers of w x h or, with none, a pooled heap buffer behind a
+// plain Xlib image. A visual that needs packing gets the Xlib image, over its own pixels.
+// Returns false if neither can be made.
+static bool
+create_buffers(DisplayContext* ctx, int w, int h, int want)
+{
+    if (visual_pack)
+        want = 0;
+
+    int count = 0;
+    while (count < want && create_shm_buffer(ctx->dpy, w, h, &ctx->buffers[count]))
+        count++;
+    ctx->buffer_count = count;
+    ctx->use_shm = count > 0;
+    ctx->current = 0;
+    ctx->fb_capacity = 0;
+
+    if (ctx->use_shm)
+    {
+        ctx->img = ctx->buffers[0].img;
+        ctx->fb.data = (uint32_t*)ctx->buffers[0].shm->shmaddr;
+        return true;
+    }
+
+    size_t capacity;
+    uint32_t* data = pool_acquire((size_t)w * (size_t)h * sizeof(uint32_t), &capacity);
+    if (!data)
+        return false;
 
-    GC gc = XCreateGC(dpy, win, 0, 0);
     XImage* img = XCreateImage(
-        dpy,
-        DefaultVisual(dpy, screen),
-        DefaultDepth(dpy, screen),
+        ctx->dpy,
+        visual,
+        (unsigned)visual_depth,
         ZPixmap,
         0,
-        (char*)fb.data,
+        visual_pack ? NULL : (char*)data,
         (unsigned)w,
         (unsigned)h,
-        32,
+        visual_bpp,
         0
     );
+    if (img && visual_pack)
+    {
+        img->data = malloc((size_t)img->bytes_per_line * (size_t)(h > 0 ? h : 1));
+        if (!img->data)
+        {
+            XDestroyImage(img);
+            img = NULL;
+        }
+    }
     if (!img)
-        terminate("cannot create image");
+    {
+        pool_release(data, capacity);
+        return false;
+    }
+
+    ctx->img = img;
+    ctx->fb.data = data;
+    ctx->fb_capacity = capacity;
+    return true;
+}
+
+static void
+destroy_buffers(DisplayContext* ctx)
+{
+    if (ctx->use_shm)
+    {
+        for (int i = 0; i < ctx->buffer_count; ++i)
+            destroy_shm_buffer(ctx->dpy, &ctx->buffers[i]);
+    }
+    else if (ctx->img)
+    {
+        if (visual_pack)
+            free(ctx->img->data);
+        ctx->img->data = NULL;
+        XDestroyImage(ctx->img);
+        pool_release(ctx->fb.data, ctx->fb_capacity);
+    }
+    ctx->img = NULL;
+    ctx->fb.data = NULL;
+    ctx->fb_capacity = 0;
+    ctx->buffer_count = 0;
+}
+
+// SOFT_RENDERER_BUFFERS picks 1 (present, then wait for the server) to MAX_PRESENT_BUFFERS.
+// SOFT_RENDERER_NO_SHM, or a display without the extension, presents through Xlib instead.
+static int
+present_buffer_count(Display* dpy)
+{
+    if (getenv("SOFT_RENDERER_NO_SHM") || !XShmQueryExtension(dpy))
+        return 0;
+
+    const char* env = getenv("SOFT_RENDERER_BUFFERS");
+    int n = env ? atoi(env) : 2;
+    if (n < 1)
+        n = 1;
+    return n > MAX_PRESENT_BUFFERS ? MAX_PRESENT_BUFFERS : n;
+}
+
+static int
+depth_bits_per_pixel(Display* dpy, int depth)
+{
+    int count = 0;
+    XPixmapFormatValues* formats = XListPixmapFormats(dpy, &count);
+    int bpp = 0;
+    for (int i = 0; i < count; ++i)
+        if (formats[i].depth == depth)
+            bpp = formats[i].bits_per_pixel;
+    if (formats)
+        XFree(formats);
+    return bpp;
+}
+
+// The default visual if it is TrueColor, else the first TrueColor one by preferred depth.
+// Sets pixel_order for 32-bit layouts so rasterizers write the visual's pixels directly, or
+// picks a packer for the others. Returns false if there is no usable visual.
+static bool
+choose_visual(Display* dpy, int screen)
+{
+    XVisualInfo info;
+    XVisualInfo want = {.visualid = XVisualIDFromVisual(DefaultVisual(dpy, screen))};
+    int count = 0;
+    XVisualInfo* def = XGetVisualInfo(dpy, VisualIDMask, &want, &count);
+    bool found = def && count > 0 && def->class == TrueColor;
+    if (found)
+        info = *def;
+    if (def)
+        XFree(def);
+
+    static const int depths[] = {24, 32, 30, 16, 15, 8};
+    for (size_t i = 0; !found && i < sizeof(depths) / sizeof(depths[0]); ++i)
+        found = XMatchVisualInfo(dpy, screen, depths[i], TrueColor, &info);
+    if (!found)
+        return false;
+
+    visual = info.visual;
+    visual_depth = info.depth;
+    visual_bpp = depth_bits_per_pixel(dpy, info.depth);
+    visual_pack = NULL;
+    pixel_order = PIXEL_XRGB;
+
+    uint32_t r = (uint32_t)info.red_mask;
+    uint32_t g = (uint32_t)info.green_mask;
+    uint32_t b = (uint32_t)info.blue_mask;
+    if (visual_bpp == 32 && g == 0xff00 && r == 0xff0000 && b == 0xff)
+        return true;
+    if (visual_bpp == 32 && g == 0xff00 && r == 0xff && b == 0xff0000)
+    {
+        pixel_order = PIXEL_XBGR;
+        return true;
+    }
+    visual_pack = span_pack_for(r, g, b, visual_bpp);
+    return visual_pack != NULL;
+}
+
+static Window
+create_window(Display* dpy, int screen, int w, int h)
+{
+    if (visual == DefaultVisual(dpy, screen))
+        return XCreateSimpleWindow(
+            dpy,
+            RootWindow(dpy, screen),
+            100,
+            100,
+            (unsigned)w,
+            (unsigned)h,
+            1,
+            BlackPixel(dpy, screen),
+            WhitePixel(dpy, screen)
+        );
+
+    // Another visual needs a colormap of its own; TrueColor pixels are the channel masks.
+    colormap = XCreateColormap(dpy, RootWindow(dpy, screen), visual, AllocNone);
+    XSetWindowAttributes attrs = {
+        .background_pixel = visual->red_mask | visual->green_mask | visual->blue_mask,
+        .border_pixel = 0,
+        .colormap = colormap,
+    };
+    return XCreateWindow(
+        dpy,
+        RootWindow(dpy, screen),
+        100,
+        100,
+        (unsigned)w,
+        (unsigned)h,
+        1,
+        visual_depth,
+        InputOutput,
+        visual,
+        CWBackPixel | CWBorderPixel | CWColormap,
+        &attrs
+    );
+}
+
+DisplayContext
+init_display(int w, int h)
+{
+    Display* dpy = XOpenDisplay(NULL);
+    if (!dpy)
+        terminate("cannot open display");
+
+    int screen = DefaultScreen(dpy);
+    if (!choose_visual(dpy, screen))
+    {
+        // Draw as before and let the server make of it what it can.
+        fprintf(stderr, "no TrueColor visual with a supported pixel layout\n");
+        visual = DefaultVisual(dpy, screen);
+        visual_depth = DefaultDepth(dpy, screen);
+        visual_bpp = 32;
+        visual_pack = NULL;
+        pixel_order = PIXEL_XRGB;
+    }
+
+    Window win = create_window(dpy, screen, w, h);
+
+    XSelectInput(
+        dpy,
+        win,
+        ExposureMask | StructureNotifyMask | KeyPressMask | ButtonPressMask | ButtonReleaseMask |
+            PointerMotionMask
+    );
+    XMapWindow(dpy, win);
+
+    // Built aside because framebuffer_attach resets the whole context.
+    DisplayContext pixels = {.dpy = dpy};
+    if (!create_buffers(&pixels, w, h, present_buffer_count(dpy)))
+        terminate("cannot allocate framebuffer");
 
     DisplayContext ctx;
+    if (!framebuffer_attach(&ctx, w, h, pixels.fb.data))
+        terminate("cannot allocate framebuffer");
+
     ctx.dpy = dpy;
     ctx.win = win;
-    ctx.gc = gc;
-    ctx.img = img;
-    ctx.w = w;
-    ctx.h = h;
-    ctx.fb = fb;
+    ctx.gc = XCreateGC(dpy, win, 0, 0);
+    ctx.img = pixels.img;
+    ctx.fb_capacity = pixels.fb_capacity;
+    ctx.use_shm = pixels.use_shm;
+    memcpy(ctx.buffers, pixels.buffers, sizeof(ctx.buffers));
+    ctx.buffer_count = pixels.buffer_count;
+    ctx.shm_completion = ctx.use_shm ? XShmGetEventBase(dpy) + ShmCompletion : -1;
 
     clear_framebuffer(&ctx);
 
     return ctx;
 }
 
-void
-cleanup_display(DisplayContext* ctx)
+bool
+display_resize(DisplayContext* ctx, int w, int h)
 {
-    ctx->img->data = NULL;
-    XDestroyImage(ctx->img);
-    XDestroyWindow(ctx->dpy, ctx->win);
-    XCloseDisplay(ctx->dpy);
+    if (w == ctx->w && h == ctx->h)
+        return true;
 
-    free(ctx->fb.data);
-    free(ctx->fb.saved);
-}
+    // Every buffer is recycled, so the server has to be done reading all of them.
+    for (;;)
+    {
+        bool busy = false;
+        for (int i = 0; i < ctx->buffer_count; ++i)
+            busy = busy || ctx->buffers[i].busy;
+        if (!busy)
+            break;
 
-void
-put_pixel(DisplayContext* ctx, int x, int y, uint8_t r, uint8_t g, uint8_t b)
-{
-    if ((unsigned)x >= (unsigned)ctx->w || (unsigned)y >= (unsigned)ctx->h)
-        return;
+        XEvent e;
+        XIfEvent(ctx->dpy, &e, is_shm_completion, (XPointer)&ctx->shm_completion);
+        display_consume_event(ctx, &e);
+    }
+
+    int want = ctx->use_shm ? ctx->buffer_count : 0;
+    destroy_buffers(ctx);
+    bool ok = create_buffers(ctx, w, h, want);
+    if (!ok)
+    {
+        // Nothing to draw into: an empty canvas keeps every rasterizer out of fb.data.
+        w = 0;
+        h = 0;
+    }
 
-    ctx->fb.data[y * ctx->w + x] = pack_rgb(r, g, b);
+    ctx->w = w;
+    ctx->h = h;
+    ctx->clip = (Rect){
+        ctx->clip.x0 < w ? ctx->clip.x0 : w,
+        ctx->clip.y0 < h ? ctx->clip.y0 : h,
+        w,
+        h,
+    };
+    damage_reset(ctx);
+    return ok;
 }
 
 void
-put_pixel_thick(DisplayContext* ctx, int x, int y, int thickness, uint8_t r, uint8_t g, uint8_t b)
+cleanup_display(DisplayContext* ctx)
 {
-    if (thickness <= 1)
-    {
-        put_pixel(ctx, x, y, r, g, b);
-        return;
-    }
+    parallel_shutdown();
+
+    destroy_buffers(ctx);
+    drain_segments(ctx->dpy);
+    XDestroyWindow(ctx->dpy, ctx->win);
+    if (colormap)
+        XFreeColormap(ctx->dpy, colormap);
+    colormap = 0;
+    XCloseDisplay(ctx->dpy);
 
-    int half = thickness / 2;
-    for (int yy = y - half; yy <= y + half; ++yy)
-        for (int xx = x - half; xx <= x + half; ++xx)
-            put_pixel(ctx, xx, yy, r, g, b);
+    pool_drain();
+    overlay_free(ctx);
 }
@@ -1,14 +1,22 @@
 #pragma once
 
-#include "types.h"
+#include "framebuffer.h"
 
+// X11 window presentation of a framebuffer. init_display picks a TrueColor visual and sets
+// pixel_order to match it, so strokes are rasterized in the server's own 32-bit layout; 8- and
+// 16-bit (or other non-8-bit-channel) visuals are packed from the framebuffer at upload.
 DisplayContext init_display(int w, int h);
 void cleanup_display(DisplayContext* ctx);
 
-void fill_framebuffer(const DisplayContext* ctx, uint8_t r, uint8_t g, uint8_t b);
-void clear_framebuffer(const DisplayContext* ctx);
+// Swaps in w x h buffers once the server has finished reading the current ones; released
+// buffers are pooled for the next resize. Pixels are not kept and damage is dropped, the
+// caller redraws. Returns false if no buffer could be made, leaving an empty 0 x 0 canvas.
+bool display_resize(DisplayContext* ctx, int w, int h);
 
+// Uploads the damaged parts of the framebuffer and resets the damage list. With MIT-SHM the
+// upload is asynchronous and fb.data moves to another buffer (SOFT_RENDERER_BUFFERS, default
+// 2); only with every buffer still being read does it wait for the server.
 void render_frame(DisplayContext* ctx);
 
-void put_pixel(DisplayContext* ctx, int x, int y, uint8_t r, uint8_t g, uint8_t b);
-void put_pixel_thick(DisplayContext* ctx, int x, int y, int thickness, uint8_t r, uint8_t g, uint8_t b);
+// Takes the presentation's own events (SHM completion) out of the app's event stream.
+bool display_consume_event(DisplayContext* ctx, const XEvent* e);
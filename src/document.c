@@ -0,0 +1,633 @@
+#include "document.h"
+
+#include "damage.h"
+#include "framebuffer.h"
+#include "kernels.h"
+#include "scene.h"
+#include "tiles.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Every integer is an LEB128 varint; signed ones are zigzag coded.
+//
+//   "SRDRAW1\n" width height shape_count      width/height of the stored pixels, 0 0 if none
+//   block*: tag count payload_bytes payload
+//   BLOCK_END
+//
+// Shape blocks (tag = kind + 1) hold `count` consecutive shapes of one kind. Fields are deltas
+// from the previous shape of the same kind, colours (0x00RRGGBB whatever the display's
+// pixel order) are XORed with its colour:
+//
+//   point    dx dy color style
+//   line     x0-prev.x1 y0-prev.y1 x1-x0 y1-y0 color style
+//   circle   dcx dcy radius color style
+//   polygon  vertex_count color style, then dx dy per vertex from the previous vertex
+//
+// Raster blocks start with the clip rect x0 y0 x1 y1 the pixels came from, then per tile
+// (TILE_SIZE squares of it, all-black ones left out): the index delta from the previous tile
+// and (run length, color) pairs covering the tile row by row. Readers skip unknown tags.
+static const char DOC_MAGIC[8] = {'S', 'R', 'D', 'R', 'A', 'W', '1', '\n'};
+
+#define BLOCK_END 0
+#define BLOCK_RASTER 16
+
+// Writers buffer one block at a time.
+#define BLOCK_MAX_SHAPES 4096
+#define BLOCK_MAX_TILES 64
+
+#define DOC_MAX_SIDE (1 << 15)
+#define DOC_MAX_DELTA ((int64_t)1 << 32)
+
+// Delta base per shape kind: the last point, line end, circle centre or polygon vertex.
+typedef struct
+{
+    int32_t x, y;
+    uint32_t color;
+} DeltaBase;
+
+typedef struct
+{
+    FILE* f;
+    uint8_t* buf;
+    size_t len, cap;
+    bool ok;
+} Writer;
+
+static size_t
+encode_varint(uint8_t* out, uint64_t v)
+{
+    size_t n = 0;
+    while (v >= 0x80)
+    {
+        out[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    out[n++] = (uint8_t)v;
+    return n;
+}
+
+static void
+put_varint(Writer* w, uint64_t v)
+{
+    if (w->cap - w->len < 10)
+    {
+        size_t cap = w->cap ? w->cap * 2 : 4096;
+        uint8_t* buf = realloc(w->buf, cap);
+        if (!buf)
+        {
+            w->ok = false;
+            return;
+        }
+        w->buf = buf;
+        w->cap = cap;
+    }
+    w->len += encode_varint(&w->buf[w->len], v);
+}
+
+static void
+put_svarint(Writer* w, int64_t v)
+{
+    put_varint(w, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+}
+
+// Writes the buffered payload as one block.
+static void
+emit_block(Writer* w, int tag, int count)
+{
+    uint8_t head[30];
+    size_t n = encode_varint(head, (uint64_t)tag);
+    n += encode_varint(&head[n], (uint64_t)count);
+    n += encode_varint(&head[n], w->len);
+    if (w->ok && fwrite(head, 1, n, w->f) != n)
+        w->ok = false;
+    if (w->ok && fwrite(w->buf, 1, w->len, w->f) != w->len)
+        w->ok = false;
+    w->len = 0;
+}
+
+static void
+put_color_style(Writer* w, DeltaBase* c, uint32_t color, uint16_t style)
+{
+    color = pixel_to_xrgb(color);
+    put_varint(w, color ^ c->color);
+    put_varint(w, style);
+    c->color = color;
+}
+
+static void
+put_point(Writer* w, const PointList* l, int i, DeltaBase* c)
+{
+    put_svarint(w, (int64_t)l->x[i] - c->x);
+    put_svarint(w, (int64_t)l->y[i] - c->y);
+    put_color_style(w, c, l->color[i], l->style[i]);
+    c->x = l->x[i];
+    c->y = l->y[i];
+}
+
+static void
+put_line(Writer* w, const LineList* l, int i, DeltaBase* c)
+{
+    put_svarint(w, (int64_t)l->x0[i] - c->x);
+    put_svarint(w, (int64_t)l->y0[i] - c->y);
+    put_svarint(w, (int64_t)l->x1[i] - l->x0[i]);
+    put_svarint(w, (int64_t)l->y1[i] - l->y0[i]);
+    put_color_style(w, c, l->color[i], l->style[i]);
+    c->x = l->x1[i];
+    c->y = l->y1[i];
+}
+
+static void
+put_circle(Writer* w, const CircleList* l, int i, DeltaBase* c)
+{
+    put_svarint(w, (int64_t)l->cx[i] - c->x);
+    put_svarint(w, (int64_t)l->cy[i] - c->y);
+    put_varint(w, (uint32_t)l->radius[i]);
+    put_color_style(w, c, l->color[i], l->style[i]);
+    c->x = l->cx[i];
+    c->y = l->cy[i];
+}
+
+static void
+put_polygon(Writer* w, const PolygonList* l, int i, DeltaBase* c)
+{
+    put_varint(w, l->vertex_count[i]);
+    put_color_style(w, c, l->color[i], l->style[i]);
+    for (uint32_t v = l->first[i]; v < l->first[i] + l->vertex_count[i]; ++v)
+    {
+        put_svarint(w, (int64_t)l->vx[v] - c->x);
+        put_svarint(w, (int64_t)l->vy[v] - c->y);
+        c->x = l->vx[v];
+        c->y = l->vy[v];
+    }
+}
+
+static void
+put_shape(Writer* w, const Scene* scene, uint32_t entry, DeltaBase* c)
+{
+    int i = (int)(entry & SHAPE_INDEX_MASK);
+    switch ((ShapeKind)(entry >> SHAPE_KIND_SHIFT))
+    {
+    case SHAPE_POINT:
+        put_point(w, &scene->points, i, c);
+        break;
+    case SHAPE_LINE:
+        put_line(w, &scene->lines, i, c);
+        break;
+    case SHAPE_CIRCLE:
+        put_circle(w, &scene->circles, i, c);
+        break;
+    case SHAPE_POLYGON:
+        put_polygon(w, &scene->polygons, i, c);
+        break;
+    default:
+        break;
+    }
+}
+
+static Rect
+tile_area(Rect a, int tiles_x, int t)
+{
+    Rect r = {a.x0 + (t % tiles_x) * TILE_SIZE, a.y0 + (t / tiles_x) * TILE_SIZE, 0, 0};
+    r.x1 = r.x0 + TILE_SIZE < a.x1 ? r.x0 + TILE_SIZE : a.x1;
+    r.y1 = r.y0 + TILE_SIZE < a.y1 ? r.y0 + TILE_SIZE : a.y1;
+    return r;
+}
+
+static bool
+tile_is_black(const DisplayContext* ctx, Rect r)
+{
+    for (int y = r.y0; y < r.y1; ++y)
+        for (int x = r.x0; x < r.x1; ++x)
+            if (ctx->fb.data[(size_t)y * ctx->w + x] != 0)
+                return false;
+    return true;
+}
+
+static void
+put_tile(Writer* w, const DisplayContext* ctx, Rect r)
+{
+    uint32_t prev = 0;
+    uint32_t color = 0;
+    uint64_t run = 0;
+    for (int y = r.y0; y < r.y1; ++y)
+    {
+        const uint32_t* row = &ctx->fb.data[(size_t)y * ctx->w];
+        for (int x = r.x0; x < r.x1; ++x)
+        {
+            if (run > 0 && row[x] == color)
+            {
+                run++;
+                continue;
+            }
+            if (run > 0)
+            {
+                put_varint(w, run);
+                put_varint(w, pixel_to_xrgb(color) ^ prev);
+                prev = pixel_to_xrgb(color);
+            }
+            color = row[x];
+            run = 1;
+        }
+    }
+    put_varint(w, run);
+    put_varint(w, pixel_to_xrgb(color) ^ prev);
+}
+
+static void
+put_raster(Writer* w, const DisplayContext* ctx)
+{
+    Rect a = ctx->clip;
+    if (a.x1 <= a.x0 || a.y1 <= a.y0)
+        return;
+
+    int tiles_x = (a.x1 - a.x0 + TILE_SIZE - 1) / TILE_SIZE;
+    int tiles_y = (a.y1 - a.y0 + TILE_SIZE - 1) / TILE_SIZE;
+    int count = 0;
+    int prev = -1;
+    for (int t = 0; t < tiles_x * tiles_y; ++t)
+    {
+        Rect r = tile_area(a, tiles_x, t);
+        if (tile_is_black(ctx, r))
+            continue;
+
+        if (count == 0)
+        {
+            put_varint(w, (uint64_t)a.x0);
+            put_varint(w, (uint64_t)a.y0);
+            put_varint(w, (uint64_t)a.x1);
+            put_varint(w, (uint64_t)a.y1);
+            prev = -1;
+        }
+        put_varint(w, (uint64_t)(t - prev));
+        put_tile(w, ctx, r);
+        prev = t;
+
+        if (++count == BLOCK_MAX_TILES)
+        {
+            emit_block(w, BLOCK_RASTER, count);
+            count = 0;
+        }
+    }
+    if (count > 0)
+        emit_block(w, BLOCK_RASTER, count);
+}
+
+// Written next to path and renamed over it, so a failed save keeps the previous file.
+bool
+document_save(const char* path, const Scene* scene, const DisplayContext* raster)
+{
+    char tmp[4096];
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp))
+        return false;
+    FILE* f = fopen(tmp, "wb");
+    if (!f)
+        return false;
+
+    Writer w = {f, NULL, 0, 0, true};
+    uint8_t head[40];
+    memcpy(head, DOC_MAGIC, sizeof(DOC_MAGIC));
+    size_t n = sizeof(DOC_MAGIC);
+    n += encode_varint(&head[n], raster ? (uint64_t)raster->w : 0);
+    n += encode_varint(&head[n], raster ? (uint64_t)raster->h : 0);
+    n += encode_varint(&head[n], (uint64_t)(scene->count - scene->first));
+    w.ok = fwrite(head, 1, n, f) == n;
+
+    DeltaBase cursors[SHAPE_KIND_COUNT] = {0};
+    int kind = 0;
+    int run = 0;
+    for (int i = scene->first; w.ok && i < scene->count; ++i)
+    {
+        uint32_t entry = scene->order[i];
+        int k = (int)(entry >> SHAPE_KIND_SHIFT);
+        if (run > 0 && (k != kind || run == BLOCK_MAX_SHAPES))
+        {
+            emit_block(&w, kind + 1, run);
+            run = 0;
+        }
+        kind = k;
+        put_shape(&w, scene, entry, &cursors[k]);
+        run++;
+    }
+    if (run > 0)
+        emit_block(&w, kind + 1, run);
+    if (raster)
+        put_raster(&w, raster);
+
+    uint8_t end = BLOCK_END;
+    if (w.ok && fwrite(&end, 1, 1, f) != 1)
+        w.ok = false;
+    free(w.buf);
+    if (fclose(f) != 0)
+        w.ok = false;
+
+    if (w.ok && rename(tmp, path) == 0)
+        return true;
+    unlink(tmp);
+    return false;
+}
+
+typedef struct
+{
+    const uint8_t* p;
+    const uint8_t* end;
+    bool ok;
+} Reader;
+
+static uint64_t
+get_varint(Reader* r)
+{
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64 && r->p < r->end; shift += 7)
+    {
+        uint8_t b = *r->p++;
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return v;
+    }
+    r->ok = false;
+    return 0;
+}
+
+static int64_t
+get_svarint(Reader* r)
+{
+    uint64_t v = get_varint(r);
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+// A delta that leaves int32 means the file is corrupt.
+static int32_t
+get_coord(Reader* r, int64_t base)
+{
+    int64_t d = get_svarint(r);
+    if (d < -DOC_MAX_DELTA || d > DOC_MAX_DELTA || base + d < INT32_MIN || base + d > INT32_MAX)
+    {
+        r->ok = false;
+        return 0;
+    }
+    return (int32_t)(base + d);
+}
+
+static void
+get_color_style(Reader* r, DeltaBase* c, uint32_t* color, uint16_t* style)
+{
+    uint64_t x = get_varint(r);
+    uint64_t s = get_varint(r);
+    if (x > UINT32_MAX || s > UINT16_MAX)
+        r->ok = false;
+    c->color ^= (uint32_t)x;
+    *color = pixel_from_xrgb(c->color);
+    *style = (uint16_t)s;
+}
+
+static void
+get_polygon(Reader* r, Scene* scene, DeltaBase* c)
+{
+    uint64_t n = get_varint(r);
+    uint32_t color;
+    uint16_t style;
+    get_color_style(r, c, &color, &style);
+    // Every vertex takes at least two bytes.
+    if (n == 0 || n > (uint64_t)(r->end - r->p) / 2)
+        r->ok = false;
+    if (!r->ok)
+        return;
+
+    for (uint64_t v = 0; r->ok && v < n; ++v)
+    {
+        c->x = get_coord(r, c->x);
+        c->y = get_coord(r, c->y);
+        if (v == 0)
+            scene_begin_polygon(scene, c->x, c->y, color, style);
+        else
+            scene_extend_polygon(scene, c->x, c->y);
+    }
+
+    const PolygonList* l = &scene->polygons;
+    if (l->count == 0 || l->vertex_count[l->count - 1] != n)
+        r->ok = false;
+}
+
+static void
+get_shapes(Reader* r, Scene* scene, ShapeKind kind, uint64_t count, DeltaBase* c)
+{
+    // Every shape takes at least two bytes.
+    if (count > (uint64_t)(r->end - r->p) / 2)
+        r->ok = false;
+
+    uint32_t color;
+    uint16_t style;
+    for (uint64_t i = 0; r->ok && i < count; ++i)
+    {
+        int before = scene->count;
+        if (kind == SHAPE_POINT)
+        {
+            c->x = get_coord(r, c->x);
+            c->y = get_coord(r, c->y);
+            get_color_style(r, c, &color, &style);
+            if (r->ok)
+                scene_add_point(scene, c->x, c->y, color, style);
+        }
+        else if (kind == SHAPE_LINE)
+        {
+            int32_t x0 = get_coord(r, c->x);
+            int32_t y0 = get_coord(r, c->y);
+            c->x = get_coord(r, x0);
+            c->y = get_coord(r, y0);
+            get_color_style(r, c, &color, &style);
+            if (r->ok)
+                scene_add_line(scene, x0, y0, c->x, c->y, color, style);
+        }
+        else if (kind == SHAPE_CIRCLE)
+        {
+            c->x = get_coord(r, c->x);
+            c->y = get_coord(r, c->y);
+            uint64_t radius = get_varint(r);
+            get_color_style(r, c, &color, &style);
+            if (radius > INT32_MAX)
+                r->ok = false;
+            if (r->ok)
+                scene_add_circle(scene, c->x, c->y, (int)radius, color, style);
+        }
+        else
+        {
+            get_polygon(r, scene, c);
+        }
+
+        // The scene drops shapes it has no memory for.
+        if (scene->count != before + 1)
+            r->ok = false;
+    }
+}
+
+// Decodes one raster block into ctx. *used says whether the pixels in ctx are already
+// replaced; the first block that applies blackens the clip rect before drawing its tiles.
+static void
+get_raster(Reader* r, uint64_t count, DisplayContext* ctx, bool* used)
+{
+    Rect a;
+    a.x0 = (int)get_varint(r);
+    a.y0 = (int)get_varint(r);
+    a.x1 = (int)get_varint(r);
+    a.y1 = (int)get_varint(r);
+    if (!r->ok)
+        return;
+    const Rect c = ctx->clip;
+    if (a.x0 != c.x0 || a.y0 != c.y0 || a.x1 != c.x1 || a.y1 != c.y1 || count == 0)
+        return;
+
+    if (!*used)
+    {
+        damage_rect(ctx, c.x0, c.y0, c.x1, c.y1);
+        for (int y = c.y0; y < c.y1; ++y)
+            fill_span(ctx, y, c.x0, c.x1, pack_rgb(0, 0, 0));
+        *used = true;
+    }
+
+    int tiles_x = (a.x1 - a.x0 + TILE_SIZE - 1) / TILE_SIZE;
+    int tiles_y = (a.y1 - a.y0 + TILE_SIZE - 1) / TILE_SIZE;
+    int64_t t = -1;
+    for (uint64_t i = 0; r->ok && i < count; ++i)
+    {
+        uint64_t step = get_varint(r);
+        if (step == 0 || step > (uint64_t)tiles_x * (uint64_t)tiles_y)
+        {
+            r->ok = false;
+            return;
+        }
+        t += (int64_t)step;
+        if (t >= (int64_t)tiles_x * tiles_y)
+        {
+            r->ok = false;
+            return;
+        }
+
+        Rect tile = tile_area(a, tiles_x, (int)t);
+        int tw = tile.x1 - tile.x0;
+        uint64_t left = (uint64_t)tw * (uint64_t)(tile.y1 - tile.y0);
+        uint32_t color = 0;
+        int x = 0;
+        int y = tile.y0;
+        while (r->ok && left > 0)
+        {
+            uint64_t run = get_varint(r);
+            color ^= (uint32_t)get_varint(r);
+            if (run == 0 || run > left)
+            {
+                r->ok = false;
+                return;
+            }
+            left -= run;
+            uint32_t pixel = pixel_from_xrgb(color);
+            while (run > 0)
+            {
+                int n = run < (uint64_t)(tw - x) ? (int)run : tw - x;
+                span_fill32(&ctx->fb.data[(size_t)y * ctx->w + tile.x0 + x], pixel, (size_t)n);
+                run -= (uint64_t)n;
+                x += n;
+                if (x == tw)
+                {
+                    x = 0;
+                    y++;
+                }
+            }
+        }
+    }
+}
+
+static bool
+read_document(Reader* r, Scene* scene, DisplayContext* raster, bool* raster_used)
+{
+    if ((size_t)(r->end - r->p) < sizeof(DOC_MAGIC) || memcmp(r->p, DOC_MAGIC, 8) != 0)
+        return false;
+    r->p += sizeof(DOC_MAGIC);
+
+    uint64_t w = get_varint(r);
+    uint64_t h = get_varint(r);
+    uint64_t shapes = get_varint(r);
+    if (!r->ok || w > DOC_MAX_SIDE || h > DOC_MAX_SIDE || shapes > SHAPE_INDEX_MASK)
+        return false;
+    if (raster && (w != (uint64_t)raster->w || h != (uint64_t)raster->h))
+        raster = NULL;
+
+    int first = scene->count;
+    DeltaBase cursors[SHAPE_KIND_COUNT] = {0};
+    for (;;)
+    {
+        uint64_t tag = get_varint(r);
+        if (!r->ok)
+            return false;
+        if (tag == BLOCK_END)
+            break;
+
+        uint64_t count = get_varint(r);
+        uint64_t bytes = get_varint(r);
+        if (!r->ok || bytes > (uint64_t)(r->end - r->p))
+            return false;
+        Reader block = {r->p, r->p + bytes, true};
+        r->p += bytes;
+
+        if (tag >= 1 && tag <= SHAPE_KIND_COUNT)
+            get_shapes(&block, scene, (ShapeKind)(tag - 1), count, &cursors[tag - 1]);
+        else if (tag == BLOCK_RASTER && raster)
+            get_raster(&block, count, raster, raster_used);
+        if (!block.ok)
+            return false;
+    }
+    return (uint64_t)(scene->count - first) == shapes;
+}
+
+bool
+document_load(const char* path, Scene* scene, DisplayContext* ctx)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    void* map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return false;
+    madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    // Stored pixels only stand in for the shapes when nothing else is drawn underneath.
+    bool was_empty = scene->count == scene->first;
+    int first = scene->count;
+    SceneMark mark = scene_mark(scene);
+    bool raster_used = false;
+
+    Reader r = {map, (const uint8_t*)map + st.st_size, true};
+    bool ok = read_document(&r, scene, was_empty ? ctx : NULL, &raster_used);
+    munmap(map, (size_t)st.st_size);
+
+    if (!ok)
+    {
+        scene_restore_mark(scene, mark);
+        if (raster_used)
+        {
+            const Rect c = ctx->clip;
+            damage_rect(ctx, c.x0, c.y0, c.x1, c.y1);
+            for (int y = c.y0; y < c.y1; ++y)
+                fill_span(ctx, y, c.x0, c.x1, pack_rgb(0, 0, 0));
+        }
+        return false;
+    }
+
+    if (ctx && !raster_used)
+    {
+        if (was_empty)
+            render_scene_tiled(scene, ctx);
+        else
+            scene_render_range(scene, ctx, first, scene->count);
+    }
+    return true;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "types.h"
+
+// Drawings on disk: the visible shapes of a scene in commit order, as blocks of consecutive
+// shapes of one kind with varint, delta-coded coordinates, optionally followed by the
+// rasterized pixels as run-length coded tiles. Both directions stream block by block; the
+// reader decodes straight from a read-only mapping of the file.
+
+// Writes the shapes after the last clear. With raster non-NULL its pixels inside the clip
+// rect are stored as well, so a loader with the same size and clip can skip rasterizing.
+bool document_save(const char* path, const Scene* scene, const DisplayContext* raster);
+
+// Appends the shapes of the document to scene. When ctx is non-NULL they are also drawn into
+// it: copied from the stored pixels if the scene was empty and they match ctx's size and
+// clip, rasterized otherwise. On failure the scene is left as it was and false is returned.
+bool document_load(const char* path, Scene* scene, DisplayContext* ctx);
@@ -1,78 +1,714 @@
 #include "draw.h"
 
-#include "display.h"
+#include "damage.h"
+#include "framebuffer.h"
+#include "kernels.h"
+#include "overlay.h"
 
+#include <math.h>
+#include <stdint.h>
 #include <stdlib.h>
 
-void
-draw_line(DisplayContext* ctx, int x0, int y0, int x1, int y1, uint8_t r, uint8_t g, uint8_t b)
+// Primitives report their bounding box once up front and then write pixels without
+// per-pixel damage bookkeeping.
+static void
+damage_line(DisplayContext* ctx, int x0, int y0, int x1, int y1, int thickness)
+{
+    int half = thickness > 1 ? thickness / 2 : 0;
+    int min_x = x0 < x1 ? x0 : x1;
+    int max_x = x0 < x1 ? x1 : x0;
+    int min_y = y0 < y1 ? y0 : y1;
+    int max_y = y0 < y1 ? y1 : y0;
+    damage_rect(ctx, min_x - half, min_y - half, max_x + half + 1, max_y + half + 1);
+}
+
+static inline void
+plot(DisplayContext* ctx, int x, int y, uint32_t color)
+{
+    if (x < ctx->clip.x0 || x >= ctx->clip.x1 || y < ctx->clip.y0 || y >= ctx->clip.y1)
+        return;
+
+    if (ctx->overlay.active)
+        overlay_push(ctx, y, x, x + 1, color);
+    else
+        ctx->fb.data[y * ctx->w + x] = color;
+}
+
+// Only for points already known to be inside ctx->clip.
+static inline void
+plot_unchecked(DisplayContext* ctx, int x, int y, uint32_t color)
 {
-    int dx = abs(x1 - x0);
-    int sx = x0 < x1 ? 1 : -1;
-    int dy = -abs(y1 - y0);
-    int sy = y0 < y1 ? 1 : -1;
-    int err = dx + dy;
+    if (ctx->overlay.active)
+        overlay_push(ctx, y, x, x + 1, color);
+    else
+        ctx->fb.data[y * ctx->w + x] = color;
+}
 
-    while (1)
+static void
+plot_thick(DisplayContext* ctx, int x, int y, int thickness, uint32_t color)
+{
+    if (thickness <= 1)
     {
-        put_pixel(ctx, x0, y0, r, g, b);
+        plot(ctx, x, y, color);
+        return;
+    }
 
-        if (x0 == x1 && y0 == y1)
-            break;
+    int half = thickness / 2;
+    for (int yy = y - half; yy <= y + half; ++yy)
+        fill_span(ctx, yy, x - half, x + half + 1, color);
+}
+
+typedef struct
+{
+    int x0, y0;
+    int x, y;
+    int x1, y1;
+    int dx, dy;
+    int sx, sy;
+    int err;
+} LineWalker;
+
+static void
+walker_init(LineWalker* lw, int x0, int y0, int x1, int y1)
+{
+    lw->x0 = x0;
+    lw->y0 = y0;
+    lw->x = x0;
+    lw->y = y0;
+    lw->x1 = x1;
+    lw->y1 = y1;
+    lw->dx = abs(x1 - x0);
+    lw->sx = x0 < x1 ? 1 : -1;
+    lw->dy = -abs(y1 - y0);
+    lw->sy = y0 < y1 ? 1 : -1;
+    lw->err = lw->dx + lw->dy;
+}
+
+// Advances to the next Bresenham point; returns false once the end point has been visited.
+static bool
+walker_step(LineWalker* lw)
+{
+    if (lw->x == lw->x1 && lw->y == lw->y1)
+        return false;
+
+    int e2 = 2 * lw->err;
+    if (e2 >= lw->dy)
+    {
+        lw->err += lw->dy;
+        lw->x += lw->sx;
+    }
+    if (e2 <= lw->dx)
+    {
+        lw->err += lw->dx;
+        lw->y += lw->sy;
+    }
+    return true;
+}
+
+// The major axis advances on every step, and after k steps the minor axis has advanced
+// floor((2 * minor * k + major) / (2 * major)) times, so any point of the walk can be
+// reached in O(1).
+static void
+walker_seek(LineWalker* lw, int k)
+{
+    int64_t a = lw->dx;
+    int64_t b = -lw->dy;
+    if (a >= b)
+    {
+        int64_t n = a ? (2 * b * k + a) / (2 * a) : 0;
+        lw->x = lw->x0 + lw->sx * k;
+        lw->y = lw->y0 + lw->sy * (int)n;
+        lw->err = (int)((a - b) - (int64_t)k * b + n * a);
+    }
+    else
+    {
+        int64_t m = (2 * a * k + b) / (2 * b);
+        lw->x = lw->x0 + lw->sx * (int)m;
+        lw->y = lw->y0 + lw->sy * k;
+        lw->err = (int)((a - b) + (int64_t)k * a - m * b);
+    }
+}
+
+static int64_t
+ceil_div(int64_t a, int64_t b)
+{
+    return a >= 0 ? (a + b - 1) / b : -((-a) / b);
+}
+
+// Range of t for which origin + s * t lies in [lo, hi].
+static void
+axis_range(int origin, int s, int lo, int hi, int64_t* t0, int64_t* t1)
+{
+    if (s > 0)
+    {
+        *t0 = (int64_t)lo - origin;
+        *t1 = (int64_t)hi - origin;
+    }
+    else
+    {
+        *t0 = (int64_t)origin - hi;
+        *t1 = (int64_t)origin - lo;
+    }
+}
+
+// Finds the steps [k0, k1] of the walk whose points lie within ctx->clip grown by `pad` on
+// every side, so the rasterizers never visit points that cannot touch a visible pixel.
+static bool
+walker_clip(const DisplayContext* ctx, const LineWalker* lw, int pad, int* k0, int* k1)
+{
+    const Rect* c = &ctx->clip;
+    int64_t major = lw->dx >= -lw->dy ? lw->dx : -lw->dy;
+    int64_t minor = lw->dx >= -lw->dy ? -lw->dy : lw->dx;
+    bool x_major = lw->dx >= -lw->dy;
+
+    int64_t j0, j1, n0, n1;
+    if (x_major)
+    {
+        axis_range(lw->x0, lw->sx, c->x0 - pad, c->x1 - 1 + pad, &j0, &j1);
+        axis_range(lw->y0, lw->sy, c->y0 - pad, c->y1 - 1 + pad, &n0, &n1);
+    }
+    else
+    {
+        axis_range(lw->y0, lw->sy, c->y0 - pad, c->y1 - 1 + pad, &j0, &j1);
+        axis_range(lw->x0, lw->sx, c->x0 - pad, c->x1 - 1 + pad, &n0, &n1);
+    }
+
+    int64_t lo = j0 > 0 ? j0 : 0;
+    int64_t hi = j1 < major ? j1 : major;
+
+    if (minor == 0)
+    {
+        if (n0 > 0 || n1 < 0)
+            return false;
+    }
+    else
+    {
+        // Invert the minor-axis step count: it is >= n0 from k = ceil((2*M*n0 - M) / 2m) on
+        // and stays <= n1 up to k = ceil((2*M*n1 + M) / 2m) - 1.
+        int64_t from = ceil_div(2 * major * n0 - major, 2 * minor);
+        int64_t to = ceil_div(2 * major * n1 + major, 2 * minor) - 1;
+        if (from > lo)
+            lo = from;
+        if (to < hi)
+            hi = to;
+    }
+
+    if (lo > hi)
+        return false;
+
+    *k0 = (int)lo;
+    *k1 = (int)hi;
+    return true;
+}
+
+// Per-row x extents of a run of Bresenham points, reused between calls (per thread, since
+// tiles are rasterized in parallel).
+static _Thread_local int* run_lo;
+static _Thread_local int* run_hi;
+static _Thread_local int run_cap;
+
+static bool
+reserve_run_rows(int rows)
+{
+    if (rows <= run_cap)
+        return true;
+
+    int cap = run_cap ? run_cap : 256;
+    while (cap < rows)
+        cap *= 2;
+
+    int* lo = realloc(run_lo, (size_t)cap * sizeof(int));
+    if (!lo)
+        return false;
+    run_lo = lo;
+    int* hi = realloc(run_hi, (size_t)cap * sizeof(int));
+    if (!hi)
+        return false;
+    run_hi = hi;
+    run_cap = cap;
+    return true;
+}
+
+// Draws the next `count` points of a walk that clipping has put inside ctx->clip. The walker
+// state lives in locals for the loop: the pixel stores could otherwise alias it.
+static void
+plot_run(DisplayContext* ctx, LineWalker* lw, int count, uint32_t color)
+{
+    if (ctx->overlay.active)
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            overlay_push(ctx, lw->y, lw->x, lw->x + 1, color);
+            walker_step(lw);
+        }
+        return;
+    }
+
+    uint32_t* p = &ctx->fb.data[lw->y * ctx->w + lw->x];
+    const int row_step = lw->sy * ctx->w;
+    const int dx = lw->dx;
+    const int dy = lw->dy;
+    const int sx = lw->sx;
+    int err = lw->err;
+    int moved_x = 0;
+    int moved_y = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        *p = color;
 
         int e2 = 2 * err;
         if (e2 >= dy)
         {
             err += dy;
-            x0 += sx;
+            moved_x++;
+            p += sx;
         }
         if (e2 <= dx)
         {
             err += dx;
-            y0 += sy;
+            moved_y++;
+            p += row_step;
         }
     }
+
+    lw->err = err;
+    lw->x += moved_x * sx;
+    lw->y += moved_y * lw->sy;
 }
 
-void
-draw_dotted_line(DisplayContext* ctx,
+// Rasterizes the next `count` points of the walk as if a (2*half+1)^2 square were stamped at
+// each of them, but writes every covered pixel once as part of a row span.
+static void
+stroke_run(DisplayContext* ctx, LineWalker* lw, int count, int half, uint32_t color)
+{
+    int y_first = lw->y;
+    int rows = 0;
+
+    // Consecutive points are monotonic in both axes, so each row of the run is one x range.
+    for (int i = 0; i < count; ++i)
+    {
+        int k = (lw->y - y_first) * lw->sy;
+        if (k == rows)
+        {
+            run_lo[k] = lw->x;
+            run_hi[k] = lw->x;
+            rows++;
+        }
+        else if (lw->x < run_lo[k])
+            run_lo[k] = lw->x;
+        else if (lw->x > run_hi[k])
+            run_hi[k] = lw->x;
+
+        walker_step(lw);
+    }
+
+    // Row y is covered by the squares of rows [y - half, y + half]; since x moves in one
+    // direction along the walk, their union is bounded by the first and last of those rows.
+    int y_last = y_first + (rows - 1) * lw->sy;
+    int y_top = (lw->sy > 0 ? y_first : y_last) - half;
+    int y_bottom = (lw->sy > 0 ? y_last : y_first) + half;
+    if (y_top < ctx->clip.y0)
+        y_top = ctx->clip.y0;
+    if (y_bottom > ctx->clip.y1 - 1)
+        y_bottom = ctx->clip.y1 - 1;
+
+    for (int y = y_top; y <= y_bottom; ++y)
+    {
+        int ka = (lw->sy > 0 ? y - half - y_first : y_first - y - half);
+        int kb = ka + 2 * half;
+        if (ka < 0)
+            ka = 0;
+        if (kb > rows - 1)
+            kb = rows - 1;
+
+        int lo = lw->sx > 0 ? run_lo[ka] : run_lo[kb];
+        int hi = lw->sx > 0 ? run_hi[kb] : run_hi[ka];
+        fill_span(ctx, y, lo - half, hi + half + 1, color);
+    }
+}
+
+static void
+draw_run(DisplayContext* ctx, LineWalker* lw, int count, int half, uint32_t color)
+{
+    if (half > 0)
+        stroke_run(ctx, lw, count, half, color);
+    else
+        plot_run(ctx, lw, count, color);
+}
+
+// Solid lines are a single run over the clipped part of the walk.
+static inline void
+draw_solid(DisplayContext* ctx, int x0, int y0, int x1, int y1, int half, uint32_t color)
+{
+    LineWalker lw;
+    walker_init(&lw, x0, y0, x1, y1);
+
+    int k0, k1;
+    if (!walker_clip(ctx, &lw, half, &k0, &k1))
+        return;
+    if (half > 0 && !reserve_run_rows(k1 - k0 + 1))
+        return;
+
+    walker_seek(&lw, k0);
+    draw_run(ctx, &lw, k1 - k0 + 1, half, color);
+}
+
+#define PATTERN_SEEK_MIN_GAP 16
+
+// Draws the clipped line with an on/off pattern (on_len > 0, off_len > 0). The phase is
+// taken from the step index, so dashes stay where the unclipped line would have put them.
+// Dashes are runs and long gaps a single seek, so nothing is tested per pixel.
+static void
+draw_pattern(DisplayContext* ctx,
     int x0,
     int y0,
     int x1,
     int y1,
-    uint8_t r,
-    uint8_t g,
-    uint8_t b)
+    int half,
+    int on_len,
+    int off_len,
+    uint32_t color)
 {
-    int dx = abs(x1 - x0);
-    int sx = x0 < x1 ? 1 : -1;
-    int dy = -abs(y1 - y0);
-    int sy = y0 < y1 ? 1 : -1;
-    int err = dx + dy;
+    LineWalker lw;
+    walker_init(&lw, x0, y0, x1, y1);
 
-    int counter = 0;
+    int k0, k1;
+    if (!walker_clip(ctx, &lw, half, &k0, &k1))
+        return;
+    if (half > 0 && !reserve_run_rows(on_len))
+        return;
 
-    while (1)
+    int period = on_len + off_len;
+    int k = k0;
+    int phase = k0 % period;
+    if (phase >= on_len)
     {
-        if ((counter % 10) < 2)
-            put_pixel(ctx, x0, y0, r, g, b);
-        counter++;
+        k += period - phase;
+        phase = 0;
+    }
 
-        if (x0 == x1 && y0 == y1)
+    walker_seek(&lw, k);
+    while (k <= k1)
+    {
+        int n = on_len - phase;
+        if (n > k1 - k + 1)
+            n = k1 - k + 1;
+        draw_run(ctx, &lw, n, half, color);
+        k += n;
+        phase = 0;
+        if (k > k1)
             break;
 
-        int e2 = 2 * err;
-        if (e2 >= dy)
-        {
-            err += dy;
-            x0 += sx;
-        }
-        if (e2 <= dx)
+        // Short gaps are cheaper to step over than to seek past.
+        int gap = off_len < k1 - k + 1 ? off_len : k1 - k + 1;
+        if (gap > PATTERN_SEEK_MIN_GAP)
+            walker_seek(&lw, k + gap);
+        else
+            for (int i = 0; i < gap; ++i)
+                walker_step(&lw);
+        k += gap;
+    }
+}
+
+// Anti-aliased pens cover pixels by a box filter of the pen, in 1/AA_ONE steps, blended over
+// the pixels already there. Coverage is computed in fixed point from the pixel's own
+// coordinates, so any clip gives the same result.
+#define AA_ONE 256
+
+static inline void
+blend_pixel(DisplayContext* ctx, int x, int y, uint32_t color, int alpha)
+{
+    if (alpha <= 0)
+        return;
+    if (alpha >= AA_ONE)
+    {
+        plot(ctx, x, y, color);
+        return;
+    }
+    if (x < ctx->clip.x0 || x >= ctx->clip.x1 || y < ctx->clip.y0 || y >= ctx->clip.y1)
+        return;
+
+    if (ctx->overlay.active)
+    {
+        overlay_push_blend(ctx, y, x, x + 1, color, alpha);
+        return;
+    }
+    uint32_t* p = &ctx->fb.data[y * ctx->w + x];
+    *p = blend32(*p, color, (uint32_t)alpha);
+}
+
+// Anti-aliased lines step along the major axis in increasing order. Across the minor axis,
+// pixel j spans [j, j + 1) in 16.16 fixed point, so a pixel centre sits at j + 0.5.
+typedef struct
+{
+    bool x_major;
+    int m0;         // major-axis start
+    int k0, k1;     // steps inside the clip
+    int n_lo, n_hi; // minor-axis clip, inclusive
+    int64_t centre; // pen centre across the minor axis at step k0
+    int64_t slope;  // minor-axis advance per step
+    int64_t half;   // half the pen's extent across the minor axis
+} AaWalk;
+
+// Returns false if the clipped walk is empty. The caller handles zero-length lines.
+static bool
+aa_walk_init(const DisplayContext* ctx, int x0, int y0, int x1, int y1, int thickness, AaWalk* w)
+{
+    int dx = x1 - x0;
+    int dy = y1 - y0;
+    w->x_major = abs(dx) >= abs(dy);
+    if (w->x_major ? dx < 0 : dy < 0)
+    {
+        x0 = x1;
+        y0 = y1;
+        dx = -dx;
+        dy = -dy;
+    }
+
+    int major = w->x_major ? dx : dy;
+    int minor = w->x_major ? dy : dx;
+    int n0 = w->x_major ? y0 : x0;
+    w->m0 = w->x_major ? x0 : y0;
+
+    // A pen `thickness` wide across the line is thickness * len / major across the minor axis.
+    double len = sqrt((double)dx * dx + (double)dy * dy);
+    w->half = llround(thickness * len / major * 32768.0);
+    w->slope = llround((double)minor * 65536.0 / major);
+
+    const Rect* c = &ctx->clip;
+    int m_lo = w->x_major ? c->x0 : c->y0;
+    int m_hi = (w->x_major ? c->x1 : c->y1) - 1;
+    w->n_lo = w->x_major ? c->y0 : c->x0;
+    w->n_hi = (w->x_major ? c->y1 : c->x1) - 1;
+    w->k0 = m_lo - w->m0 > 0 ? m_lo - w->m0 : 0;
+    w->k1 = m_hi - w->m0 < major ? m_hi - w->m0 : major;
+    w->centre = (int64_t)n0 * 65536 + 32768 + w->k0 * w->slope;
+    return w->k0 <= w->k1 && w->n_lo <= w->n_hi;
+}
+
+// Minor-axis pixel j of step m, skipped outside the clip.
+static inline void
+aa_put(DisplayContext* ctx, const AaWalk* w, int m, int j, uint32_t color, int alpha)
+{
+    if (j < w->n_lo || j > w->n_hi)
+        return;
+    if (w->x_major)
+        blend_pixel(ctx, m, j, color, alpha);
+    else
+        blend_pixel(ctx, j, m, color, alpha);
+}
+
+// One-pixel pens are Xiaolin Wu's: each step splits full coverage between the two pixels
+// either side of the centre by its fractional part.
+static void
+line_aa_thin(DisplayContext* ctx, const Stroke* s, int x0, int y0, int x1, int y1)
+{
+    if (x0 == x1 && y0 == y1)
+    {
+        plot(ctx, x0, y0, s->color);
+        return;
+    }
+
+    AaWalk w;
+    if (!aa_walk_init(ctx, x0, y0, x1, y1, 1, &w))
+        return;
+
+    const bool direct = !ctx->overlay.active;
+    const ptrdiff_t step = w.x_major ? ctx->w : 1;
+    int64_t pos = w.centre - 32768;
+    for (int k = w.k0; k <= w.k1; ++k, pos += w.slope)
+    {
+        int m = w.m0 + k;
+        int j = (int)(pos >> 16);
+        uint32_t f = (uint32_t)(pos >> 8) & 0xff;
+        if (direct && j >= w.n_lo && j < w.n_hi)
         {
-            err += dx;
-            y0 += sy;
+            uint32_t* p = w.x_major ? &ctx->fb.data[j * ctx->w + m] : &ctx->fb.data[m * ctx->w + j];
+            p[0] = blend32(p[0], s->color, AA_ONE - f);
+            p[step] = blend32(p[step], s->color, f);
+            continue;
         }
+        aa_put(ctx, &w, m, j, s->color, (int)(AA_ONE - f));
+        aa_put(ctx, &w, m, j + 1, s->color, (int)f);
+    }
+}
+
+// Wider pens have butt ends at the end points. Each step covers [a, b) across the minor
+// axis: a partly covered pixel at either edge and an opaque run between them (a row span
+// when the minor axis is x).
+static void
+line_aa_thick(DisplayContext* ctx, const Stroke* s, int x0, int y0, int x1, int y1)
+{
+    if (x0 == x1 && y0 == y1)
+    {
+        plot_thick(ctx, x0, y0, s->thickness, s->color);
+        return;
     }
+
+    AaWalk w;
+    if (!aa_walk_init(ctx, x0, y0, x1, y1, s->thickness, &w))
+        return;
+
+    const bool direct = !ctx->overlay.active;
+    int64_t centre = w.centre;
+    for (int k = w.k0; k <= w.k1; ++k, centre += w.slope)
+    {
+        int m = w.m0 + k;
+        int64_t a = centre - w.half;
+        int64_t b = centre + w.half;
+        int top = (int)(a >> 16);
+        int bottom = (int)(b >> 16);
+
+        // The pen is at least two pixels across, so the edges never share a pixel.
+        aa_put(ctx, &w, m, top, s->color, (int)(((int64_t)(top + 1) * 65536 - a + 128) >> 8));
+        aa_put(ctx, &w, m, bottom, s->color, (int)((b - (int64_t)bottom * 65536 + 128) >> 8));
+
+        int f0 = top + 1 > w.n_lo ? top + 1 : w.n_lo;
+        int f1 = bottom - 1 < w.n_hi ? bottom - 1 : w.n_hi;
+        if (f0 > f1)
+            continue;
+        if (!w.x_major)
+            fill_span(ctx, m, f0, f1 + 1, s->color);
+        else if (direct)
+            for (uint32_t* p = &ctx->fb.data[f0 * ctx->w + m]; f0 <= f1; ++f0, p += ctx->w)
+                *p = s->color;
+        else
+            for (; f0 <= f1; ++f0)
+                plot_unchecked(ctx, m, f0, s->color);
+    }
+}
+
+// Specializations selected by stroke_make; the constant half width lets the compiler drop
+// the thin/thick branch from each.
+static void
+line_solid_thin(DisplayContext* ctx, const Stroke* s, int x0, int y0, int x1, int y1)
+{
+    draw_solid(ctx, x0, y0, x1, y1, 0, s->color);
+}
+
+static void
+line_solid_thick(DisplayContext* ctx, const Stroke* s, int x0, int y0, int x1, int y1)
+{
+    draw_solid(ctx, x0, y0, x1, y1, s->half, s->color);
+}
+
+static void
+line_pattern_thin(DisplayContext* ctx, const Stroke* s, int x0, int y0, int x1, int y1)
+{
+    draw_pattern(ctx, x0, y0, x1, y1, 0, s->on_len, s->off_len, s->color);
+}
+
+static void
+line_pattern_thick(DisplayContext* ctx, const Stroke* s, int x0, int y0, int x1, int y1)
+{
+    draw_pattern(ctx, x0, y0, x1, y1, s->half, s->on_len, s->off_len, s->color);
+}
+
+static void
+line_none(DisplayContext* ctx, const Stroke* s, int x0, int y0, int x1, int y1)
+{
+    (void)ctx;
+    (void)s;
+    (void)x0;
+    (void)y0;
+    (void)x1;
+    (void)y1;
+}
+
+int
+stroke_reach(int thickness, int line_style)
+{
+    // An anti-aliased pen reaches thickness / sqrt(2) across a diagonal, plus the pixel it
+    // partly covers (181 / 256 > 1 / sqrt(2)).
+    if (line_style == LINE_STYLE_AA)
+        return thickness * 181 / 256 + 1;
+    return thickness > 1 ? thickness / 2 : 0;
+}
+
+Stroke
+stroke_make_pattern(uint32_t color, int thickness, int on_len, int off_len)
+{
+    Stroke s = {
+        .color = color,
+        .thickness = thickness,
+        .half = thickness > 1 ? thickness / 2 : 0,
+        .reach = stroke_reach(thickness, LINE_STYLE_SOLID),
+        .on_len = on_len,
+        .off_len = off_len,
+        .dashed_circle = false,
+        .aa = false,
+    };
+    if (s.off_len < 0 || s.on_len + s.off_len <= 0)
+        s.off_len = 0;
+
+    if (on_len <= 0)
+        s.line = line_none;
+    else if (s.off_len == 0)
+        s.line = s.half > 0 ? line_solid_thick : line_solid_thin;
+    else
+        s.line = s.half > 0 ? line_pattern_thick : line_pattern_thin;
+    return s;
+}
+
+Stroke
+stroke_make(uint32_t color, int thickness, int line_style)
+{
+    Stroke s;
+    if (line_style == LINE_STYLE_AA)
+    {
+        s = stroke_make_pattern(color, thickness, 1, 0);
+        s.reach = stroke_reach(thickness, LINE_STYLE_AA);
+        s.aa = true;
+        s.line = s.half > 0 ? line_aa_thick : line_aa_thin;
+        return s;
+    }
+    if (line_style == LINE_STYLE_DOTTED)
+        s = stroke_make_pattern(color, 1, 2, 8);
+    else if (line_style == LINE_STYLE_DASHED)
+        s = stroke_make_pattern(color, thickness, 6, 4);
+    else
+        s = stroke_make_pattern(color, thickness, 1, 0);
+
+    // Circles keep their own 6/4 dash for any patterned style, and their pen width.
+    s.thickness = thickness;
+    s.dashed_circle = line_style != LINE_STYLE_SOLID;
+    return s;
+}
+
+void
+stroke_line(DisplayContext* ctx, const Stroke* s, int x0, int y0, int x1, int y1)
+{
+    damage_line(ctx, x0, y0, x1, y1, 2 * s->reach + 1);
+    s->line(ctx, s, x0, y0, x1, y1);
+}
+
+void
+stroke_point(DisplayContext* ctx, const Stroke* s, int x, int y)
+{
+    uint8_t r, g, b;
+    unpack_rgb(s->color, &r, &g, &b);
+    put_pixel_thick(ctx, x, y, s->thickness, r, g, b);
+}
+
+void
+draw_line(DisplayContext* ctx, int x0, int y0, int x1, int y1, uint8_t r, uint8_t g, uint8_t b)
+{
+    Stroke s = stroke_make(pack_rgb(r, g, b), 1, LINE_STYLE_SOLID);
+    stroke_line(ctx, &s, x0, y0, x1, y1);
+}
+
+void
+draw_dotted_line(DisplayContext* ctx,
+    int x0,
+    int y0,
+    int x1,
+    int y1,
+    uint8_t r,
+    uint8_t g,
+    uint8_t b)
+{
+    Stroke s = stroke_make(pack_rgb(r, g, b), 1, LINE_STYLE_DOTTED);
+    stroke_line(ctx, &s, x0, y0, x1, y1);
 }
 
 void
@@ -86,31 +722,8 @@ draw_line_thick(DisplayContext* ctx,
     uint8_t g,
     uint8_t b)
 {
-    int dx = abs(x1 - x0);
-    int sx = x0 < x1 ? 1 : -1;
-    int dy = -abs(y1 - y0);
-    int sy = y0 < y1 ? 1 : -1;
-    int err = dx + dy;
-
-    while (1)
-    {
-        put_pixel_thick(ctx, x0, y0, thickness, r, g, b);
-
-        if (x0 == x1 && y0 == y1)
-            break;
-
-        int e2 = 2 * err;
-        if (e2 >= dy)
-        {
-            err += dy;
-            x0 += sx;
-        }
-        if (e2 <= dx)
-        {
-            err += dx;
-            y0 += sy;
-        }
-    }
+    Stroke s = stroke_make(pack_rgb(r, g, b), thickness, LINE_STYLE_SOLID);
+    stroke_line(ctx, &s, x0, y0, x1, y1);
 }
 
 void
@@ -126,38 +739,8 @@ draw_dashed_line_thick(DisplayContext* ctx,
     uint8_t g,
     uint8_t b)
 {
-    int dx = abs(x1 - x0);
-    int sx = x0 < x1 ? 1 : -1;
-    int dy = -abs(y1 - y0);
-    int sy = y0 < y1 ? 1 : -1;
-    int err = dx + dy;
-
-    int counter = 0;
-    int period = on_len + off_len;
-    if (period <= 0)
-        period = 1;
-
-    while (1)
-    {
-        if ((counter % period) < on_len)
-            put_pixel_thick(ctx, x0, y0, thickness, r, g, b);
-        counter++;
-
-        if (x0 == x1 && y0 == y1)
-            break;
-
-        int e2 = 2 * err;
-        if (e2 >= dy)
-        {
-            err += dy;
-            x0 += sx;
-        }
-        if (e2 <= dx)
-        {
-            err += dx;
-            y0 += sy;
-        }
-    }
+    Stroke s = stroke_make_pattern(pack_rgb(r, g, b), thickness, on_len, off_len);
+    stroke_line(ctx, &s, x0, y0, x1, y1);
 }
 
 void
@@ -184,25 +767,347 @@ snap_to_axis(int x0, int y0, int* x1, int* y1)
     }
 }
 
+// Circle dashes are laid out by arc length along the nominal radius: 6 on, 4 off, with the
+// period stretched so a whole number of dashes closes the ring. Each pixel is classified by
+// its angle, so every octant and every ring of a thick pen shares the same dash edges.
+#define CIRCLE_DASH_PERIOD 10.0
+#define CIRCLE_DASH_ON 0.6
+
+typedef struct
+{
+    double periods_per_radian;
+} ArcDash;
+
+static ArcDash
+arc_dash_make(int radius)
+{
+    const double two_pi = 6.283185307179586;
+    double periods = floor(two_pi * radius / CIRCLE_DASH_PERIOD + 0.5);
+    if (periods < 1.0)
+        periods = 1.0;
+    return (ArcDash){periods / two_pi};
+}
+
+static inline bool
+arc_dash_on(const ArcDash* dash, int dx, int dy)
+{
+    double t = (atan2((double)dy, (double)dx) + 3.141592653589793) * dash->periods_per_radian;
+    return t - floor(t) < CIRCLE_DASH_ON;
+}
+
 static void
 circle_plot8(DisplayContext* ctx,
     int cx,
     int cy,
     int x,
     int y,
+    bool inside,
+    const ArcDash* dash,
+    uint32_t color)
+{
+    const int ox[8] = {x, -x, x, -x, y, -y, y, -y};
+    const int oy[8] = {y, y, -y, -y, x, x, -x, -x};
+    for (int i = 0; i < 8; ++i)
+    {
+        if (dash && !arc_dash_on(dash, ox[i], oy[i]))
+            continue;
+        if (inside)
+            plot_unchecked(ctx, cx + ox[i], cy + oy[i], color);
+        else
+            plot(ctx, cx + ox[i], cy + oy[i], color);
+    }
+}
+
+static int64_t
+isqrt_floor(int64_t n)
+{
+    int64_t r = (int64_t)sqrt((double)n);
+    while (r > 0 && r * r > n)
+        --r;
+    while ((r + 1) * (r + 1) <= n)
+        ++r;
+    return r;
+}
+
+// Writes [x0, x1) of row y, keeping only the pixels inside a dash.
+static void
+dash_span(DisplayContext* ctx,
+    int y,
+    int x0,
+    int x1,
+    int cx,
+    int cy,
+    const ArcDash* dash,
+    uint32_t color)
+{
+    if (!dash)
+    {
+        fill_span(ctx, y, x0, x1, color);
+        return;
+    }
+
+    if (x0 < ctx->clip.x0)
+        x0 = ctx->clip.x0;
+    if (x1 > ctx->clip.x1)
+        x1 = ctx->clip.x1;
+
+    int run = x0;
+    for (int x = x0; x < x1; ++x)
+    {
+        if (arc_dash_on(dash, x - cx, y - cy))
+            continue;
+        if (run < x)
+            fill_span(ctx, y, run, x, color);
+        run = x + 1;
+    }
+    if (run < x1)
+        fill_span(ctx, y, run, x1, color);
+}
+
+// Pixels whose centres lie within [inner - 0.5, outer + 0.5] of the centre, one or two spans
+// per row. Squared distances being integers, that is inner^2 - inner < d^2 <= outer^2 + outer;
+// inner <= 0 gives a disc. Only rows inside the clip are visited and each row's extents are
+// computed directly, so output is the same for any clip and work is O(pixels written + rows).
+static void
+fill_annulus(DisplayContext* ctx,
+    int cx,
+    int cy,
+    int inner,
+    int outer,
+    const ArcDash* dash,
+    uint32_t color)
+{
+    int64_t outer_limit = (int64_t)outer * outer + outer;
+    int64_t inner_limit = inner > 0 ? (int64_t)inner * inner - inner : -1;
+
+    int y0 = cy - outer > ctx->clip.y0 ? cy - outer : ctx->clip.y0;
+    int y1 = cy + outer < ctx->clip.y1 - 1 ? cy + outer : ctx->clip.y1 - 1;
+    for (int y = y0; y <= y1; ++y)
+    {
+        int64_t dy2 = (int64_t)(y - cy) * (y - cy);
+        int xo = (int)isqrt_floor(outer_limit - dy2);
+        int64_t m = inner_limit - dy2;
+        int xi = m < 0 ? 0 : (int)isqrt_floor(m) + 1;
+
+        if (xi == 0)
+        {
+            dash_span(ctx, y, cx - xo, cx + xo + 1, cx, cy, dash, color);
+        }
+        else if (xi <= xo)
+        {
+            dash_span(ctx, y, cx - xo, cx - xi + 1, cx, cy, dash, color);
+            dash_span(ctx, y, cx + xi, cx + xo + 1, cx, cy, dash, color);
+        }
+    }
+}
+
+// Returns false when nothing of the box [cx - extent, cx + extent] is inside the clip.
+static bool
+damage_circle(DisplayContext* ctx, int cx, int cy, int extent, bool* inside)
+{
+    damage_rect(ctx, cx - extent, cy - extent, cx + extent + 1, cy + extent + 1);
+
+    const Rect* c = &ctx->clip;
+    if (cx + extent < c->x0 || cx - extent >= c->x1 || cy + extent < c->y0 || cy - extent >= c->y1)
+        return false;
+    *inside = cx - extent >= c->x0 && cx + extent < c->x1 && cy - extent >= c->y0 &&
+              cy + extent < c->y1;
+    return true;
+}
+
+static int64_t
+isqrt_ceil(int64_t n)
+{
+    return n <= 0 ? 0 : isqrt_floor(n - 1) + 1;
+}
+
+// Limits of an anti-aliased ring as squared pixel distances. Radii are in 1/AA_ONE px and a
+// pixel at distance d (floor(sqrt(d^2)) in the same units) is covered
+// clamp(outer + 128 - d) - clamp(inner + 128 - d), each clamped to [0, AA_ONE]; every
+// threshold on d becomes an exact one on the integer d^2.
+typedef struct
+{
+    int64_t outer, inner;
+    int64_t visible_max, visible_min; // d^2 range with nonzero coverage
+    int64_t full_max, full_min;       // d^2 range with full coverage
+} AaRing;
+
+static AaRing
+aa_ring_make(int radius, int thickness)
+{
+    AaRing ring;
+    ring.outer = (int64_t)radius * AA_ONE + (int64_t)thickness * AA_ONE / 2;
+    ring.inner = (int64_t)radius * AA_ONE - (int64_t)thickness * AA_ONE / 2;
+
+    int64_t v = ring.outer + 128;
+    int64_t w = ring.inner - 127;
+    int64_t f = ring.outer - 127;
+    int64_t g = ring.inner + 128;
+    ring.visible_max = ceil_div(v * v, AA_ONE * AA_ONE) - 1;
+    ring.visible_min = w > 0 ? ceil_div(w * w, AA_ONE * AA_ONE) : 0;
+    ring.full_max = f > 0 ? ceil_div(f * f, AA_ONE * AA_ONE) - 1 : -1;
+    ring.full_min = g > 0 ? ceil_div(g * g, AA_ONE * AA_ONE) : 0;
+    return ring;
+}
+
+static int
+aa_ring_coverage(const AaRing* ring, int64_t d2)
+{
+    // Only partly covered pixels get here, so a rounding difference in the last 1/256 of
+    // coverage is harmless; the limits above stay exact.
+    int64_t d = (int64_t)(sqrt((double)d2) * AA_ONE);
+    int64_t out = ring->outer + 128 - d;
+    int64_t in = ring->inner + 128 - d;
+    out = out < 0 ? 0 : (out > AA_ONE ? AA_ONE : out);
+    in = in < 0 ? 0 : (in > AA_ONE ? AA_ONE : in);
+    return (int)(out - in);
+}
+
+// Offsets dx in [lo, hi] of row y on one side of the centre (x = cx + sign * dx); those in
+// [f0, f1] are fully covered and written as one span.
+static void
+aa_ring_side(DisplayContext* ctx,
+    const AaRing* ring,
+    int cx,
+    int y,
+    int64_t dy2,
+    int sign,
+    int lo,
+    int hi,
+    int f0,
+    int f1,
+    uint32_t color)
+{
+    // Keep to the columns inside the clip.
+    int c0 = sign > 0 ? ctx->clip.x0 - cx : cx - (ctx->clip.x1 - 1);
+    int c1 = sign > 0 ? ctx->clip.x1 - 1 - cx : cx - ctx->clip.x0;
+    if (lo < c0)
+        lo = c0;
+    if (hi > c1)
+        hi = c1;
+
+    // Row y and [lo, hi] are inside the clip, which leaves only the overlay to check for.
+    const bool direct = !ctx->overlay.active;
+    for (int dx = lo; dx <= hi; ++dx)
+    {
+        if (dx >= f0 && dx <= f1)
+        {
+            int end = f1 < hi ? f1 : hi;
+            if (sign > 0)
+                fill_span(ctx, y, cx + dx, cx + end + 1, color);
+            else
+                fill_span(ctx, y, cx - end, cx - dx + 1, color);
+            dx = end;
+            continue;
+        }
+        int alpha = aa_ring_coverage(ring, (int64_t)dx * dx + dy2);
+        if (direct)
+        {
+            uint32_t* p = &ctx->fb.data[y * ctx->w + cx + sign * dx];
+            *p = blend32(*p, color, (uint32_t)alpha);
+        }
+        else
+            blend_pixel(ctx, cx + sign * dx, y, color, alpha);
+    }
+}
+
+// Pixel (x, r) of the first octant at alpha, in all eight octants. Mirror images that land on
+// the same pixel (on the axes and the diagonal) are blended once.
+static void
+wu_plot8(DisplayContext* ctx, int cx, int cy, int x, int r, uint32_t color, int alpha)
+{
+    for (int sx = 1; sx >= (x == 0 ? 1 : -1); sx -= 2)
+    {
+        for (int sy = 1; sy >= -1; sy -= 2)
+        {
+            blend_pixel(ctx, cx + sx * x, cy + sy * r, color, alpha);
+            if (r != x)
+                blend_pixel(ctx, cx + sy * r, cy + sx * x, color, alpha);
+        }
+    }
+}
+
+// One-pixel rings are Xiaolin Wu's: down the first octant, each column splits full coverage
+// between the pixels either side of the exact arc, one square root per eight columns.
+static void
+circle_aa_thin(DisplayContext* ctx, int cx, int cy, int radius, uint32_t color)
+{
+    int64_t r2 = (int64_t)radius * radius;
+    for (int x = 0; 2 * (int64_t)x * x <= r2; ++x)
+    {
+        int64_t y = (int64_t)(sqrt((double)(r2 - (int64_t)x * x)) * AA_ONE);
+        int j = (int)(y / AA_ONE);
+        int f = (int)(y % AA_ONE);
+        wu_plot8(ctx, cx, cy, x, j, color, AA_ONE - f);
+        wu_plot8(ctx, cx, cy, x, j + 1, color, f);
+    }
+}
+
+// Anti-aliased ring of a pen `thickness` wide around radius. Wider pens go row by row: one or
+// two runs of offsets per side of each row, with an opaque span where coverage is full.
+static void
+circle_aa(DisplayContext* ctx,
+    int cx,
+    int cy,
+    int radius,
     int thickness,
-    uint8_t r,
-    uint8_t g,
-    uint8_t b)
+    int reach,
+    uint32_t color)
+{
+    if (radius < 0)
+        radius = -radius;
+
+    bool inside;
+    if (!damage_circle(ctx, cx, cy, radius + reach, &inside))
+        return;
+    if (thickness <= 1)
+    {
+        circle_aa_thin(ctx, cx, cy, radius, color);
+        return;
+    }
+
+    AaRing ring = aa_ring_make(radius, thickness);
+    int extent = (int)isqrt_floor(ring.visible_max);
+    int y0 = cy - extent > ctx->clip.y0 ? cy - extent : ctx->clip.y0;
+    int y1 = cy + extent < ctx->clip.y1 - 1 ? cy + extent : ctx->clip.y1 - 1;
+    for (int y = y0; y <= y1; ++y)
+    {
+        int64_t dy2 = (int64_t)(y - cy) * (y - cy);
+        if (dy2 > ring.visible_max)
+            continue;
+
+        int hi = (int)isqrt_floor(ring.visible_max - dy2);
+        int lo = (int)isqrt_ceil(ring.visible_min - dy2);
+        int f1 = ring.full_max - dy2 >= 0 ? (int)isqrt_floor(ring.full_max - dy2) : -1;
+        int f0 = (int)isqrt_ceil(ring.full_min - dy2);
+
+        aa_ring_side(ctx, &ring, cx, y, dy2, -1, lo > 1 ? lo : 1, hi, f0, f1, color);
+        aa_ring_side(ctx, &ring, cx, y, dy2, 1, lo, hi, f0, f1, color);
+    }
+}
+
+void
+stroke_circle(DisplayContext* ctx, const Stroke* s, int cx, int cy, int radius)
+{
+    if (s->aa)
+    {
+        circle_aa(ctx, cx, cy, radius, s->thickness, s->reach, s->color);
+        return;
+    }
+    uint8_t r, g, b;
+    unpack_rgb(s->color, &r, &g, &b);
+    draw_circle(ctx, cx, cy, radius, s->thickness, s->dashed_circle, r, g, b);
+}
+
+void
+fill_circle(DisplayContext* ctx, int cx, int cy, int radius, uint32_t color)
 {
-    put_pixel_thick(ctx, cx + x, cy + y, thickness, r, g, b);
-    put_pixel_thick(ctx, cx - x, cy + y, thickness, r, g, b);
-    put_pixel_thick(ctx, cx + x, cy - y, thickness, r, g, b);
-    put_pixel_thick(ctx, cx - x, cy - y, thickness, r, g, b);
-    put_pixel_thick(ctx, cx + y, cy + x, thickness, r, g, b);
-    put_pixel_thick(ctx, cx - y, cy + x, thickness, r, g, b);
-    put_pixel_thick(ctx, cx + y, cy - x, thickness, r, g, b);
-    put_pixel_thick(ctx, cx - y, cy - x, thickness, r, g, b);
+    if (radius < 0)
+        radius = -radius;
+
+    bool inside;
+    if (damage_circle(ctx, cx, cy, radius, &inside))
+        fill_annulus(ctx, cx, cy, 0, radius, NULL, color);
 }
 
 void
@@ -218,25 +1123,35 @@ draw_circle(DisplayContext* ctx,
 {
     if (radius < 0)
         radius = -radius;
+
+    int half = thickness > 1 ? thickness / 2 : 0;
+    bool inside;
+    if (!damage_circle(ctx, cx, cy, radius + half, &inside))
+        return;
+    uint32_t color = pack_rgb(r, g, b);
+
     if (radius == 0)
     {
-        put_pixel_thick(ctx, cx, cy, thickness, r, g, b);
+        plot_thick(ctx, cx, cy, thickness, color);
+        return;
+    }
+
+    ArcDash dash = arc_dash_make(radius);
+    const ArcDash* pattern = dashed ? &dash : NULL;
+
+    // Thick pens are the annulus radius +- half, written as row spans.
+    if (half > 0)
+    {
+        fill_annulus(ctx, cx, cy, radius - half, radius + half, pattern, color);
         return;
     }
 
     int x = 0;
     int y = radius;
     int d = 1 - radius;
-
-    int step = 0;
-    const int on_len = 6;
-    const int off_len = 4;
-    const int period = on_len + off_len;
-
     while (x <= y)
     {
-        if (!dashed || ((step % period) < on_len))
-            circle_plot8(ctx, cx, cy, x, y, thickness, r, g, b);
+        circle_plot8(ctx, cx, cy, x, y, inside, pattern, color);
 
         if (d < 0)
         {
@@ -249,6 +1164,5 @@ draw_circle(DisplayContext* ctx,
         }
 
         x += 1;
-        step += 1;
     }
 }
@@ -2,6 +2,20 @@
 
 #include "types.h"
 
+// Resolves a pen once; stroking with it then skips all per-call style branching. line_style
+// is one of LINE_STYLE_* (dotted is always one pixel wide, anti-aliased blends its edges into
+// the pixels below). stroke_make_pattern takes explicit dash and gap lengths, where
+// off_len <= 0 means solid.
+Stroke stroke_make(uint32_t color, int thickness, int line_style);
+Stroke stroke_make_pattern(uint32_t color, int thickness, int on_len, int off_len);
+
+// How far beyond the skeleton of a line or circle (its end points, its radius) a pen writes.
+int stroke_reach(int thickness, int line_style);
+
+void stroke_line(DisplayContext* ctx, const Stroke* s, int x0, int y0, int x1, int y1);
+void stroke_circle(DisplayContext* ctx, const Stroke* s, int cx, int cy, int radius);
+void stroke_point(DisplayContext* ctx, const Stroke* s, int x, int y);
+
 void draw_line(DisplayContext* ctx, int x0, int y0, int x1, int y1, uint8_t r, uint8_t g, uint8_t b);
 void draw_dotted_line(DisplayContext* ctx,
     int x0,
@@ -34,6 +48,8 @@ void draw_dashed_line_thick(DisplayContext* ctx,
     uint8_t g,
     uint8_t b);
 
+// Thick circles are the annulus radius +- thickness / 2 written as row spans; dashes follow
+// arc length and line up across octants.
 void draw_circle(DisplayContext* ctx,
     int cx,
     int cy,
@@ -44,4 +60,7 @@ void draw_circle(DisplayContext* ctx,
     uint8_t g,
     uint8_t b);
 
+// Solid disc of pixel centres within radius + 0.5, written as one span per row.
+void fill_circle(DisplayContext* ctx, int cx, int cy, int radius, uint32_t color);
+
 void snap_to_axis(int x0, int y0, int* x1, int* y1);
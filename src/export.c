@@ -0,0 +1,436 @@
+#include "export.h"
+
+#include "damage.h"
+#include "parallel.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+// Raw bytes a strip aims for. Strips are the unit of copy-on-write and each is one deflate
+// stream, small enough that a batch only holds the parallel pool for a few milliseconds.
+#define EXPORT_STRIP_BYTES (128 * 1024)
+
+typedef enum
+{
+    STRIP_LIVE,    // still in the framebuffer as it was at the start
+    STRIP_READING, // being converted from the framebuffer; writers wait for it
+    STRIP_COPIED,  // saved aside before a write, converted from the copy
+    STRIP_DONE,    // converted (or lost, see Export.spoiled)
+} StripState;
+
+// One strip of a batch in flight: its raw rows and, for PNG, their deflated form.
+typedef struct
+{
+    uint8_t* raw;
+    size_t raw_size;
+    uint8_t* out;
+    size_t out_cap, out_size;
+    uLong adler;
+    z_stream z;
+    bool z_ready;
+    bool ok;
+} Slot;
+
+typedef struct
+{
+    bool active; // started and not yet waited for
+    DisplayContext* ctx;
+    bool hooked;
+    const uint32_t* pixels; // ctx->fb.data at the start
+    size_t stride;
+    Rect area;
+    bool png;
+    FILE* file;
+    char* path;
+
+    int strip_rows, strip_count;
+    int first; // first strip of the batch being encoded
+    Slot* slots;
+    int slot_count;
+
+    pthread_t thread;
+    uint8_t* state;    // StripState per strip, under strip_lock
+    uint32_t** copies; // pixels of the STRIP_COPIED strips
+    bool spoiled;      // a strip could not be saved before it was written over
+    atomic_bool finished;
+    bool ok;
+} Export;
+
+static Export job;
+static pthread_mutex_t strip_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t strip_changed = PTHREAD_COND_INITIALIZER;
+
+static int
+strip_y0(int s)
+{
+    return job.area.y0 + s * job.strip_rows;
+}
+
+static int
+strip_height(int s)
+{
+    int y0 = strip_y0(s);
+    return y0 + job.strip_rows < job.area.y1 ? job.strip_rows : job.area.y1 - y0;
+}
+
+// PNG rows start with their filter type byte.
+static size_t
+row_bytes(void)
+{
+    return (size_t)(job.area.x1 - job.area.x0) * 3 + (job.png ? 1 : 0);
+}
+
+// Saves strip s as it is now; called with the lock held (or before the thread starts).
+static bool
+copy_strip(int s)
+{
+    size_t w = (size_t)(job.area.x1 - job.area.x0);
+    int rows = strip_height(s);
+    uint32_t* copy = malloc(w * (size_t)rows * sizeof(uint32_t));
+    if (!copy)
+        return false;
+
+    const uint32_t* src = &job.pixels[(size_t)strip_y0(s) * job.stride + (size_t)job.area.x0];
+    for (int r = 0; r < rows; ++r)
+        memcpy(&copy[(size_t)r * w], &src[(size_t)r * job.stride], w * sizeof(uint32_t));
+    job.copies[s] = copy;
+    job.state[s] = STRIP_COPIED;
+    return true;
+}
+
+static void
+copy_on_write(void* user, DisplayContext* ctx, Rect area)
+{
+    (void)user;
+    (void)ctx;
+    if (atomic_load(&job.finished))
+        return;
+
+    int y0 = area.y0 > job.area.y0 ? area.y0 : job.area.y0;
+    int y1 = area.y1 < job.area.y1 ? area.y1 : job.area.y1;
+    if (y1 <= y0 || area.x1 <= job.area.x0 || area.x0 >= job.area.x1)
+        return;
+
+    pthread_mutex_lock(&strip_lock);
+    for (int s = (y0 - job.area.y0) / job.strip_rows; s <= (y1 - 1 - job.area.y0) / job.strip_rows;
+        ++s)
+    {
+        while (job.state[s] == STRIP_READING)
+            pthread_cond_wait(&strip_changed, &strip_lock);
+        if (job.state[s] == STRIP_LIVE && !copy_strip(s))
+        {
+            job.spoiled = true;
+            job.state[s] = STRIP_DONE;
+        }
+    }
+    pthread_mutex_unlock(&strip_lock);
+}
+
+// Sub filter for PNG: each byte minus the same channel of the pixel to its left.
+static void
+convert_rows(uint8_t* dst, const uint32_t* src, size_t stride, int w, int rows)
+{
+    for (int r = 0; r < rows; ++r)
+    {
+        const uint32_t* p = &src[(size_t)r * stride];
+        if (!job.png)
+        {
+            for (int x = 0; x < w; ++x, dst += 3)
+                unpack_rgb(p[x], &dst[0], &dst[1], &dst[2]);
+            continue;
+        }
+
+        *dst++ = 1;
+        uint8_t left[3] = {0, 0, 0};
+        for (int x = 0; x < w; ++x, dst += 3)
+        {
+            uint8_t c[3];
+            unpack_rgb(p[x], &c[0], &c[1], &c[2]);
+            for (int k = 0; k < 3; ++k)
+            {
+                dst[k] = (uint8_t)(c[k] - left[k]);
+                left[k] = c[k];
+            }
+        }
+    }
+}
+
+// Runs on the pool: converts strip first + i into slot i and deflates it. Every strip but the
+// last ends in a sync flush, so the streams concatenate into one.
+static void
+encode_strip(void* arg, int i)
+{
+    (void)arg;
+    Slot* slot = &job.slots[i];
+    int s = job.first + i;
+    int w = job.area.x1 - job.area.x0;
+    int rows = strip_height(s);
+
+    pthread_mutex_lock(&strip_lock);
+    StripState state = job.state[s];
+    if (state == STRIP_LIVE)
+        job.state[s] = STRIP_READING;
+    pthread_mutex_unlock(&strip_lock);
+
+    slot->raw_size = (size_t)rows * row_bytes();
+    slot->ok = state != STRIP_DONE;
+    if (state == STRIP_LIVE)
+    {
+        const uint32_t* src = &job.pixels[(size_t)strip_y0(s) * job.stride + (size_t)job.area.x0];
+        convert_rows(slot->raw, src, job.stride, w, rows);
+    }
+    else if (state == STRIP_COPIED)
+    {
+        convert_rows(slot->raw, job.copies[s], (size_t)w, w, rows);
+    }
+
+    pthread_mutex_lock(&strip_lock);
+    job.state[s] = STRIP_DONE;
+    pthread_cond_broadcast(&strip_changed);
+    pthread_mutex_unlock(&strip_lock);
+    // Writers leave STRIP_DONE strips alone, so the copy is this thread's to free.
+    free(job.copies[s]);
+    job.copies[s] = NULL;
+
+    if (!slot->ok || !job.png)
+        return;
+
+    z_stream* z = &slot->z;
+    bool last = s == job.strip_count - 1;
+    deflateReset(z);
+    z->next_in = slot->raw;
+    z->avail_in = (uInt)slot->raw_size;
+    z->next_out = slot->out;
+    z->avail_out = (uInt)slot->out_cap;
+    int ret = deflate(z, last ? Z_FINISH : Z_SYNC_FLUSH);
+    slot->ok = (last ? ret == Z_STREAM_END : ret == Z_OK && z->avail_out > 0) && z->avail_in == 0;
+    slot->out_size = slot->out_cap - z->avail_out;
+    slot->adler = adler32(adler32(0L, Z_NULL, 0), slot->raw, (uInt)slot->raw_size);
+}
+
+static bool
+create_slots(void)
+{
+    job.slot_count = parallel_threads();
+    job.slots = calloc((size_t)job.slot_count, sizeof(Slot));
+    if (!job.slots)
+        return false;
+
+    size_t raw_cap = (size_t)job.strip_rows * row_bytes();
+    for (int i = 0; i < job.slot_count; ++i)
+    {
+        Slot* slot = &job.slots[i];
+        slot->raw = malloc(raw_cap);
+        if (!slot->raw)
+            return false;
+        if (!job.png)
+            continue;
+
+        // After the Sub filter a drawing is mostly runs of zeros, which run-length matching
+        // alone compresses as well as the full search in a fraction of the time.
+        if (deflateInit2(&slot->z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_RLE) != Z_OK)
+            return false;
+        slot->z_ready = true;
+        // Room for the sync flush marker on top of a complete stream.
+        slot->out_cap = deflateBound(&slot->z, (uLong)raw_cap) + 16;
+        slot->out = malloc(slot->out_cap);
+        if (!slot->out)
+            return false;
+    }
+    return true;
+}
+
+static void
+free_slots(void)
+{
+    for (int i = 0; job.slots && i < job.slot_count; ++i)
+    {
+        if (job.slots[i].z_ready)
+            deflateEnd(&job.slots[i].z);
+        free(job.slots[i].raw);
+        free(job.slots[i].out);
+    }
+    free(job.slots);
+    job.slots = NULL;
+}
+
+static void
+put_be32(uint8_t* p, uint32_t v)
+{
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+static bool
+write_chunk(FILE* f, const char* type, const uint8_t* data, size_t size)
+{
+    uint8_t head[8];
+    put_be32(head, (uint32_t)size);
+    memcpy(&head[4], type, 4);
+    uLong crc = crc32(crc32(0L, Z_NULL, 0), (const Bytef*)type, 4);
+    if (size > 0)
+        crc = crc32(crc, data, (uInt)size);
+    uint8_t tail[4];
+    put_be32(tail, (uint32_t)crc);
+    return fwrite(head, 1, 8, f) == 8 && (size == 0 || fwrite(data, 1, size, f) == size) &&
+           fwrite(tail, 1, 4, f) == 4;
+}
+
+static bool
+write_header(void)
+{
+    int w = job.area.x1 - job.area.x0;
+    int h = job.area.y1 - job.area.y0;
+    if (!job.png)
+        return fprintf(job.file, "P6\n%d %d\n255\n", w, h) > 0;
+
+    static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    uint8_t ihdr[13] = {0};
+    put_be32(&ihdr[0], (uint32_t)w);
+    put_be32(&ihdr[4], (uint32_t)h);
+    ihdr[8] = 8; // bits per channel
+    ihdr[9] = 2; // RGB
+    // The zlib header (deflate, 32 KiB window) goes in a chunk of its own, the strips follow.
+    static const uint8_t zlib_header[2] = {0x78, 0x9c};
+    return fwrite(signature, 1, 8, job.file) == 8 && write_chunk(job.file, "IHDR", ihdr, 13) &&
+           write_chunk(job.file, "IDAT", zlib_header, 2);
+}
+
+static void*
+export_main(void* unused)
+{
+    (void)unused;
+    bool ok = create_slots() && write_header();
+    uLong adler = adler32(0L, Z_NULL, 0);
+    for (int first = 0; ok && first < job.strip_count; first += job.slot_count)
+    {
+        int n = job.strip_count - first < job.slot_count ? job.strip_count - first
+                                                          : job.slot_count;
+        job.first = first;
+        parallel_for(n, encode_strip, NULL);
+
+        for (int i = 0; ok && i < n; ++i)
+        {
+            const Slot* slot = &job.slots[i];
+            if (!slot->ok)
+                ok = false;
+            else if (job.png)
+                ok = write_chunk(job.file, "IDAT", slot->out, slot->out_size);
+            else
+                ok = fwrite(slot->raw, 1, slot->raw_size, job.file) == slot->raw_size;
+            adler = adler32_combine(adler, slot->adler, (z_off_t)slot->raw_size);
+        }
+    }
+
+    if (ok && job.png)
+    {
+        uint8_t tail[4];
+        put_be32(tail, (uint32_t)adler);
+        ok = write_chunk(job.file, "IDAT", tail, 4) && write_chunk(job.file, "IEND", NULL, 0);
+    }
+    if (fclose(job.file) != 0)
+        ok = false;
+    job.file = NULL;
+    free_slots();
+
+    if (!ok)
+        fprintf(stderr, "%s: cannot write image\n", job.path);
+    job.ok = ok;
+    atomic_store(&job.finished, true);
+    return NULL;
+}
+
+// Frees everything the job holds; the thread has finished or never ran.
+static void
+release_job(void)
+{
+    if (job.hooked)
+        damage_remove_hook(job.ctx, copy_on_write, NULL);
+    for (int s = 0; job.copies && s < job.strip_count; ++s)
+        free(job.copies[s]);
+    free(job.copies);
+    free(job.state);
+    free(job.path);
+    if (job.file)
+        fclose(job.file);
+    job = (Export){0};
+}
+
+bool
+export_start(DisplayContext* ctx, Rect area, const char* path)
+{
+    if (export_busy())
+        return false;
+    export_wait();
+
+    if (area.x0 < ctx->clip.x0)
+        area.x0 = ctx->clip.x0;
+    if (area.y0 < ctx->clip.y0)
+        area.y0 = ctx->clip.y0;
+    if (area.x1 > ctx->clip.x1)
+        area.x1 = ctx->clip.x1;
+    if (area.y1 > ctx->clip.y1)
+        area.y1 = ctx->clip.y1;
+    if (area.x1 <= area.x0 || area.y1 <= area.y0)
+        return false;
+
+    size_t len = strlen(path);
+    job.png = len >= 4 && strcmp(&path[len - 4], ".png") == 0;
+    job.ctx = ctx;
+    job.pixels = ctx->fb.data;
+    job.stride = (size_t)ctx->w;
+    job.area = area;
+    int rows = (int)(EXPORT_STRIP_BYTES / row_bytes());
+    job.strip_rows = rows > 0 ? rows : 1;
+    job.strip_count = (area.y1 - area.y0 + job.strip_rows - 1) / job.strip_rows;
+    atomic_store(&job.finished, false);
+
+    job.file = fopen(path, "wb");
+    job.path = strdup(path);
+    job.state = calloc((size_t)job.strip_count, 1);
+    job.copies = calloc((size_t)job.strip_count, sizeof(uint32_t*));
+    bool ok = job.file && job.path && job.state && job.copies;
+
+    // Nothing else runs yet, so no lock is needed for the up-front copy.
+    if (ctx->dpy)
+    {
+        for (int s = 0; ok && s < job.strip_count; ++s)
+            ok = copy_strip(s);
+    }
+    else if (ok)
+    {
+        ok = job.hooked = damage_add_hook(ctx, copy_on_write, NULL);
+    }
+
+    if (!ok || pthread_create(&job.thread, NULL, export_main, NULL) != 0)
+    {
+        release_job();
+        return false;
+    }
+    job.active = true;
+    return true;
+}
+
+bool
+export_busy(void)
+{
+    return job.active && !atomic_load(&job.finished);
+}
+
+bool
+export_wait(void)
+{
+    if (!job.active)
+        return true;
+
+    pthread_join(job.thread, NULL);
+    bool ok = job.ok && !job.spoiled;
+    release_job();
+    return ok;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "types.h"
+
+// Background export of the pixels inside area (clipped to ctx->clip), as PNG when path ends
+// in ".png" and as binary PPM (P6) otherwise. The file gets the pixels as they are at the
+// call: strips of rows are encoded in place and later writes into ctx copy a strip aside the
+// first time they touch it, so nothing is copied up front. A window's buffers move on present
+// and resize, so for a window target it is copied into strips immediately instead. A writer
+// thread encodes the strips in batches on the parallel pool, deflating each on its own for
+// PNG; failures are reported on stderr when they happen.
+//
+// One export runs at a time: returns false if the previous one is still writing or this one
+// cannot start. ctx must stay alive and in place until export_wait returns.
+bool export_start(DisplayContext* ctx, Rect area, const char* path);
+bool export_busy(void);
+// Waits for the export to finish and detaches it from its context. Returns whether the file
+// was written (true when there was nothing to wait for).
+bool export_wait(void);
@@ -0,0 +1,273 @@
+#include "floodfill.h"
+
+#include "arena.h"
+#include "damage.h"
+#include "framebuffer.h"
+
+#include <string.h>
+
+// Row y still has to be scanned over [x0, x1]; row y - dy is filled there, so runs found are
+// followed on in direction dy and only their overhang is followed back.
+typedef struct
+{
+    int y, x0, x1, dy;
+} Segment;
+
+typedef struct
+{
+    DisplayContext* ctx;
+    Rect area;
+    uint32_t target;
+    uint32_t color;
+    int tolerance;
+    uint8_t in_range[3][256]; // per channel: values within tolerance of the target
+    uint8_t* visited; // one bit per area pixel; NULL when painted pixels no longer match
+    Arena* scratch;
+    bool out_of_memory;
+
+    Segment* stack;
+    int depth, stack_cap;
+    int* spans;
+    int span_count, span_cap;
+} Fill;
+
+// Inside runs the pixel mostly equals the target, so that is tested first.
+static inline bool
+matches(const Fill* f, uint32_t pixel)
+{
+    if (((pixel ^ f->target) & 0xffffff) == 0)
+        return true;
+    if (f->tolerance == 0)
+        return false;
+    return f->in_range[0][pixel & 0xff] & f->in_range[1][(pixel >> 8) & 0xff] &
+           f->in_range[2][(pixel >> 16) & 0xff];
+}
+
+static inline size_t
+visited_bit(const Fill* f, int x, int y)
+{
+    return (size_t)(y - f->area.y0) * (size_t)(f->area.x1 - f->area.x0) + (size_t)(x - f->area.x0);
+}
+
+static inline bool
+inside(const Fill* f, const uint32_t* row, int x, int y)
+{
+    if (!matches(f, row[x]))
+        return false;
+    if (!f->visited)
+        return true;
+    size_t bit = visited_bit(f, x, y);
+    return !(f->visited[bit >> 3] & (1u << (bit & 7)));
+}
+
+// Sets bits [bit, end), whole bytes at a time where it can.
+static void
+mark_visited(uint8_t* visited, size_t bit, size_t end)
+{
+    for (; bit < end && (bit & 7); ++bit)
+        visited[bit >> 3] |= (uint8_t)(1u << (bit & 7));
+    if (end - bit >= 8)
+    {
+        memset(&visited[bit >> 3], 0xff, (end - bit) >> 3);
+        bit += (end - bit) & ~(size_t)7;
+    }
+    for (; bit < end; ++bit)
+        visited[bit >> 3] |= (uint8_t)(1u << (bit & 7));
+}
+
+// Offset from `bit` of the first set bit in [bit, end), or end - bit if there is none.
+static size_t
+first_visited(const uint8_t* visited, size_t bit, size_t end)
+{
+    size_t i = bit;
+    while (i < end)
+    {
+        uint8_t byte = (uint8_t)(visited[i >> 3] >> (i & 7));
+        if (byte)
+        {
+            i += (size_t)__builtin_ctz(byte);
+            return (i < end ? i : end) - bit;
+        }
+        i = (i | 7) + 1;
+    }
+    return end - bit;
+}
+
+// Doubles an array of `cap` elements in the scratch arena once it holds `count`.
+static bool
+reserve(Fill* f, void** p, int* cap, int count, size_t elem)
+{
+    if (count < *cap)
+        return true;
+
+    int new_cap = *cap ? *cap * 2 : 256;
+    void* q = arena_resize(f->scratch, *p, (size_t)*cap * elem, (size_t)new_cap * elem);
+    if (!q)
+    {
+        f->out_of_memory = true;
+        return false;
+    }
+    *p = q;
+    *cap = new_cap;
+    return true;
+}
+
+static void
+push(Fill* f, int y, int x0, int x1, int dy)
+{
+    if (y < f->area.y0 || y >= f->area.y1)
+        return;
+    if (!reserve(f, (void**)&f->stack, &f->stack_cap, f->depth, sizeof(Segment)))
+        return;
+    f->stack[f->depth++] = (Segment){y, x0, x1, dy};
+}
+
+// Paints the half-open run [x0, x1) of row y and records it.
+static bool
+emit(Fill* f, int y, int x0, int x1)
+{
+    if (!reserve(f, (void**)&f->spans, &f->span_cap, f->span_count * 4 + 3, sizeof(int)))
+        return false;
+
+    int* s = &f->spans[f->span_count * 4];
+    s[0] = x0;
+    s[1] = y;
+    s[2] = x1 - 1;
+    s[3] = y;
+    f->span_count++;
+
+    damage_rect(f->ctx, x0, y, x1, y + 1);
+    fill_span(f->ctx, y, x0, x1, f->color);
+    if (f->visited)
+        mark_visited(f->visited, visited_bit(f, x0, y), visited_bit(f, x1 - 1, y) + 1);
+    return true;
+}
+
+// First pixel at or right of x that is outside the region. Runs are most of the work, so
+// colours are compared on their own (four pixels a step for an exact fill) and visited
+// pixels are cut off afterwards, a byte of the bitmap at a time.
+static inline int
+run_end(const Fill* f, const uint32_t* row, int x, int y)
+{
+    int start = x;
+    int end = f->area.x1;
+    if (f->tolerance == 0)
+    {
+        uint32_t t = f->target;
+        while (x + 4 <= end &&
+               (((row[x] ^ t) | (row[x + 1] ^ t) | (row[x + 2] ^ t) | (row[x + 3] ^ t)) &
+                   0xffffff) == 0)
+            x += 4;
+    }
+    while (x < end && matches(f, row[x]))
+        x++;
+
+    if (f->visited && x > start)
+    {
+        size_t bit = visited_bit(f, start, y);
+        x = start + (int)first_visited(f->visited, bit, bit + (size_t)(x - start));
+    }
+    return x;
+}
+
+static void
+scan(Fill* f, Segment s)
+{
+    const uint32_t* row = &f->ctx->fb.data[(size_t)s.y * (size_t)f->ctx->w];
+    int x = s.x0;
+    int left;
+    if (inside(f, row, x, s.y))
+    {
+        left = x;
+        while (left > f->area.x0 && inside(f, row, left - 1, s.y))
+            left--;
+        if (left < s.x0)
+            push(f, s.y - s.dy, left, s.x0 - 1, -s.dy);
+    }
+    else
+    {
+        while (x <= s.x1 && !inside(f, row, x, s.y))
+            x++;
+        if (x > s.x1)
+            return;
+        left = x;
+    }
+
+    for (;;)
+    {
+        int end = run_end(f, row, x + 1, s.y);
+        if (!emit(f, s.y, left, end))
+            return;
+        push(f, s.y + s.dy, left, end - 1, s.dy);
+        if (end - 1 > s.x1)
+            push(f, s.y - s.dy, s.x1 + 1, end - 1, -s.dy);
+
+        x = end + 1;
+        while (x <= s.x1 && !inside(f, row, x, s.y))
+            x++;
+        if (x > s.x1)
+            return;
+        left = x;
+    }
+}
+
+int
+flood_fill(DisplayContext* ctx,
+    Rect area,
+    int x,
+    int y,
+    uint32_t color,
+    int tolerance,
+    Arena* scratch,
+    int** spans)
+{
+    *spans = NULL;
+    if (area.x0 < ctx->clip.x0)
+        area.x0 = ctx->clip.x0;
+    if (area.y0 < ctx->clip.y0)
+        area.y0 = ctx->clip.y0;
+    if (area.x1 > ctx->clip.x1)
+        area.x1 = ctx->clip.x1;
+    if (area.y1 > ctx->clip.y1)
+        area.y1 = ctx->clip.y1;
+    if (ctx->overlay.active || x < area.x0 || x >= area.x1 || y < area.y0 || y >= area.y1)
+        return 0;
+
+    Fill f = {
+        .ctx = ctx,
+        .area = area,
+        .target = ctx->fb.data[(size_t)y * (size_t)ctx->w + x] & 0xffffff,
+        .color = color,
+        .tolerance = tolerance > 0 ? tolerance : 0,
+        .scratch = scratch,
+    };
+    for (int c = 0; c < 3; ++c)
+    {
+        int v = (int)((f.target >> (8 * c)) & 0xff);
+        int low = v > f.tolerance ? v - f.tolerance : 0;
+        int high = v + f.tolerance < 255 ? v + f.tolerance : 255;
+        memset(&f.in_range[c][low], 1, (size_t)(high - low + 1));
+    }
+
+    // A colour the region already matches does not mark where the fill has been.
+    if (matches(&f, color))
+    {
+        if (f.tolerance == 0)
+            return 0;
+        size_t bytes = (visited_bit(&f, area.x1 - 1, area.y1 - 1) >> 3) + 1;
+        f.visited = arena_alloc(scratch, bytes);
+        if (!f.visited)
+            return 0;
+        memset(f.visited, 0, bytes);
+    }
+
+    // The seed is a one-pixel segment going down. Its run's overhang is followed back up on
+    // either side of it, which leaves only the seed column of the row above.
+    scan(&f, (Segment){y, x, x, 1});
+    push(&f, y - 1, x, x, -1);
+    while (f.depth > 0 && !f.out_of_memory)
+        scan(&f, f.stack[--f.depth]);
+
+    *spans = f.spans;
+    return f.span_count;
+}
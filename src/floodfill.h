@@ -0,0 +1,22 @@
+#pragma once
+
+#include "types.h"
+
+// Bucket fill: paints `color` over the 4-connected region around (x, y) of pixels whose
+// channels each differ from that pixel's by at most `tolerance` (0 = the exact colour),
+// inside both area and the clip rect. Works a row span at a time from an explicit stack of
+// pending segments allocated in `scratch`, reporting each span's damage before writing it.
+//
+// The filled runs are returned in *spans, allocated in `scratch`, as inclusive x0 y0 x1 y1
+// quadruples of one row each (the layout scene_add_lines takes, so the fill can be recorded
+// as 1-pixel lines); the return value is how many. Should scratch run out the fill stops
+// early, and exactly the runs written so far are returned. Does nothing while the overlay is
+// recording a preview.
+int flood_fill(DisplayContext* ctx,
+    Rect area,
+    int x,
+    int y,
+    uint32_t color,
+    int tolerance,
+    Arena* scratch,
+    int** spans);
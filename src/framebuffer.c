@@ -0,0 +1,126 @@
+#include "framebuffer.h"
+
+#include "damage.h"
+#include "kernels.h"
+#include "overlay.h"
+#include "parallel.h"
+#include "tiles.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Framebuffers at least this large are cleared on the worker pool.
+#define PARALLEL_FILL_MIN_PX (1024 * 1024)
+
+// Neighbouring damage rects are uploaded as one when that costs less than this many extra pixels.
+#define DAMAGE_COALESCE_PX (64 * 64)
+
+PixelOrder pixel_order = PIXEL_XRGB;
+
+bool
+framebuffer_attach(DisplayContext* ctx, int w, int h, uint32_t* data)
+{
+    memset(ctx, 0, sizeof(*ctx));
+    if (!data)
+        data = calloc((size_t)w * (size_t)h, sizeof(uint32_t));
+    if (!data)
+        return false;
+
+    ctx->w = w;
+    ctx->h = h;
+    ctx->fb.data = data;
+    ctx->clip = (Rect){0, 0, w, h};
+    ctx->damage.coalesce_px = DAMAGE_COALESCE_PX;
+    ctx->shm_completion = -1;
+    return true;
+}
+
+DisplayContext
+init_offscreen(int w, int h)
+{
+    DisplayContext ctx;
+    if (framebuffer_attach(&ctx, w, h, NULL))
+        clear_framebuffer(&ctx);
+    return ctx;
+}
+
+void
+cleanup_offscreen(DisplayContext* ctx)
+{
+    parallel_shutdown();
+    free(ctx->fb.data);
+    ctx->fb.data = NULL;
+    overlay_free(ctx);
+}
+
+void
+fill_framebuffer(DisplayContext* ctx, uint8_t r, uint8_t g, uint8_t b)
+{
+    size_t count = (size_t)ctx->w * (size_t)ctx->h;
+    if (count >= PARALLEL_FILL_MIN_PX)
+    {
+        fill_framebuffer_parallel(ctx, pack_rgb(r, g, b));
+        return;
+    }
+
+    damage_all(ctx);
+    span_fill32(ctx->fb.data, pack_rgb(r, g, b), count);
+}
+
+void
+clear_framebuffer(DisplayContext* ctx)
+{
+    fill_framebuffer(ctx, 0, 0, 0);
+}
+
+void
+put_pixel(DisplayContext* ctx, int x, int y, uint8_t r, uint8_t g, uint8_t b)
+{
+    const Rect* c = &ctx->clip;
+    if (x < c->x0 || x >= c->x1 || y < c->y0 || y >= c->y1)
+        return;
+
+    damage_rect(ctx, x, y, x + 1, y + 1);
+    if (ctx->overlay.active)
+        overlay_push(ctx, y, x, x + 1, pack_rgb(r, g, b));
+    else
+        ctx->fb.data[y * ctx->w + x] = pack_rgb(r, g, b);
+}
+
+void
+put_pixel_thick(DisplayContext* ctx, int x, int y, int thickness, uint8_t r, uint8_t g, uint8_t b)
+{
+    if (thickness <= 1)
+    {
+        put_pixel(ctx, x, y, r, g, b);
+        return;
+    }
+
+    int half = thickness / 2;
+    damage_rect(ctx, x - half, y - half, x + half + 1, y + half + 1);
+
+    uint32_t color = pack_rgb(r, g, b);
+    for (int yy = y - half; yy <= y + half; ++yy)
+        fill_span(ctx, yy, x - half, x + half + 1, color);
+}
+
+void
+fill_span(DisplayContext* ctx, int y, int x0, int x1, uint32_t color)
+{
+    if (y < ctx->clip.y0 || y >= ctx->clip.y1)
+        return;
+    if (x0 < ctx->clip.x0)
+        x0 = ctx->clip.x0;
+    if (x1 > ctx->clip.x1)
+        x1 = ctx->clip.x1;
+    if (x1 <= x0)
+        return;
+
+    if (ctx->overlay.active)
+    {
+        overlay_push(ctx, y, x0, x1, color);
+        return;
+    }
+
+    span_fill32(&ctx->fb.data[y * ctx->w + x0], color, (size_t)(x1 - x0));
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "types.h"
+
+// The raster target with no window attached: pixels, clip, damage and overlay. Presentation
+// backends (display.h) build on this; batch rendering uses it on its own.
+
+// Resets every field of ctx and attaches a w x h pixel buffer, allocating it when data is
+// NULL. Returns false if the allocation fails.
+bool framebuffer_attach(DisplayContext* ctx, int w, int h, uint32_t* data);
+
+// In-memory target for headless rendering; fb.data is NULL if allocation failed.
+DisplayContext init_offscreen(int w, int h);
+void cleanup_offscreen(DisplayContext* ctx);
+
+void fill_framebuffer(DisplayContext* ctx, uint8_t r, uint8_t g, uint8_t b);
+void clear_framebuffer(DisplayContext* ctx);
+
+void put_pixel(DisplayContext* ctx, int x, int y, uint8_t r, uint8_t g, uint8_t b);
+void put_pixel_thick(DisplayContext* ctx,
+    int x,
+    int y,
+    int thickness,
+    uint8_t r,
+    uint8_t g,
+    uint8_t b);
+
+// Clipped write of the half-open row span [x0, x1) for rasterizers, honouring the preview
+// overlay. Callers report damage themselves.
+void fill_span(DisplayContext* ctx, int y, int x0, int x1, uint32_t color);
@@ -0,0 +1,498 @@
+#include "history.h"
+
+#include "damage.h"
+#include "framebuffer.h"
+#include "scene.h"
+#include "tiles.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define HISTORY_DEFAULT_MB 64
+#define TILE_PIXELS (TILE_SIZE * TILE_SIZE)
+
+// Runs shorter than this are cheaper to store as literals.
+#define MIN_REPEAT 3
+
+// Each record is a sequence of changed tiles: a varint tile index, then varint tokens
+// (length << 2 | kind) until the tile's pixels are covered. Zero runs leave pixels alone,
+// repeat runs are followed by one XOR word and literal runs by `length` words.
+enum
+{
+    RUN_ZERO = 0,
+    RUN_REPEAT = 1,
+    RUN_LITERAL = 2,
+};
+
+typedef struct
+{
+    uint8_t* data;
+    size_t size, cap;
+    bool failed;
+} ByteBuf;
+
+static void
+buf_reserve(ByteBuf* b, size_t extra)
+{
+    if (b->failed || b->size + extra <= b->cap)
+        return;
+
+    size_t cap = b->cap ? b->cap : 256;
+    while (cap < b->size + extra)
+        cap *= 2;
+    uint8_t* p = realloc(b->data, cap);
+    if (!p)
+    {
+        b->failed = true;
+        return;
+    }
+    b->data = p;
+    b->cap = cap;
+}
+
+static void
+put_varint(ByteBuf* b, uint32_t v)
+{
+    buf_reserve(b, 5);
+    if (b->failed)
+        return;
+    while (v >= 0x80)
+    {
+        b->data[b->size++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    b->data[b->size++] = (uint8_t)v;
+}
+
+static void
+put_words(ByteBuf* b, const uint32_t* w, int n)
+{
+    size_t bytes = (size_t)n * sizeof(uint32_t);
+    buf_reserve(b, bytes);
+    if (b->failed)
+        return;
+    memcpy(b->data + b->size, w, bytes);
+    b->size += bytes;
+}
+
+static uint32_t
+get_varint(const uint8_t** p)
+{
+    uint32_t v = 0;
+    int shift = 0;
+    uint8_t byte;
+    do
+    {
+        byte = *(*p)++;
+        v |= (uint32_t)(byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return v;
+}
+
+static uint32_t
+get_word(const uint8_t** p)
+{
+    uint32_t w;
+    memcpy(&w, *p, sizeof(w));
+    *p += sizeof(w);
+    return w;
+}
+
+static void
+put_run(ByteBuf* b, int kind, int len)
+{
+    put_varint(b, ((uint32_t)len << 2) | (uint32_t)kind);
+}
+
+static void
+encode_tile(ByteBuf* b, const uint32_t* delta, int n)
+{
+    int i = 0;
+    while (i < n)
+    {
+        int j = i + 1;
+        if (delta[i] == 0)
+        {
+            while (j < n && delta[j] == 0)
+                j++;
+            put_run(b, RUN_ZERO, j - i);
+            i = j;
+            continue;
+        }
+
+        while (j < n && delta[j] == delta[i])
+            j++;
+        if (j - i >= MIN_REPEAT)
+        {
+            put_run(b, RUN_REPEAT, j - i);
+            put_words(b, &delta[i], 1);
+            i = j;
+            continue;
+        }
+
+        // Literal up to the next zero or the start of a repeat run.
+        j = i;
+        while (j < n && delta[j] != 0 &&
+               !(j + 2 < n && delta[j] == delta[j + 1] && delta[j] == delta[j + 2]))
+            j++;
+        put_run(b, RUN_LITERAL, j - i);
+        put_words(b, &delta[i], j - i);
+        i = j;
+    }
+}
+
+static Rect
+tile_rect(const History* h, Rect area, int t)
+{
+    int x0 = (t % h->tiles_x) * TILE_SIZE;
+    int y0 = (t / h->tiles_x) * TILE_SIZE;
+    Rect r = {x0, y0, x0 + TILE_SIZE, y0 + TILE_SIZE};
+    if (r.x0 < area.x0)
+        r.x0 = area.x0;
+    if (r.y0 < area.y0)
+        r.y0 = area.y0;
+    if (r.x1 > area.x1)
+        r.x1 = area.x1;
+    if (r.y1 > area.y1)
+        r.y1 = area.y1;
+    return r;
+}
+
+static void
+free_entry(History* h, HistoryEntry* e)
+{
+    h->bytes -= e->size;
+    free(e->data);
+    e->data = NULL;
+    e->size = 0;
+}
+
+static HistoryEntry*
+entry_at(History* h, int i)
+{
+    return &h->entries[(h->first + i) % HISTORY_MAX_ENTRIES];
+}
+
+static bool
+grow_snapshots(History* h)
+{
+    int cap = h->snap_cap ? h->snap_cap * 2 : 16;
+    int* tiles = realloc(h->snap_tiles, (size_t)cap * sizeof(int));
+    if (!tiles)
+        return false;
+    h->snap_tiles = tiles;
+
+    uint32_t* pixels = realloc(h->snap_pixels, (size_t)cap * TILE_PIXELS * sizeof(uint32_t));
+    if (!pixels)
+        return false;
+    h->snap_pixels = pixels;
+    h->snap_cap = cap;
+    return true;
+}
+
+static void
+clear_touched(History* h)
+{
+    for (int i = 0; i < h->snap_count; ++i)
+        h->touched[h->snap_tiles[i] >> 3] &= (uint8_t)~(1u << (h->snap_tiles[i] & 7));
+    h->snap_count = 0;
+}
+
+// XOR deltas only chain correctly if no recorded change is missing, so running out of memory
+// mid-action forgets the whole history rather than keeping a record that would corrupt it.
+static void
+abandon_action(History* h)
+{
+    clear_touched(h);
+    h->recording = false;
+    history_reset(h);
+}
+
+// Copies each tile aside the first time the open action is about to write to it.
+static void
+history_hook(void* user, DisplayContext* ctx, Rect r)
+{
+    History* h = user;
+    if (!h->recording)
+        return;
+
+    if (r.x0 < h->area.x0)
+        r.x0 = h->area.x0;
+    if (r.y0 < h->area.y0)
+        r.y0 = h->area.y0;
+    if (r.x1 > h->area.x1)
+        r.x1 = h->area.x1;
+    if (r.y1 > h->area.y1)
+        r.y1 = h->area.y1;
+    if (r.x1 <= r.x0 || r.y1 <= r.y0)
+        return;
+
+    for (int ty = r.y0 / TILE_SIZE; ty <= (r.y1 - 1) / TILE_SIZE; ++ty)
+    {
+        for (int tx = r.x0 / TILE_SIZE; tx <= (r.x1 - 1) / TILE_SIZE; ++tx)
+        {
+            int t = ty * h->tiles_x + tx;
+            if (h->touched[t >> 3] & (1u << (t & 7)))
+                continue;
+            if (h->snap_count == h->snap_cap && !grow_snapshots(h))
+            {
+                abandon_action(h);
+                return;
+            }
+
+            Rect tr = tile_rect(h, h->area, t);
+            int tw = tr.x1 - tr.x0;
+            uint32_t* dst = &h->snap_pixels[(size_t)h->snap_count * TILE_PIXELS];
+            for (int y = tr.y0; y < tr.y1; ++y)
+                memcpy(dst + (size_t)(y - tr.y0) * tw,
+                    &ctx->fb.data[(size_t)y * ctx->w + tr.x0],
+                    (size_t)tw * sizeof(uint32_t));
+
+            h->touched[t >> 3] |= (uint8_t)(1u << (t & 7));
+            h->snap_tiles[h->snap_count++] = t;
+        }
+    }
+}
+
+void
+history_init(History* h, DisplayContext* ctx)
+{
+    memset(h, 0, sizeof(*h));
+
+    const char* mb = getenv("SOFT_RENDERER_UNDO_MB");
+    int budget_mb = mb ? atoi(mb) : HISTORY_DEFAULT_MB;
+    if (budget_mb <= 0)
+        budget_mb = HISTORY_DEFAULT_MB;
+    h->budget = (size_t)budget_mb << 20;
+
+    h->tiles_x = (ctx->w + TILE_SIZE - 1) / TILE_SIZE;
+    h->tiles_y = (ctx->h + TILE_SIZE - 1) / TILE_SIZE;
+    h->touched = calloc(((size_t)h->tiles_x * h->tiles_y + 7) / 8, 1);
+    if (h->touched)
+        damage_add_hook(ctx, history_hook, h);
+}
+
+void
+history_resize(History* h, const DisplayContext* ctx)
+{
+    if (!h->touched)
+        return;
+
+    // Without a tile map for the new grid nothing more can be recorded; history_begin
+    // checks for that.
+    free(h->touched);
+    h->tiles_x = (ctx->w + TILE_SIZE - 1) / TILE_SIZE;
+    h->tiles_y = (ctx->h + TILE_SIZE - 1) / TILE_SIZE;
+    h->touched = calloc(((size_t)h->tiles_x * h->tiles_y + 7) / 8, 1);
+    h->geometry++;
+}
+
+void
+history_free(History* h, DisplayContext* ctx)
+{
+    damage_remove_hook(ctx, history_hook, h);
+    history_reset(h);
+    free(h->touched);
+    free(h->snap_tiles);
+    free(h->snap_pixels);
+    memset(h, 0, sizeof(*h));
+}
+
+void
+history_reset(History* h)
+{
+    for (int i = 0; i < h->count; ++i)
+        free_entry(h, entry_at(h, i));
+    h->first = 0;
+    h->count = 0;
+    h->cursor = 0;
+}
+
+void
+history_begin(History* h, const DisplayContext* ctx, const Scene* scene)
+{
+    if (h->recording)
+        history_end(h, ctx, scene);
+    if (!h->touched)
+        return;
+
+    h->recording = true;
+    h->area = ctx->clip;
+    h->mark = scene_mark(scene);
+    h->snap_count = 0;
+}
+
+void
+history_end(History* h, const DisplayContext* ctx, const Scene* scene)
+{
+    if (!h->recording)
+        return;
+    h->recording = false;
+
+    ByteBuf b = {0};
+    uint32_t delta[TILE_PIXELS];
+    for (int i = 0; i < h->snap_count; ++i)
+    {
+        int t = h->snap_tiles[i];
+        Rect tr = tile_rect(h, h->area, t);
+        int tw = tr.x1 - tr.x0;
+        int n = tw * (tr.y1 - tr.y0);
+        const uint32_t* before = &h->snap_pixels[(size_t)i * TILE_PIXELS];
+
+        uint32_t any = 0;
+        for (int y = tr.y0; y < tr.y1; ++y)
+        {
+            const uint32_t* after = &ctx->fb.data[(size_t)y * ctx->w + tr.x0];
+            uint32_t* d = &delta[(y - tr.y0) * tw];
+            const uint32_t* s = &before[(y - tr.y0) * tw];
+            for (int x = 0; x < tw; ++x)
+            {
+                d[x] = s[x] ^ after[x];
+                any |= d[x];
+            }
+        }
+        if (!any)
+            continue;
+
+        put_varint(&b, (uint32_t)t);
+        encode_tile(&b, delta, n);
+    }
+    clear_touched(h);
+
+    SceneMark after = scene_mark(scene);
+    if (b.failed)
+    {
+        free(b.data);
+        history_reset(h);
+        return;
+    }
+    if (b.size == 0 && memcmp(&after, &h->mark, sizeof(after)) == 0)
+        return;
+
+    // A new action forks history: whatever was undone can no longer be redone.
+    while (h->count > h->cursor)
+        free_entry(h, entry_at(h, --h->count));
+
+    if (h->count == HISTORY_MAX_ENTRIES)
+    {
+        free_entry(h, entry_at(h, 0));
+        h->first = (h->first + 1) % HISTORY_MAX_ENTRIES;
+        h->count--;
+    }
+
+    // Shrink to fit; the ring charges the cap by stored bytes.
+    uint8_t* data = NULL;
+    if (b.size)
+    {
+        data = realloc(b.data, b.size);
+        if (!data)
+            data = b.data;
+    }
+    else
+    {
+        free(b.data);
+    }
+
+    HistoryEntry* e = entry_at(h, h->count++);
+    *e = (HistoryEntry){data, b.size, h->area, h->mark, after, h->geometry};
+    h->bytes += b.size;
+    h->cursor = h->count;
+
+    // Keep the newest action even if it alone exceeds the cap.
+    while (h->bytes > h->budget && h->count > 1)
+    {
+        free_entry(h, entry_at(h, 0));
+        h->first = (h->first + 1) % HISTORY_MAX_ENTRIES;
+        h->count--;
+        h->cursor--;
+    }
+}
+
+static void
+xor_pixels(DisplayContext* ctx, Rect r, int k, int len, const uint8_t** words, uint32_t word)
+{
+    int tw = r.x1 - r.x0;
+    for (int i = k; i < k + len; ++i)
+    {
+        uint32_t* px = &ctx->fb.data[(size_t)(r.y0 + i / tw) * ctx->w + r.x0 + i % tw];
+        *px ^= words ? get_word(words) : word;
+    }
+}
+
+static void
+apply_entry(const History* h, DisplayContext* ctx, const HistoryEntry* e)
+{
+    const uint8_t* p = e->data;
+    const uint8_t* end = e->data + e->size;
+    while (p < end)
+    {
+        Rect r = tile_rect(h, e->area, (int)get_varint(&p));
+        damage_rect(ctx, r.x0, r.y0, r.x1, r.y1);
+
+        int n = (r.x1 - r.x0) * (r.y1 - r.y0);
+        for (int k = 0; k < n;)
+        {
+            uint32_t run = get_varint(&p);
+            int len = (int)(run >> 2);
+            if ((run & 3) == RUN_REPEAT)
+                xor_pixels(ctx, r, k, len, NULL, get_word(&p));
+            else if ((run & 3) == RUN_LITERAL)
+                xor_pixels(ctx, r, k, len, &p, 0);
+            k += len;
+        }
+    }
+}
+
+// Entries from before a resize index another tile grid. The pixels they lead to are the
+// scene at their mark, rasterized from scratch the same way the resize did.
+static void
+replay_scene(DisplayContext* ctx, const Scene* scene)
+{
+    Rect c = ctx->clip;
+    if (c.x1 <= c.x0 || c.y1 <= c.y0)
+        return;
+
+    damage_rect(ctx, c.x0, c.y0, c.x1, c.y1);
+    for (int y = c.y0; y < c.y1; ++y)
+        fill_span(ctx, y, c.x0, c.x1, pack_rgb(0, 0, 0));
+    render_scene_tiled(scene, ctx);
+}
+
+static void
+apply_step(const History* h,
+    DisplayContext* ctx,
+    Scene* scene,
+    const HistoryEntry* e,
+    SceneMark target)
+{
+    scene_restore_mark(scene, target);
+    if (e->geometry == h->geometry)
+        apply_entry(h, ctx, e);
+    else
+        replay_scene(ctx, scene);
+}
+
+bool
+history_undo(History* h, DisplayContext* ctx, Scene* scene)
+{
+    history_end(h, ctx, scene);
+    if (h->cursor == 0)
+        return false;
+
+    HistoryEntry* e = entry_at(h, --h->cursor);
+    apply_step(h, ctx, scene, e, e->before);
+    return true;
+}
+
+bool
+history_redo(History* h, DisplayContext* ctx, Scene* scene)
+{
+    history_end(h, ctx, scene);
+    if (h->cursor == h->count)
+        return false;
+
+    HistoryEntry* e = entry_at(h, h->cursor++);
+    apply_step(h, ctx, scene, e, e->after);
+    return true;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "types.h"
+
+// Registers a write hook on ctx; the cap comes from SOFT_RENDERER_UNDO_MB (default 64).
+void history_init(History* h, DisplayContext* ctx);
+void history_free(History* h, DisplayContext* ctx);
+
+// Brackets one undoable action. Only writes inside the clip rect at begin are recorded.
+// Beginning while an action is open closes that action first.
+void history_begin(History* h, const DisplayContext* ctx, const Scene* scene);
+void history_end(History* h, const DisplayContext* ctx, const Scene* scene);
+
+// Both return false when there is nothing to undo/redo. An open action is closed first.
+bool history_undo(History* h, DisplayContext* ctx, Scene* scene);
+bool history_redo(History* h, DisplayContext* ctx, Scene* scene);
+
+// Follows a framebuffer resize; call with no action open. Actions recorded before it are
+// undone and redone by re-rasterizing the scene instead of applying their tile deltas.
+void history_resize(History* h, const DisplayContext* ctx);
+
+// Drops every recorded action.
+void history_reset(History* h);
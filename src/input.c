@@ -0,0 +1,293 @@
+#include "input.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define INPUT_MASK (KeyPressMask | ButtonPressMask | ButtonReleaseMask | PointerMotionMask)
+
+// Power of two. A full ring drops motion (a later one supersedes it) and makes clicks and
+// keys wait for room.
+#define INPUT_RING_SIZE 1024
+
+typedef struct
+{
+    uint8_t type;   // KeyPress, ButtonPress, ButtonRelease or MotionNotify
+    uint8_t detail; // keycode or button
+    uint16_t state; // modifier and button mask
+    int16_t x, y;
+} InputRecord;
+
+typedef struct
+{
+    InputRecord ring[INPUT_RING_SIZE];
+    _Alignas(64) atomic_uint head; // next slot to write, producer only
+    _Alignas(64) atomic_uint tail; // next slot to read, consumer only
+    atomic_bool signalled;         // a wakeup byte is pending in `wake`
+    atomic_bool stopping;
+
+    bool running;
+    Display* dpy;
+    pthread_t thread;
+    int wake[2]; // producer -> render thread
+    int stop[2]; // render thread -> producer
+} InputThread;
+
+static InputThread input = {.wake = {-1, -1}, .stop = {-1, -1}};
+
+static bool
+ring_push(const InputRecord* r)
+{
+    unsigned head = atomic_load_explicit(&input.head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&input.tail, memory_order_acquire);
+    if (head - tail == INPUT_RING_SIZE)
+        return false;
+
+    input.ring[head & (INPUT_RING_SIZE - 1)] = *r;
+    atomic_store_explicit(&input.head, head + 1, memory_order_release);
+    return true;
+}
+
+static bool
+ring_pop(InputRecord* r)
+{
+    unsigned tail = atomic_load_explicit(&input.tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&input.head, memory_order_acquire);
+    if (tail == head)
+        return false;
+
+    *r = input.ring[tail & (INPUT_RING_SIZE - 1)];
+    atomic_store_explicit(&input.tail, tail + 1, memory_order_release);
+    return true;
+}
+
+static int16_t
+clamp16(int v)
+{
+    return (int16_t)(v < INT16_MIN ? INT16_MIN : v > INT16_MAX ? INT16_MAX : v);
+}
+
+static bool
+make_record(const XEvent* e, InputRecord* r)
+{
+    switch (e->type)
+    {
+    case KeyPress:
+        *r = (InputRecord){KeyPress,
+            (uint8_t)e->xkey.keycode,
+            (uint16_t)e->xkey.state,
+            clamp16(e->xkey.x),
+            clamp16(e->xkey.y)};
+        return true;
+    case ButtonPress:
+    case ButtonRelease:
+        *r = (InputRecord){(uint8_t)e->type,
+            (uint8_t)e->xbutton.button,
+            (uint16_t)e->xbutton.state,
+            clamp16(e->xbutton.x),
+            clamp16(e->xbutton.y)};
+        return true;
+    case MotionNotify:
+        *r = (InputRecord){MotionNotify,
+            0,
+            (uint16_t)e->xmotion.state,
+            clamp16(e->xmotion.x),
+            clamp16(e->xmotion.y)};
+        return true;
+    default:
+        return false;
+    }
+}
+
+static void
+publish(const InputRecord* r)
+{
+    while (!ring_push(r))
+    {
+        if (r->type == MotionNotify || atomic_load(&input.stopping))
+            return;
+        poll(NULL, 0, 1);
+    }
+
+    if (!atomic_exchange(&input.signalled, true))
+    {
+        char byte = 0;
+        ssize_t n = write(input.wake[1], &byte, 1);
+        (void)n;
+    }
+}
+
+static void*
+input_main(void* unused)
+{
+    (void)unused;
+    struct pollfd pfd[2] = {
+        {ConnectionNumber(input.dpy), POLLIN, 0},
+        {input.stop[0], POLLIN, 0},
+    };
+
+    while (!atomic_load(&input.stopping))
+    {
+        if (XPending(input.dpy) == 0)
+        {
+            poll(pfd, 2, -1);
+            continue;
+        }
+
+        XEvent e;
+        InputRecord r;
+        XNextEvent(input.dpy, &e);
+        if (make_record(&e, &r))
+            publish(&r);
+    }
+    return NULL;
+}
+
+static bool
+open_pipe(int fds[2])
+{
+    if (pipe(fds) != 0)
+    {
+        fds[0] = fds[1] = -1;
+        return false;
+    }
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+    return true;
+}
+
+static void
+close_pipe(int fds[2])
+{
+    for (int i = 0; i < 2; ++i)
+    {
+        if (fds[i] >= 0)
+            close(fds[i]);
+        fds[i] = -1;
+    }
+}
+
+bool
+input_start(DisplayContext* ctx)
+{
+    if (input.running || getenv("SOFT_RENDERER_NO_INPUT_THREAD"))
+        return false;
+
+    input.dpy = XOpenDisplay(DisplayString(ctx->dpy));
+    if (!input.dpy)
+        return false;
+    if (!open_pipe(input.wake) || !open_pipe(input.stop))
+    {
+        close_pipe(input.wake);
+        XCloseDisplay(input.dpy);
+        return false;
+    }
+
+    // Only one client may select ButtonPress on a window, so the window connection lets go
+    // before the input connection takes over.
+    XWindowAttributes attrs;
+    XGetWindowAttributes(ctx->dpy, ctx->win, &attrs);
+    XSelectInput(ctx->dpy, ctx->win, attrs.your_event_mask & ~INPUT_MASK);
+    XSync(ctx->dpy, False);
+    XSelectInput(input.dpy, ctx->win, INPUT_MASK);
+    XSync(input.dpy, False);
+
+    atomic_store(&input.head, 0);
+    atomic_store(&input.tail, 0);
+    atomic_store(&input.signalled, false);
+    atomic_store(&input.stopping, false);
+    if (pthread_create(&input.thread, NULL, input_main, NULL) != 0)
+    {
+        XSelectInput(input.dpy, ctx->win, NoEventMask);
+        XSync(input.dpy, False);
+        XSelectInput(ctx->dpy, ctx->win, attrs.your_event_mask);
+        XCloseDisplay(input.dpy);
+        close_pipe(input.wake);
+        close_pipe(input.stop);
+        return false;
+    }
+
+    input.running = true;
+    return true;
+}
+
+void
+input_stop(DisplayContext* ctx)
+{
+    (void)ctx;
+    if (!input.running)
+        return;
+
+    atomic_store(&input.stopping, true);
+    char byte = 0;
+    ssize_t n = write(input.stop[1], &byte, 1);
+    (void)n;
+    pthread_join(input.thread, NULL);
+
+    XCloseDisplay(input.dpy);
+    close_pipe(input.wake);
+    close_pipe(input.stop);
+    input.running = false;
+}
+
+int
+input_wakeup_fd(void)
+{
+    return input.running ? input.wake[0] : -1;
+}
+
+static bool
+pop_event(DisplayContext* ctx, XEvent* e)
+{
+    InputRecord r;
+    if (!ring_pop(&r))
+        return false;
+
+    memset(e, 0, sizeof(*e));
+    e->type = r.type;
+    e->xany.display = ctx->dpy;
+    e->xany.window = ctx->win;
+    switch (r.type)
+    {
+    case KeyPress:
+        e->xkey.keycode = r.detail;
+        e->xkey.state = r.state;
+        e->xkey.x = r.x;
+        e->xkey.y = r.y;
+        break;
+    case ButtonPress:
+    case ButtonRelease:
+        e->xbutton.button = r.detail;
+        e->xbutton.state = r.state;
+        e->xbutton.x = r.x;
+        e->xbutton.y = r.y;
+        break;
+    default:
+        e->xmotion.state = r.state;
+        e->xmotion.x = r.x;
+        e->xmotion.y = r.y;
+        break;
+    }
+    return true;
+}
+
+bool
+input_next(DisplayContext* ctx, XEvent* e)
+{
+    if (!input.running)
+        return false;
+    if (pop_event(ctx, e))
+        return true;
+
+    // Re-arm the wakeup before the final check: a push after it either lands in that check
+    // or finds `signalled` clear and writes a new byte.
+    atomic_store(&input.signalled, false);
+    char buf[64];
+    while (read(input.wake[0], buf, sizeof(buf)) > 0)
+        ;
+    return pop_event(ctx, e);
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "types.h"
+
+// Pointer and key input on a thread of its own. It reads them from a second X connection,
+// so the window connection never has to be shared between threads (no XInitThreads), and
+// hands compact records to the render thread through a lock-free single-producer ring. A
+// slow upload then no longer holds up input collection. SOFT_RENDERER_NO_INPUT_THREAD keeps
+// everything on the window connection.
+//
+// Returns false (and leaves input on ctx->dpy) when the thread cannot be started.
+bool input_start(DisplayContext* ctx);
+void input_stop(DisplayContext* ctx);
+
+// Readable whenever records may be waiting; -1 while the thread is not running.
+int input_wakeup_fd(void);
+
+// Pops the oldest record as an event on ctx->dpy. Returns false once the ring is empty, after
+// which polling input_wakeup_fd is guaranteed to see the next push.
+bool input_next(DisplayContext* ctx, XEvent* e);
@@ -0,0 +1,259 @@
+#include "kernels.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KERNELS_X86 1
+#elif defined(__aarch64__) || (defined(__ARM_NEON) && defined(__arm__))
+#include <arm_neon.h>
+#define KERNELS_NEON 1
+#endif
+
+static void
+fill_scalar(uint32_t* dst, uint32_t value, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+        dst[i] = value;
+}
+
+static void
+copy_scalar(uint32_t* dst, const uint32_t* src, size_t count)
+{
+    memmove(dst, src, count * sizeof(uint32_t));
+}
+
+#if KERNELS_X86
+__attribute__((target("sse2"))) static void
+fill_sse2(uint32_t* dst, uint32_t value, size_t count)
+{
+    __m128i v = _mm_set1_epi32((int)value);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        _mm_storeu_si128((__m128i*)(dst + i), v);
+        _mm_storeu_si128((__m128i*)(dst + i + 4), v);
+    }
+    for (; i + 4 <= count; i += 4)
+        _mm_storeu_si128((__m128i*)(dst + i), v);
+    for (; i < count; ++i)
+        dst[i] = value;
+}
+
+__attribute__((target("sse2"))) static void
+copy_sse2(uint32_t* dst, const uint32_t* src, size_t count)
+{
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_loadu_si128((const __m128i*)(src + i)));
+    for (; i < count; ++i)
+        dst[i] = src[i];
+}
+
+__attribute__((target("avx2"))) static void
+fill_avx2(uint32_t* dst, uint32_t value, size_t count)
+{
+    __m256i v = _mm256_set1_epi32((int)value);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        _mm256_storeu_si256((__m256i*)(dst + i), v);
+        _mm256_storeu_si256((__m256i*)(dst + i + 8), v);
+    }
+    for (; i + 8 <= count; i += 8)
+        _mm256_storeu_si256((__m256i*)(dst + i), v);
+    for (; i < count; ++i)
+        dst[i] = value;
+}
+
+__attribute__((target("avx2"))) static void
+copy_avx2(uint32_t* dst, const uint32_t* src, size_t count)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_loadu_si256((const __m256i*)(src + i)));
+    for (; i < count; ++i)
+        dst[i] = src[i];
+}
+#endif
+
+#if KERNELS_NEON
+static void
+fill_neon(uint32_t* dst, uint32_t value, size_t count)
+{
+    uint32x4_t v = vdupq_n_u32(value);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        vst1q_u32(dst + i, v);
+        vst1q_u32(dst + i + 4, v);
+    }
+    for (; i + 4 <= count; i += 4)
+        vst1q_u32(dst + i, v);
+    for (; i < count; ++i)
+        dst[i] = value;
+}
+
+static void
+copy_neon(uint32_t* dst, const uint32_t* src, size_t count)
+{
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+        vst1q_u32(dst + i, vld1q_u32(src + i));
+    for (; i < count; ++i)
+        dst[i] = src[i];
+}
+#endif
+
+static const char* selected_name = "scalar";
+
+static void
+select_kernels(void)
+{
+    span_fill32_wide = fill_scalar;
+    span_copy32_wide = copy_scalar;
+    selected_name = "scalar";
+
+#if KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        span_fill32_wide = fill_avx2;
+        span_copy32_wide = copy_avx2;
+        selected_name = "avx2";
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {
+        span_fill32_wide = fill_sse2;
+        span_copy32_wide = copy_sse2;
+        selected_name = "sse2";
+    }
+#elif KERNELS_NEON
+    span_fill32_wide = fill_neon;
+    span_copy32_wide = copy_neon;
+    selected_name = "neon";
+#endif
+}
+
+// The pointers start out at these resolvers, which pick the implementation on first use.
+static void
+fill_resolve(uint32_t* dst, uint32_t value, size_t count)
+{
+    select_kernels();
+    span_fill32_wide(dst, value, count);
+}
+
+static void
+copy_resolve(uint32_t* dst, const uint32_t* src, size_t count)
+{
+    select_kernels();
+    span_copy32_wide(dst, src, count);
+}
+
+SpanFillFn span_fill32_wide = fill_resolve;
+SpanCopyFn span_copy32_wide = copy_resolve;
+
+const char*
+kernels_name(void)
+{
+    if (span_fill32_wide == fill_resolve)
+        select_kernels();
+    return selected_name;
+}
+
+// A packer per fixed layout: each channel keeps its top `bits` bits at `shift`.
+#define DEFINE_SPAN_PACK(name, type, r_shift, r_bits, g_shift, g_bits, b_shift, b_bits)          \
+    static void name(void* dst, const uint32_t* src, size_t count)                              \
+    {                                                                                           \
+        type* out = dst;                                                                        \
+        for (size_t i = 0; i < count; ++i)                                                      \
+        {                                                                                       \
+            uint32_t p = src[i];                                                                \
+            out[i] = (type)((((p >> 16) & 0xff) >> (8 - (r_bits))) << (r_shift) |              \
+                            (((p >> 8) & 0xff) >> (8 - (g_bits))) << (g_shift) |               \
+                            ((p & 0xff) >> (8 - (b_bits))) << (b_shift));                      \
+        }                                                                                       \
+    }
+
+DEFINE_SPAN_PACK(pack_rgb565, uint16_t, 11, 5, 5, 6, 0, 5)
+DEFINE_SPAN_PACK(pack_bgr565, uint16_t, 0, 5, 5, 6, 11, 5)
+DEFINE_SPAN_PACK(pack_rgb555, uint16_t, 10, 5, 5, 5, 0, 5)
+DEFINE_SPAN_PACK(pack_bgr555, uint16_t, 0, 5, 5, 5, 10, 5)
+
+typedef struct
+{
+    uint32_t red_mask, green_mask, blue_mask;
+    int bits_per_pixel;
+    SpanPackFn pack;
+} PackLayout;
+
+static const PackLayout pack_layouts[] = {
+    {0xf800, 0x07e0, 0x001f, 16, pack_rgb565},
+    {0x001f, 0x07e0, 0xf800, 16, pack_bgr565},
+    {0x7c00, 0x03e0, 0x001f, 16, pack_rgb555},
+    {0x001f, 0x03e0, 0x7c00, 16, pack_bgr555},
+};
+
+// Channel placement of the generic packer.
+static int generic_shift[3], generic_bits[3];
+static int generic_bytes;
+
+// Scales an 8-bit channel to 1..16 bits, repeating its top bits when widening.
+static uint32_t
+scale_channel(uint32_t v, int bits)
+{
+    if (bits <= 8)
+        return v >> (8 - bits);
+    return (v << (bits - 8)) | (v >> (16 - bits));
+}
+
+static void
+pack_generic(void* dst, const uint32_t* src, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        uint32_t p = src[i];
+        uint32_t out = scale_channel((p >> 16) & 0xff, generic_bits[0]) << generic_shift[0] |
+                       scale_channel((p >> 8) & 0xff, generic_bits[1]) << generic_shift[1] |
+                       scale_channel(p & 0xff, generic_bits[2]) << generic_shift[2];
+        if (generic_bytes == 4)
+            ((uint32_t*)dst)[i] = out;
+        else if (generic_bytes == 2)
+            ((uint16_t*)dst)[i] = (uint16_t)out;
+        else
+            ((uint8_t*)dst)[i] = (uint8_t)out;
+    }
+}
+
+// Contiguous masks of 1 to 16 bits only.
+static bool
+mask_layout(uint32_t mask, int* shift, int* bits)
+{
+    if (mask == 0)
+        return false;
+    *shift = __builtin_ctz(mask);
+    *bits = __builtin_popcount(mask);
+    return *bits <= 16 && (mask >> *shift) == (1u << *bits) - 1;
+}
+
+SpanPackFn
+span_pack_for(uint32_t red_mask, uint32_t green_mask, uint32_t blue_mask, int bits_per_pixel)
+{
+    for (size_t i = 0; i < sizeof(pack_layouts) / sizeof(pack_layouts[0]); ++i)
+    {
+        const PackLayout* l = &pack_layouts[i];
+        if (l->red_mask == red_mask && l->green_mask == green_mask &&
+            l->blue_mask == blue_mask && l->bits_per_pixel == bits_per_pixel)
+            return l->pack;
+    }
+
+    if (bits_per_pixel != 8 && bits_per_pixel != 16 && bits_per_pixel != 32)
+        return NULL;
+    uint32_t masks[3] = {red_mask, green_mask, blue_mask};
+    for (int c = 0; c < 3; ++c)
+        if (!mask_layout(masks[c], &generic_shift[c], &generic_bits[c]))
+            return NULL;
+    generic_bytes = bits_per_pixel / 8;
+    return pack_generic;
+}
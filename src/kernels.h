@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Span kernels shared by every rasterizer and buffer operation. The wide implementations
+// (SSE2/AVX2 on x86, NEON on AArch64) are picked on first use from what the CPU supports.
+typedef void (*SpanFillFn)(uint32_t* dst, uint32_t value, size_t count);
+typedef void (*SpanCopyFn)(uint32_t* dst, const uint32_t* src, size_t count);
+
+extern SpanFillFn span_fill32_wide;
+extern SpanCopyFn span_copy32_wide;
+
+const char* kernels_name(void);
+
+// Spans shorter than this are not worth a call through the dispatch pointer.
+#define SPAN_KERNEL_MIN 8
+
+static inline void
+span_fill32(uint32_t* dst, uint32_t value, size_t count)
+{
+    if (count < SPAN_KERNEL_MIN)
+    {
+        for (size_t i = 0; i < count; ++i)
+            dst[i] = value;
+        return;
+    }
+    span_fill32_wide(dst, value, count);
+}
+
+// dst and src must not overlap.
+static inline void
+span_copy32(uint32_t* dst, const uint32_t* src, size_t count)
+{
+    if (count < SPAN_KERNEL_MIN)
+    {
+        for (size_t i = 0; i < count; ++i)
+            dst[i] = src[i];
+        return;
+    }
+    span_copy32_wide(dst, src, count);
+}
+
+// src laid over dst at alpha / 256 (0..256), red and blue sharing one multiply. The unused top
+// byte comes out zero.
+static inline uint32_t
+blend32(uint32_t dst, uint32_t src, uint32_t alpha)
+{
+    uint32_t inv = 256 - alpha;
+    uint32_t rb = (((src & 0xff00ff) * alpha + (dst & 0xff00ff) * inv) >> 8) & 0xff00ff;
+    uint32_t g = (((src & 0x00ff00) * alpha + (dst & 0x00ff00) * inv) >> 8) & 0x00ff00;
+    return rb | g;
+}
+
+// Converts count 0x00RRGGBB pixels to a visual's own pixel layout, written to dst.
+typedef void (*SpanPackFn)(void* dst, const uint32_t* src, size_t count);
+
+// Packer for TrueColor pixels of bits_per_pixel (8, 16 or 32) with the given channel masks,
+// or NULL if there is none. The common 16-bit layouts have their own variants; others share
+// one generic packer, so only one such layout can be in use at a time.
+SpanPackFn span_pack_for(uint32_t red_mask,
+    uint32_t green_mask,
+    uint32_t blue_mask,
+    int bits_per_pixel);
@@ -1,14 +1,65 @@
 #include "app.h"
+#include "arena.h"
+#include "batch.h"
+#include "canvas.h"
 #include "display.h"
+#include "document.h"
+#include "export.h"
+#include "history.h"
+#include "input.h"
+#include "profile.h"
+#include "scene.h"
 #include "ui.h"
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
 #define W 600
 #define H 800
+#define DEFAULT_FPS 60
+
+static int
+usage(const char* argv0)
+{
+    fprintf(stderr, "usage: %s [--canvas WxH] [--open doc.srd] | --batch script.txt -o out.ppm|out.png\n", argv0);
+    return 2;
+}
 
 int
-main(void)
+main(int argc, char** argv)
 {
+    const char* script = NULL;
+    const char* out = NULL;
+    const char* canvas_size = NULL;
+    const char* document = NULL;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc)
+            script = argv[++i];
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            out = argv[++i];
+        else if (strcmp(argv[i], "--canvas") == 0 && i + 1 < argc)
+            canvas_size = argv[++i];
+        else if (strcmp(argv[i], "--open") == 0 && i + 1 < argc)
+            document = argv[++i];
+        else
+            return usage(argv[0]);
+    }
+    if (script || out)
+    {
+        if (!script || !out || canvas_size || document)
+            return usage(argv[0]);
+        return batch_run(script, out) ? 0 : 1;
+    }
+
+    int canvas_w = 0;
+    int canvas_h = 0;
+    if (canvas_size && sscanf(canvas_size, "%dx%d", &canvas_w, &canvas_h) != 2)
+        return usage(argv[0]);
+
     DisplayContext ctx = init_display(W, H);
+    ctx.clip.y0 = UI_BAR_H;
     InputState state = {
         .running = true,
         .have_first = false,
@@ -22,15 +73,62 @@ main(void)
     .snap_mode = -1,
     };
 
+    // SOFT_RENDERER_CANVAS_FILE keeps the canvas pixels somewhere other than $TMPDIR.
+    Canvas canvas;
+    if (canvas_size)
+    {
+        if (!canvas_open(&canvas, canvas_w, canvas_h, getenv("SOFT_RENDERER_CANVAS_FILE")))
+        {
+            fprintf(stderr, "cannot map a %dx%d canvas\n", canvas_w, canvas_h);
+            cleanup_display(&ctx);
+            return 1;
+        }
+        canvas.view_changed = true;
+        state.canvas = &canvas;
+    }
+    DisplayContext* target = state.canvas ? &canvas.ctx : &ctx;
+
+    history_init(&state.history, target);
+    profile_init(&ctx, target);
+    ui_init(&ctx);
+
+    // A missing document starts empty; Ctrl+S creates it.
+    if (document)
+    {
+        app_set_document(document);
+        if (!document_load(document, &state.scene, target))
+            fprintf(stderr, "%s: cannot load document\n", document);
+    }
+
+    if (state.canvas)
+        canvas_sync(&canvas, &ctx);
     render_ui(&ctx, &state);
     render_frame(&ctx);
+    input_start(&ctx);
+
+    register_handler(handle_expose, "handle_expose");
+    register_handler(handle_configure, "handle_configure");
+    register_handler(handle_keypress, "handle_keypress");
+    register_handler(handle_click, "handle_click");
+    register_handler(handle_motion, "handle_motion");
+    register_handler(handle_release, "handle_release");
 
-    register_handler(handle_keypress);
-    register_handler(handle_click);
-    register_handler(handle_motion);
+    const char* fps = getenv("SOFT_RENDERER_FPS");
+    app_set_target_fps(fps ? atoi(fps) : DEFAULT_FPS);
 
     app_run(&ctx, &state);
+    export_wait();
 
+    input_stop(&ctx);
+    ui_free(&ctx);
+    profile_shutdown(&ctx, target);
+    history_free(&state.history, target);
+    if (state.canvas)
+        canvas_close(&canvas);
+    scene_free(&state.scene);
+    arena_free(arena_frame());
+    free(state.poly_x);
+    free(state.poly_y);
     cleanup_display(&ctx);
     return 0;
 }
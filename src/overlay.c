@@ -0,0 +1,167 @@
+#include "overlay.h"
+
+#include "damage.h"
+#include "kernels.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+void
+overlay_begin(DisplayContext* ctx)
+{
+    overlay_clear(ctx);
+    ctx->overlay.active = true;
+}
+
+void
+overlay_end(DisplayContext* ctx)
+{
+    Overlay* o = &ctx->overlay;
+    o->active = false;
+    if (o->count > 0)
+        damage_rect(ctx, o->bounds.x0, o->bounds.y0, o->bounds.x1, o->bounds.y1);
+}
+
+void
+overlay_clear(DisplayContext* ctx)
+{
+    Overlay* o = &ctx->overlay;
+    if (o->count > 0)
+        damage_rect(ctx, o->bounds.x0, o->bounds.y0, o->bounds.x1, o->bounds.y1);
+
+    o->count = 0;
+    o->bounds = (Rect){0, 0, 0, 0};
+}
+
+void
+overlay_free(DisplayContext* ctx)
+{
+    Overlay* o = &ctx->overlay;
+    free(o->spans);
+    free(o->under);
+    memset(o, 0, sizeof(*o));
+}
+
+static void
+grow_bounds(Overlay* o, int y, int x0, int x1)
+{
+    if (o->bounds.x1 <= o->bounds.x0)
+    {
+        o->bounds = (Rect){x0, y, x1, y + 1};
+        return;
+    }
+    if (x0 < o->bounds.x0)
+        o->bounds.x0 = x0;
+    if (x1 > o->bounds.x1)
+        o->bounds.x1 = x1;
+    if (y < o->bounds.y0)
+        o->bounds.y0 = y;
+    if (y + 1 > o->bounds.y1)
+        o->bounds.y1 = y + 1;
+}
+
+void
+overlay_push(DisplayContext* ctx, int y, int x0, int x1, uint32_t color)
+{
+    overlay_push_blend(ctx, y, x0, x1, color, 256);
+}
+
+void
+overlay_push_blend(DisplayContext* ctx, int y, int x0, int x1, uint32_t color, int alpha)
+{
+    Overlay* o = &ctx->overlay;
+    if (y < ctx->clip.y0 || y >= ctx->clip.y1)
+        return;
+    if (x0 < ctx->clip.x0)
+        x0 = ctx->clip.x0;
+    if (x1 > ctx->clip.x1)
+        x1 = ctx->clip.x1;
+    if (x1 <= x0)
+        return;
+
+    // Rasterizers emit runs left to right; extend the previous span instead of adding one.
+    // Blended spans only merge when adjacent, since overlapping ones blend twice.
+    if (o->count > 0)
+    {
+        Span* last = &o->spans[o->count - 1];
+        bool joins = alpha >= 256 ? x0 >= last->x0 && x0 <= last->x1 : x0 == last->x1;
+        if (last->y == y && last->color == color && last->alpha == alpha && joins)
+        {
+            if (x1 > last->x1)
+                last->x1 = x1;
+            grow_bounds(o, y, x0, x1);
+            return;
+        }
+    }
+
+    if (o->count == o->cap)
+    {
+        int cap = o->cap ? o->cap * 2 : 256;
+        Span* spans = realloc(o->spans, (size_t)cap * sizeof(Span));
+        if (!spans)
+            return;
+        o->spans = spans;
+        o->cap = cap;
+    }
+    o->spans[o->count++] = (Span){y, x0, x1, color, alpha};
+    grow_bounds(o, y, x0, x1);
+}
+
+void
+overlay_composite(DisplayContext* ctx)
+{
+    Overlay* o = &ctx->overlay;
+    o->under_count = 0;
+    if (o->count == 0)
+        return;
+
+    size_t total = 0;
+    for (int i = 0; i < o->count; ++i)
+        total += (size_t)(o->spans[i].x1 - o->spans[i].x0);
+
+    if (total > o->under_cap)
+    {
+        uint32_t* under = realloc(o->under, total * sizeof(uint32_t));
+        if (!under)
+            return;
+        o->under = under;
+        o->under_cap = total;
+    }
+
+    // Spans may overlap; saving in order and restoring in reverse order keeps this exact.
+    uint32_t* saved = o->under;
+    for (int i = 0; i < o->count; ++i)
+    {
+        const Span* s = &o->spans[i];
+        uint32_t* row = &ctx->fb.data[s->y * ctx->w];
+        size_t n = (size_t)(s->x1 - s->x0);
+        span_copy32(saved, &row[s->x0], n);
+        saved += n;
+        if (s->alpha >= 256)
+        {
+            span_fill32(&row[s->x0], s->color, n);
+            continue;
+        }
+        for (int x = s->x0; x < s->x1; ++x)
+            row[x] = blend32(row[x], s->color, (uint32_t)s->alpha);
+    }
+    o->under_count = total;
+}
+
+void
+overlay_restore(DisplayContext* ctx)
+{
+    Overlay* o = &ctx->overlay;
+    if (o->under_count == 0)
+        return;
+
+    const uint32_t* saved = o->under + o->under_count;
+    for (int i = o->count - 1; i >= 0; --i)
+    {
+        const Span* s = &o->spans[i];
+        size_t n = (size_t)(s->x1 - s->x0);
+        saved -= n;
+        span_copy32(&ctx->fb.data[s->y * ctx->w + s->x0], saved, n);
+    }
+    o->under_count = 0;
+}
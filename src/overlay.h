@@ -0,0 +1,18 @@
+#pragma once
+
+#include "types.h"
+
+// Previews are recorded as spans instead of being drawn into fb.data. render_frame composites
+// them over the committed pixels for the upload and puts the covered pixels back afterwards,
+// so replacing a preview costs O(preview area) instead of a full framebuffer restore.
+void overlay_begin(DisplayContext* ctx);
+void overlay_end(DisplayContext* ctx);
+void overlay_clear(DisplayContext* ctx);
+void overlay_free(DisplayContext* ctx);
+
+void overlay_push(DisplayContext* ctx, int y, int x0, int x1, uint32_t color);
+// Anti-aliased coverage: color at alpha / 256 over whatever is below it when composited.
+void overlay_push_blend(DisplayContext* ctx, int y, int x0, int x1, uint32_t color, int alpha);
+
+void overlay_composite(DisplayContext* ctx);
+void overlay_restore(DisplayContext* ctx);
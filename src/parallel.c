@@ -0,0 +1,181 @@
+#include "parallel.h"
+
+#include "kernels.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define MAX_WORKERS 64
+
+typedef struct
+{
+    pthread_mutex_t caller; // one loop at a time; loops must not nest
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    pthread_t threads[MAX_WORKERS];
+    int worker_count;
+    bool started;
+    bool stopping;
+
+    // Current loop; `generation` changes whenever a new one is published.
+    unsigned generation;
+    ParallelFn fn;
+    void* arg;
+    int count;
+    atomic_int next;
+    atomic_int finished;
+    int busy_workers;
+} Pool;
+
+static Pool pool = {
+    .caller = PTHREAD_MUTEX_INITIALIZER,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+};
+
+static void
+run_items(ParallelFn fn, void* arg, int count)
+{
+    int i;
+    while ((i = atomic_fetch_add(&pool.next, 1)) < count)
+    {
+        fn(arg, i);
+        atomic_fetch_add(&pool.finished, 1);
+    }
+}
+
+static void*
+worker_main(void* unused)
+{
+    (void)unused;
+    unsigned seen = 0;
+
+    pthread_mutex_lock(&pool.lock);
+    for (;;)
+    {
+        while (!pool.stopping && pool.generation == seen)
+            pthread_cond_wait(&pool.wake, &pool.lock);
+        if (pool.stopping)
+            break;
+
+        seen = pool.generation;
+        ParallelFn fn = pool.fn;
+        void* arg = pool.arg;
+        int count = pool.count;
+        pool.busy_workers++;
+        pthread_mutex_unlock(&pool.lock);
+
+        run_items(fn, arg, count);
+
+        pthread_mutex_lock(&pool.lock);
+        pool.busy_workers--;
+        pthread_cond_signal(&pool.done);
+    }
+    pthread_mutex_unlock(&pool.lock);
+    return NULL;
+}
+
+static int
+configured_workers(void)
+{
+    const char* env = getenv("SOFT_RENDERER_THREADS");
+    long n = env ? atol(env) : sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1)
+        n = 1;
+    // The calling thread takes part, so it counts as one of the threads.
+    n -= 1;
+    return n > MAX_WORKERS ? MAX_WORKERS : (int)n;
+}
+
+static void
+start_pool(void)
+{
+    // Resolve the span kernels before any worker can race on the dispatch pointers.
+    kernels_name();
+
+    int want = configured_workers();
+    for (int i = 0; i < want; ++i)
+    {
+        if (pthread_create(&pool.threads[pool.worker_count], NULL, worker_main, NULL) != 0)
+            break;
+        pool.worker_count++;
+    }
+    pool.started = true;
+}
+
+void
+parallel_for(int count, ParallelFn fn, void* arg)
+{
+    if (count <= 0)
+        return;
+
+    pthread_mutex_lock(&pool.caller);
+    pthread_mutex_lock(&pool.lock);
+    if (!pool.started)
+        start_pool();
+
+    if (pool.worker_count == 0 || count == 1)
+    {
+        pthread_mutex_unlock(&pool.lock);
+        for (int i = 0; i < count; ++i)
+            fn(arg, i);
+        pthread_mutex_unlock(&pool.caller);
+        return;
+    }
+
+    // A worker that woke up late for the previous loop must be out of it before the shared
+    // counters are reset.
+    while (pool.busy_workers > 0)
+        pthread_cond_wait(&pool.done, &pool.lock);
+
+    pool.fn = fn;
+    pool.arg = arg;
+    pool.count = count;
+    atomic_store(&pool.next, 0);
+    atomic_store(&pool.finished, 0);
+    pool.generation++;
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+
+    run_items(fn, arg, count);
+
+    pthread_mutex_lock(&pool.lock);
+    while (atomic_load(&pool.finished) < count)
+        pthread_cond_wait(&pool.done, &pool.lock);
+    pthread_mutex_unlock(&pool.lock);
+    pthread_mutex_unlock(&pool.caller);
+}
+
+int
+parallel_threads(void)
+{
+    pthread_mutex_lock(&pool.lock);
+    if (!pool.started)
+        start_pool();
+    int n = pool.worker_count + 1;
+    pthread_mutex_unlock(&pool.lock);
+    return n;
+}
+
+void
+parallel_shutdown(void)
+{
+    pthread_mutex_lock(&pool.caller);
+    pthread_mutex_lock(&pool.lock);
+    pool.stopping = true;
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+
+    for (int i = 0; i < pool.worker_count; ++i)
+        pthread_join(pool.threads[i], NULL);
+
+    pool.worker_count = 0;
+    pool.started = false;
+    pool.stopping = false;
+    pthread_mutex_unlock(&pool.caller);
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+// A process-wide worker pool for data-parallel loops. parallel_for runs fn(arg, i) for every
+// i in [0, count) across the pool and the calling thread, and returns once all are done.
+// Calls from different threads are serialized; fn must not call parallel_for itself.
+typedef void (*ParallelFn)(void* arg, int index);
+
+void parallel_for(int count, ParallelFn fn, void* arg);
+int parallel_threads(void);
+void parallel_shutdown(void);
@@ -0,0 +1,228 @@
+#include "polyfill.h"
+
+#include "damage.h"
+#include "framebuffer.h"
+
+#include <stdlib.h>
+
+// A non-horizontal edge oriented top to bottom. It crosses row y when the row's centre line
+// y + 0.5 lies in [top, bottom), i.e. for rows [y0, y1). The crossing is tracked in exact
+// rational steps, so a row gets the same pixels whichever row the walk started from (tiles
+// start mid-polygon).
+typedef struct
+{
+    int y0, y1;
+    int winding; // +1 where the outline runs downwards, -1 upwards
+    int x;       // floor of the crossing with the current row's centre line
+    int rem;     // fractional part rem / den, 0 <= rem < den
+    int den;     // 2 * height
+    int step, step_rem;
+    int px; // first pixel whose centre is at or right of the crossing
+} Edge;
+
+// Edge table and active list, reused between calls (per thread, since tiles are rasterized
+// in parallel).
+static _Thread_local Edge* edge_table;
+static _Thread_local Edge** active;
+static _Thread_local int edge_cap;
+
+static bool
+reserve_edges(int count)
+{
+    if (count <= edge_cap)
+        return true;
+
+    int cap = edge_cap ? edge_cap : 64;
+    while (cap < count)
+        cap *= 2;
+
+    Edge* e = realloc(edge_table, (size_t)cap * sizeof(Edge));
+    if (!e)
+        return false;
+    edge_table = e;
+    Edge** a = realloc(active, (size_t)cap * sizeof(Edge*));
+    if (!a)
+        return false;
+    active = a;
+    edge_cap = cap;
+    return true;
+}
+
+static int64_t
+floor_div(int64_t a, int64_t b)
+{
+    int64_t q = a / b;
+    return (a % b != 0 && (a < 0) != (b < 0)) ? q - 1 : q;
+}
+
+// Pixel centres x + 0.5 >= crossing start at ceil(crossing - 0.5).
+static inline void
+edge_round(Edge* e)
+{
+    e->px = e->x + (2 * e->rem > e->den);
+}
+
+static void
+edge_init(Edge* e, int xa, int ya, int xb, int yb, int start)
+{
+    int dx = xb - xa;
+    int dy = yb - ya;
+    e->y0 = start;
+    e->y1 = yb;
+    e->den = 2 * dy;
+
+    // Crossing with row `start`: xa + (2 * (start - ya) + 1) * dx / (2 * dy).
+    int64_t num = (int64_t)(2 * (start - ya) + 1) * dx;
+    int64_t whole = floor_div(num, e->den);
+    e->x = xa + (int)whole;
+    e->rem = (int)(num - whole * e->den);
+
+    e->step = (int)floor_div(2 * (int64_t)dx, e->den);
+    e->step_rem = 2 * dx - e->step * e->den;
+    edge_round(e);
+}
+
+static inline void
+edge_advance(Edge* e)
+{
+    e->x += e->step;
+    e->rem += e->step_rem;
+    if (e->rem >= e->den)
+    {
+        e->rem -= e->den;
+        e->x++;
+    }
+    edge_round(e);
+}
+
+static int
+compare_edge_start(const void* a, const void* b)
+{
+    const Edge* ea = a;
+    const Edge* eb = b;
+    return (ea->y0 > eb->y0) - (ea->y0 < eb->y0);
+}
+
+// Crossings move little from one row to the next, so insertion sort is close to linear.
+static void
+sort_active(Edge** list, int count)
+{
+    for (int i = 1; i < count; ++i)
+    {
+        Edge* e = list[i];
+        int j = i;
+        while (j > 0 && list[j - 1]->px > e->px)
+        {
+            list[j] = list[j - 1];
+            --j;
+        }
+        list[j] = e;
+    }
+}
+
+static void
+emit_row(DisplayContext* ctx, int y, Edge** list, int count, int rule, uint32_t color)
+{
+    if (rule == FILL_EVEN_ODD)
+    {
+        for (int i = 0; i + 1 < count; i += 2)
+            fill_span(ctx, y, list[i]->px, list[i + 1]->px, color);
+        return;
+    }
+
+    int winding = 0;
+    int x0 = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        int before = winding;
+        winding += list[i]->winding;
+        if (before == 0 && winding != 0)
+            x0 = list[i]->px;
+        else if (before != 0 && winding == 0)
+            fill_span(ctx, y, x0, list[i]->px, color);
+    }
+}
+
+void
+fill_polygon(DisplayContext* ctx,
+    const int32_t* vx,
+    const int32_t* vy,
+    int count,
+    int rule,
+    uint32_t color)
+{
+    if (count < 3 || (rule != FILL_EVEN_ODD && rule != FILL_NON_ZERO))
+        return;
+
+    int min_x = vx[0], max_x = vx[0], min_y = vy[0], max_y = vy[0];
+    for (int i = 1; i < count; ++i)
+    {
+        if (vx[i] < min_x)
+            min_x = vx[i];
+        if (vx[i] > max_x)
+            max_x = vx[i];
+        if (vy[i] < min_y)
+            min_y = vy[i];
+        if (vy[i] > max_y)
+            max_y = vy[i];
+    }
+
+    // Only centres strictly inside the hull's box can be covered.
+    int ys = min_y > ctx->clip.y0 ? min_y : ctx->clip.y0;
+    int ye = max_y < ctx->clip.y1 ? max_y : ctx->clip.y1;
+    if (ys >= ye || max_x <= ctx->clip.x0 || min_x >= ctx->clip.x1)
+        return;
+    if (!reserve_edges(count))
+        return;
+
+    damage_rect(ctx, min_x, ys, max_x, ye);
+
+    int edge_count = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        int j = i + 1 < count ? i + 1 : 0;
+        if (vy[i] == vy[j])
+            continue;
+
+        bool down = vy[i] < vy[j];
+        int xa = down ? vx[i] : vx[j];
+        int ya = down ? vy[i] : vy[j];
+        int xb = down ? vx[j] : vx[i];
+        int yb = down ? vy[j] : vy[i];
+        if (yb <= ys || ya >= ye)
+            continue;
+
+        Edge* e = &edge_table[edge_count++];
+        edge_init(e, xa, ya, xb, yb, ya > ys ? ya : ys);
+        e->winding = down ? 1 : -1;
+    }
+    qsort(edge_table, (size_t)edge_count, sizeof(Edge), compare_edge_start);
+
+    int next = 0;
+    int active_count = 0;
+    for (int y = ys; y < ye; ++y)
+    {
+        int kept = 0;
+        for (int i = 0; i < active_count; ++i)
+            if (active[i]->y1 > y)
+                active[kept++] = active[i];
+        active_count = kept;
+
+        while (next < edge_count && edge_table[next].y0 == y)
+            active[active_count++] = &edge_table[next++];
+
+        if (active_count == 0)
+        {
+            // Skip the gap to the next edge (or stop once none are left).
+            if (next == edge_count)
+                break;
+            y = edge_table[next].y0 - 1;
+            continue;
+        }
+
+        sort_active(active, active_count);
+        emit_row(ctx, y, active, active_count, rule, color);
+        for (int i = 0; i < active_count; ++i)
+            edge_advance(active[i]);
+    }
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "types.h"
+
+// Scanline fill of the polygon through `count` vertices, closed by an implicit edge from the
+// last vertex back to the first. A pixel is inside when its centre is, under `rule`
+// (FILL_EVEN_ODD or FILL_NON_ZERO), so self-intersecting outlines fill predictably. Rows are
+// written as clipped spans through the preview overlay like every other rasterizer.
+void fill_polygon(DisplayContext* ctx,
+    const int32_t* vx,
+    const int32_t* vy,
+    int count,
+    int rule,
+    uint32_t color);
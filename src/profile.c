@@ -0,0 +1,241 @@
+#include "profile.h"
+
+#include "arena.h"
+#include "damage.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Frame statistics cover this many most recent frames.
+#define PROFILE_WINDOW 256
+
+// Shorter scopes are not worth a trace event.
+#define PROFILE_MIN_SCOPE_NS 1000
+
+// Tracing stops recording (but keeps the statistics) past this many events.
+#define PROFILE_MAX_EVENTS (1 << 20)
+
+typedef struct
+{
+    const char* name;
+    int64_t start;
+    int64_t dur; // < 0 marks a frame counter event, with the counters in `pixels`/`bytes`
+    uint64_t pixels;
+    uint64_t bytes;
+} TraceEvent;
+
+typedef struct
+{
+    bool enabled;
+    bool stats;
+    const char* trace_path;
+    int64_t epoch;
+
+    TraceEvent* events;
+    int event_count, event_cap;
+
+    int64_t frame_ns[PROFILE_WINDOW];
+    int frame_count; // total frames; the window holds the last PROFILE_WINDOW
+    uint64_t pixels; // reported since the last frame
+    uint64_t last_pixels;
+    size_t last_upload;
+
+    ArenaCounters arena; // at the end of the previous frame
+    uint64_t last_allocs, last_blocks;
+} Profile;
+
+static Profile prof;
+
+static int64_t
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+count_pixels(void* user, DisplayContext* ctx, Rect area)
+{
+    (void)user;
+    (void)ctx;
+    prof.pixels += (uint64_t)(area.x1 - area.x0) * (uint64_t)(area.y1 - area.y0);
+}
+
+void
+profile_init(DisplayContext* ctx, DisplayContext* target)
+{
+    memset(&prof, 0, sizeof(prof));
+    prof.stats = getenv("SOFT_RENDERER_STATS") != NULL;
+    prof.trace_path = getenv("SOFT_RENDERER_TRACE");
+    prof.enabled = prof.stats || prof.trace_path;
+    if (!prof.enabled)
+        return;
+
+    prof.epoch = now_ns();
+    prof.arena = arena_counters();
+    damage_add_hook(ctx, count_pixels, NULL);
+    if (target != ctx)
+        damage_add_hook(target, count_pixels, NULL);
+}
+
+static void
+push_event(TraceEvent e)
+{
+    if (!prof.trace_path || prof.event_count == PROFILE_MAX_EVENTS)
+        return;
+
+    if (prof.event_count == prof.event_cap)
+    {
+        int cap = prof.event_cap ? prof.event_cap * 2 : 4096;
+        TraceEvent* p = realloc(prof.events, (size_t)cap * sizeof(TraceEvent));
+        if (!p)
+            return;
+        prof.events = p;
+        prof.event_cap = cap;
+    }
+    prof.events[prof.event_count++] = e;
+}
+
+static void
+write_trace(const char* path)
+{
+    FILE* f = fopen(path, "w");
+    if (!f)
+    {
+        fprintf(stderr, "cannot write trace to %s\n", path);
+        return;
+    }
+
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (int i = 0; i < prof.event_count; ++i)
+    {
+        const TraceEvent* e = &prof.events[i];
+        double ts = (double)(e->start - prof.epoch) / 1000.0;
+        if (e->dur >= 0)
+            fprintf(f,
+                "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f}",
+                e->name,
+                ts,
+                (double)e->dur / 1000.0);
+        else
+            fprintf(f,
+                "{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,"
+                "\"args\":{\"pixels\":%llu,\"upload_bytes\":%llu}}",
+                e->name,
+                ts,
+                (unsigned long long)e->pixels,
+                (unsigned long long)e->bytes);
+        fprintf(f, "%s\n", i + 1 < prof.event_count ? "," : "");
+    }
+    fprintf(f, "]}\n");
+    fclose(f);
+}
+
+void
+profile_shutdown(DisplayContext* ctx, DisplayContext* target)
+{
+    if (!prof.enabled)
+        return;
+
+    damage_remove_hook(ctx, count_pixels, NULL);
+    if (target != ctx)
+        damage_remove_hook(target, count_pixels, NULL);
+    if (prof.trace_path)
+        write_trace(prof.trace_path);
+    free(prof.events);
+    memset(&prof, 0, sizeof(prof));
+}
+
+bool
+profile_enabled(void)
+{
+    return prof.enabled;
+}
+
+bool
+profile_stats_visible(void)
+{
+    return prof.stats;
+}
+
+int64_t
+profile_begin(void)
+{
+    return prof.enabled ? now_ns() : 0;
+}
+
+void
+profile_end(const char* name, int64_t start)
+{
+    if (!prof.enabled || start == 0)
+        return;
+
+    // Mostly handlers returning early for an event type they ignore.
+    int64_t dur = now_ns() - start;
+    if (dur >= PROFILE_MIN_SCOPE_NS)
+        push_event((TraceEvent){name, start, dur, 0, 0});
+}
+
+void
+profile_frame(int64_t start, size_t upload_bytes)
+{
+    if (!prof.enabled || start == 0)
+        return;
+
+    int64_t end = now_ns();
+    prof.frame_ns[prof.frame_count % PROFILE_WINDOW] = end - start;
+    prof.frame_count++;
+    prof.last_pixels = prof.pixels;
+    prof.last_upload = upload_bytes;
+
+    ArenaCounters arena = arena_counters();
+    prof.last_allocs = arena.allocs - prof.arena.allocs;
+    prof.last_blocks = arena.blocks - prof.arena.blocks;
+    prof.arena = arena;
+
+    push_event((TraceEvent){"frame", start, end - start, 0, 0});
+    push_event((TraceEvent){"traffic", end, -1, prof.pixels, upload_bytes});
+    prof.pixels = 0;
+}
+
+static int
+compare_ns(const void* a, const void* b)
+{
+    int64_t x = *(const int64_t*)a;
+    int64_t y = *(const int64_t*)b;
+    return (x > y) - (x < y);
+}
+
+void
+profile_format(char* timing, size_t timing_size, char* traffic, size_t traffic_size)
+{
+    int n = prof.frame_count < PROFILE_WINDOW ? prof.frame_count : PROFILE_WINDOW;
+    if (n == 0)
+    {
+        snprintf(timing, timing_size, "FRAME -");
+        snprintf(traffic, traffic_size, "PX - UP - AL - HEAP -");
+        return;
+    }
+
+    int64_t sorted[PROFILE_WINDOW];
+    int64_t sum = 0;
+    memcpy(sorted, prof.frame_ns, (size_t)n * sizeof(int64_t));
+    for (int i = 0; i < n; ++i)
+        sum += sorted[i];
+    qsort(sorted, (size_t)n, sizeof(int64_t), compare_ns);
+
+    double last = (double)prof.frame_ns[(prof.frame_count - 1) % PROFILE_WINDOW] * 1e-6;
+    double avg = (double)sum / n * 1e-6;
+    double p99 = (double)sorted[(n * 99) / 100 < n ? (n * 99) / 100 : n - 1] * 1e-6;
+    snprintf(timing, timing_size, "FRAME %.2f AVG %.2f P99 %.2f MS", last, avg, p99);
+    snprintf(traffic,
+        traffic_size,
+        "PX %llu UP %.1f KB AL %llu HEAP %llu",
+        (unsigned long long)prof.last_pixels,
+        (double)prof.last_upload / 1024.0,
+        (unsigned long long)prof.last_allocs,
+        (unsigned long long)prof.last_blocks);
+}
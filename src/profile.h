@@ -0,0 +1,28 @@
+#pragma once
+
+#include "types.h"
+
+// Opt-in timing of the event loop stages. SOFT_RENDERER_STATS shows live frame statistics
+// in the UI bar; SOFT_RENDERER_TRACE=path writes every recorded stage as a Chrome trace
+// (chrome://tracing, Perfetto) when the app exits. With neither set every call is a no-op.
+// Main thread only.
+//
+// Pixel counts come from writes into ctx (the window) and target, the context strokes are
+// committed to (a canvas, or ctx itself).
+void profile_init(DisplayContext* ctx, DisplayContext* target);
+void profile_shutdown(DisplayContext* ctx, DisplayContext* target);
+
+bool profile_enabled(void);
+bool profile_stats_visible(void);
+
+// Returns the start timestamp for profile_end, or 0 when profiling is off. `name` must
+// outlive the process (a string literal).
+int64_t profile_begin(void);
+void profile_end(const char* name, int64_t start);
+
+// Closes the frame that started at `start`: its wall time, the pixels writers reported since
+// the previous frame, the bytes render_frame uploaded and the arena allocations made.
+void profile_frame(int64_t start, size_t upload_bytes);
+
+// One-line summaries of the recent frames for the stats overlay.
+void profile_format(char* timing, size_t timing_size, char* traffic, size_t traffic_size);
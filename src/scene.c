@@ -0,0 +1,724 @@
+#include "scene.h"
+
+#include "arena.h"
+#include "draw.h"
+#include "polyfill.h"
+#include "spatial.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define SCENE_MIN_CAP 64
+
+#define RESIZE(ptr, cap) resize_array((void**)&(ptr), (size_t)(cap) * sizeof(*(ptr)))
+
+static bool
+resize_array(void** ptr, size_t bytes)
+{
+    void* p = realloc(*ptr, bytes);
+    if (!p)
+        return false;
+    *ptr = p;
+    return true;
+}
+
+static int
+next_cap(int cap, int need)
+{
+    if (cap < SCENE_MIN_CAP)
+        cap = SCENE_MIN_CAP;
+    while (cap < need)
+        cap *= 2;
+    return cap;
+}
+
+static int
+pen_reach(uint16_t style)
+{
+    return stroke_reach(SHAPE_THICKNESS(style), SHAPE_LINE_STYLE(style));
+}
+
+static bool
+push_order(Scene* scene, ShapeKind kind, int index)
+{
+    if (scene->count == scene->cap)
+    {
+        int cap = next_cap(scene->cap, scene->count + 1);
+        if (!RESIZE(scene->order, cap))
+            return false;
+        scene->cap = cap;
+    }
+    scene->order[scene->count++] = ((uint32_t)kind << SHAPE_KIND_SHIFT) | (uint32_t)index;
+    return true;
+}
+
+static const Rect no_rect = {0, 0, 0, 0};
+
+// A shape the grid misses would never be hit or redrawn, so on failure it is not committed.
+static bool
+index_last(Scene* scene)
+{
+    int pos = scene->count - 1;
+    Rect bounds = scene_shape_bounds(scene, scene->order[pos]);
+    if (spatial_insert(&scene->grid, &scene->arena, pos, bounds, no_rect))
+        return true;
+    spatial_truncate(&scene->grid, pos);
+    scene->count--;
+    return false;
+}
+
+void
+scene_add_point(Scene* scene, int x, int y, uint32_t color, uint16_t style)
+{
+    PointList* l = &scene->points;
+    if (l->count == l->cap)
+    {
+        int cap = next_cap(l->cap, l->count + 1);
+        if (!RESIZE(l->x, cap) || !RESIZE(l->y, cap) || !RESIZE(l->color, cap) ||
+            !RESIZE(l->style, cap))
+            return;
+        l->cap = cap;
+    }
+
+    int i = l->count;
+    l->x[i] = x;
+    l->y[i] = y;
+    l->color[i] = color;
+    l->style[i] = style;
+    l->count++;
+    if (!push_order(scene, SHAPE_POINT, i) || !index_last(scene))
+        l->count--;
+}
+
+void
+scene_add_line(Scene* scene, int x0, int y0, int x1, int y1, uint32_t color, uint16_t style)
+{
+    LineList* l = &scene->lines;
+    if (l->count == l->cap)
+    {
+        int cap = next_cap(l->cap, l->count + 1);
+        if (!RESIZE(l->x0, cap) || !RESIZE(l->y0, cap) || !RESIZE(l->x1, cap) ||
+            !RESIZE(l->y1, cap) || !RESIZE(l->color, cap) || !RESIZE(l->style, cap))
+            return;
+        l->cap = cap;
+    }
+
+    int i = l->count;
+    l->x0[i] = x0;
+    l->y0[i] = y0;
+    l->x1[i] = x1;
+    l->y1[i] = y1;
+    l->color[i] = color;
+    l->style[i] = style;
+    l->count++;
+    if (!push_order(scene, SHAPE_LINE, i) || !index_last(scene))
+        l->count--;
+}
+
+void
+scene_add_circle(Scene* scene, int cx, int cy, int radius, uint32_t color, uint16_t style)
+{
+    CircleList* l = &scene->circles;
+    if (l->count == l->cap)
+    {
+        int cap = next_cap(l->cap, l->count + 1);
+        if (!RESIZE(l->cx, cap) || !RESIZE(l->cy, cap) || !RESIZE(l->radius, cap) ||
+            !RESIZE(l->color, cap) || !RESIZE(l->style, cap))
+            return;
+        l->cap = cap;
+    }
+
+    int i = l->count;
+    l->cx[i] = cx;
+    l->cy[i] = cy;
+    l->radius[i] = radius;
+    l->color[i] = color;
+    l->style[i] = style;
+    l->count++;
+    if (!push_order(scene, SHAPE_CIRCLE, i) || !index_last(scene))
+        l->count--;
+}
+
+static bool
+reserve_order(Scene* scene, int extra)
+{
+    if (scene->count + extra <= scene->cap)
+        return true;
+    int cap = next_cap(scene->cap, scene->count + extra);
+    if (!RESIZE(scene->order, cap))
+        return false;
+    scene->cap = cap;
+    return true;
+}
+
+int
+scene_add_lines(Scene* scene,
+    const int* coords,
+    const uint32_t* colors,
+    uint32_t color,
+    int count,
+    uint16_t style)
+{
+    LineList* l = &scene->lines;
+    if (count <= 0 || !reserve_order(scene, count))
+        return 0;
+    if (l->count + count > l->cap)
+    {
+        int cap = next_cap(l->cap, l->count + count);
+        if (!RESIZE(l->x0, cap) || !RESIZE(l->y0, cap) || !RESIZE(l->x1, cap) ||
+            !RESIZE(l->y1, cap) || !RESIZE(l->color, cap) || !RESIZE(l->style, cap))
+            return 0;
+        l->cap = cap;
+    }
+
+    int added = 0;
+    for (; added < count; ++added)
+    {
+        const int* c = &coords[4 * added];
+        int i = l->count;
+        l->x0[i] = c[0];
+        l->y0[i] = c[1];
+        l->x1[i] = c[2];
+        l->y1[i] = c[3];
+        l->color[i] = colors ? colors[added] : color;
+        l->style[i] = style;
+        l->count++;
+        if (!push_order(scene, SHAPE_LINE, i) || !index_last(scene))
+        {
+            l->count--;
+            break;
+        }
+    }
+    return added;
+}
+
+int
+scene_add_circles(Scene* scene,
+    const int* coords,
+    const uint32_t* colors,
+    uint32_t color,
+    int count,
+    uint16_t style)
+{
+    CircleList* l = &scene->circles;
+    if (count <= 0 || !reserve_order(scene, count))
+        return 0;
+    if (l->count + count > l->cap)
+    {
+        int cap = next_cap(l->cap, l->count + count);
+        if (!RESIZE(l->cx, cap) || !RESIZE(l->cy, cap) || !RESIZE(l->radius, cap) ||
+            !RESIZE(l->color, cap) || !RESIZE(l->style, cap))
+            return 0;
+        l->cap = cap;
+    }
+
+    int added = 0;
+    for (; added < count; ++added)
+    {
+        const int* c = &coords[3 * added];
+        int i = l->count;
+        l->cx[i] = c[0];
+        l->cy[i] = c[1];
+        l->radius[i] = c[2];
+        l->color[i] = colors ? colors[added] : color;
+        l->style[i] = style;
+        l->count++;
+        if (!push_order(scene, SHAPE_CIRCLE, i) || !index_last(scene))
+        {
+            l->count--;
+            break;
+        }
+    }
+    return added;
+}
+
+static bool
+push_vertex(PolygonList* l, int x, int y)
+{
+    if (l->vcount == l->vcap)
+    {
+        int cap = next_cap(l->vcap, l->vcount + 1);
+        if (!RESIZE(l->vx, cap) || !RESIZE(l->vy, cap))
+            return false;
+        l->vcap = cap;
+    }
+    l->vx[l->vcount] = x;
+    l->vy[l->vcount] = y;
+    l->vcount++;
+    return true;
+}
+
+void
+scene_begin_polygon(Scene* scene, int x, int y, uint32_t color, uint16_t style)
+{
+    PolygonList* l = &scene->polygons;
+    if (l->count == l->cap)
+    {
+        int cap = next_cap(l->cap, l->count + 1);
+        if (!RESIZE(l->first, cap) || !RESIZE(l->vertex_count, cap) || !RESIZE(l->color, cap) ||
+            !RESIZE(l->style, cap))
+            return;
+        l->cap = cap;
+    }
+
+    int i = l->count;
+    l->first[i] = (uint32_t)l->vcount;
+    l->vertex_count[i] = 0;
+    l->color[i] = color;
+    l->style[i] = style;
+    if (!push_vertex(l, x, y))
+        return;
+    l->vertex_count[i] = 1;
+    l->count++;
+    if (!push_order(scene, SHAPE_POLYGON, i) || !index_last(scene))
+    {
+        l->count--;
+        l->vcount--;
+        return;
+    }
+    scene->tail_order = scene->count - 1;
+    scene->tail_bounds = scene_shape_bounds(scene, scene->order[scene->tail_order]);
+}
+
+void
+scene_extend_polygon(Scene* scene, int x, int y)
+{
+    PolygonList* l = &scene->polygons;
+    if (l->count == 0)
+        return;
+
+    // Vertices of the newest polygon are at the end of the pool.
+    int i = l->count - 1;
+    if (!push_vertex(l, x, y))
+        return;
+    l->vertex_count[i]++;
+
+    if (scene->tail_order < 0)
+    {
+        uint32_t entry = ((uint32_t)SHAPE_POLYGON << SHAPE_KIND_SHIFT) | (uint32_t)i;
+        int pos = scene->count - 1;
+        while (pos >= 0 && scene->order[pos] != entry)
+            --pos;
+        if (pos < 0)
+            return;
+        scene->tail_order = pos;
+        scene->tail_bounds = no_rect;
+    }
+
+    // Only the cells the polygon grew into are new to it.
+    Rect b = scene->tail_bounds;
+    Rect grown;
+    if (b.x1 > b.x0)
+    {
+        int pad = pen_reach(l->style[i]);
+        grown = (Rect){x - pad, y - pad, x + pad + 1, y + pad + 1};
+        grown.x0 = grown.x0 < b.x0 ? grown.x0 : b.x0;
+        grown.y0 = grown.y0 < b.y0 ? grown.y0 : b.y0;
+        grown.x1 = grown.x1 > b.x1 ? grown.x1 : b.x1;
+        grown.y1 = grown.y1 > b.y1 ? grown.y1 : b.y1;
+    }
+    else
+    {
+        grown = scene_shape_bounds(scene, scene->order[scene->tail_order]);
+    }
+
+    if (spatial_insert(&scene->grid, &scene->arena, scene->tail_order, grown, b))
+    {
+        scene->tail_bounds = grown;
+    }
+    else
+    {
+        l->vertex_count[i]--;
+        l->vcount--;
+    }
+}
+
+void
+scene_clear(Scene* scene)
+{
+    scene->first = scene->count;
+}
+
+SceneMark
+scene_mark(const Scene* scene)
+{
+    const PolygonList* g = &scene->polygons;
+    return (SceneMark){
+        .first = scene->first,
+        .order = scene->count,
+        .points = scene->points.count,
+        .lines = scene->lines.count,
+        .circles = scene->circles.count,
+        .polygons = g->count,
+        .vertices = g->vcount,
+        .last_polygon_vertices = g->count > 0 ? g->vertex_count[g->count - 1] : 0,
+    };
+}
+
+// Marks are only restored along the history they were taken from, so every list entry below
+// a marked count still holds the data it had when the mark was taken.
+void
+scene_restore_mark(Scene* scene, SceneMark mark)
+{
+    PolygonList* g = &scene->polygons;
+    int indexed = scene->count < mark.order ? scene->count : mark.order;
+    bool tail_grew = g->count > 0 && g->count == mark.polygons &&
+                     g->vertex_count[g->count - 1] < mark.last_polygon_vertices;
+
+    scene->first = mark.first;
+    scene->count = mark.order;
+    scene->points.count = mark.points;
+    scene->lines.count = mark.lines;
+    scene->circles.count = mark.circles;
+    g->count = mark.polygons;
+    g->vcount = mark.vertices;
+    if (g->count > 0)
+        g->vertex_count[g->count - 1] = mark.last_polygon_vertices;
+
+    // Dropped shapes leave the grid; restored ones (redo) and a polygon whose vertices came
+    // back return to it. Shrunk polygons keep their larger cells, which queries filter out.
+    spatial_truncate(&scene->grid, indexed);
+    for (int pos = indexed; pos < scene->count; ++pos)
+        spatial_insert(
+            &scene->grid, &scene->arena, pos, scene_shape_bounds(scene, scene->order[pos]), no_rect
+        );
+    scene->tail_order = -1;
+    if (tail_grew)
+    {
+        uint32_t entry = ((uint32_t)SHAPE_POLYGON << SHAPE_KIND_SHIFT) | (uint32_t)(g->count - 1);
+        for (int pos = indexed - 1; pos >= 0; --pos)
+        {
+            if (scene->order[pos] == entry)
+            {
+                spatial_insert(
+                    &scene->grid, &scene->arena, pos, scene_shape_bounds(scene, entry), no_rect
+                );
+                break;
+            }
+        }
+    }
+}
+
+void
+scene_free(Scene* scene)
+{
+    PointList* p = &scene->points;
+    free(p->x);
+    free(p->y);
+    free(p->color);
+    free(p->style);
+
+    LineList* l = &scene->lines;
+    free(l->x0);
+    free(l->y0);
+    free(l->x1);
+    free(l->y1);
+    free(l->color);
+    free(l->style);
+
+    CircleList* c = &scene->circles;
+    free(c->cx);
+    free(c->cy);
+    free(c->radius);
+    free(c->color);
+    free(c->style);
+
+    PolygonList* g = &scene->polygons;
+    free(g->first);
+    free(g->vertex_count);
+    free(g->color);
+    free(g->style);
+    free(g->vx);
+    free(g->vy);
+
+    free(scene->order);
+    arena_free(&scene->arena);
+    memset(scene, 0, sizeof(*scene));
+}
+
+static Stroke
+shape_stroke(uint32_t color, uint16_t style)
+{
+    return stroke_make(color, SHAPE_THICKNESS(style), SHAPE_LINE_STYLE(style));
+}
+
+// Draws entry i of `kind` with a pen already resolved for its colour and style.
+static void
+render_with_pen(const Scene* scene, DisplayContext* ctx, ShapeKind kind, int i, const Stroke* pen)
+{
+    switch (kind)
+    {
+    case SHAPE_POINT:
+        stroke_point(ctx, pen, scene->points.x[i], scene->points.y[i]);
+        break;
+    case SHAPE_LINE:
+    {
+        const LineList* l = &scene->lines;
+        stroke_line(ctx, pen, l->x0[i], l->y0[i], l->x1[i], l->y1[i]);
+        break;
+    }
+    case SHAPE_CIRCLE:
+    {
+        const CircleList* l = &scene->circles;
+        if (SHAPE_FILL_RULE(l->style[i]) != FILL_NONE)
+            fill_circle(ctx, l->cx[i], l->cy[i], l->radius[i], l->color[i]);
+        stroke_circle(ctx, pen, l->cx[i], l->cy[i], l->radius[i]);
+        break;
+    }
+    case SHAPE_POLYGON:
+    {
+        const PolygonList* l = &scene->polygons;
+        const int32_t* vx = &l->vx[l->first[i]];
+        const int32_t* vy = &l->vy[l->first[i]];
+        fill_polygon(ctx,
+            vx,
+            vy,
+            (int)l->vertex_count[i],
+            SHAPE_FILL_RULE(l->style[i]),
+            l->color[i]);
+        for (uint32_t v = 1; v < l->vertex_count[i]; ++v)
+            stroke_line(ctx, pen, vx[v - 1], vy[v - 1], vx[v], vy[v]);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+static void
+shape_pen(const Scene* scene, ShapeKind kind, int i, uint32_t* color, uint16_t* style)
+{
+    switch (kind)
+    {
+    case SHAPE_POINT:
+        *color = scene->points.color[i];
+        *style = scene->points.style[i];
+        break;
+    case SHAPE_LINE:
+        *color = scene->lines.color[i];
+        *style = scene->lines.style[i];
+        break;
+    case SHAPE_CIRCLE:
+        *color = scene->circles.color[i];
+        *style = scene->circles.style[i];
+        break;
+    case SHAPE_POLYGON:
+        *color = scene->polygons.color[i];
+        *style = scene->polygons.style[i];
+        break;
+    default:
+        *color = 0;
+        *style = 0;
+        break;
+    }
+}
+
+void
+scene_render_shape(const Scene* scene, DisplayContext* ctx, uint32_t entry)
+{
+    scene_render_entries(scene, ctx, &entry, 1);
+}
+
+void
+scene_render_entries(const Scene* scene, DisplayContext* ctx, const uint32_t* entries, int count)
+{
+    Stroke pen;
+    uint32_t pen_color = 0;
+    uint16_t pen_style = 0;
+    bool have_pen = false;
+
+    for (int k = 0; k < count; ++k)
+    {
+        ShapeKind kind = (ShapeKind)(entries[k] >> SHAPE_KIND_SHIFT);
+        int i = (int)(entries[k] & SHAPE_INDEX_MASK);
+        uint32_t color;
+        uint16_t style;
+        shape_pen(scene, kind, i, &color, &style);
+
+        // Bulk-drawn shapes mostly share their pen with the one before.
+        if (!have_pen || color != pen_color || style != pen_style)
+        {
+            pen = shape_stroke(color, style);
+            pen_color = color;
+            pen_style = style;
+            have_pen = true;
+        }
+        render_with_pen(scene, ctx, kind, i, &pen);
+    }
+}
+
+Rect
+scene_shape_bounds(const Scene* scene, uint32_t entry)
+{
+    int i = (int)(entry & SHAPE_INDEX_MASK);
+    int x0 = 0, y0 = 0, x1 = 0, y1 = 0, pad = 0;
+
+    switch ((ShapeKind)(entry >> SHAPE_KIND_SHIFT))
+    {
+    case SHAPE_POINT:
+        x0 = x1 = scene->points.x[i];
+        y0 = y1 = scene->points.y[i];
+        pad = pen_reach(scene->points.style[i]);
+        break;
+    case SHAPE_LINE:
+    {
+        const LineList* l = &scene->lines;
+        x0 = l->x0[i] < l->x1[i] ? l->x0[i] : l->x1[i];
+        x1 = l->x0[i] < l->x1[i] ? l->x1[i] : l->x0[i];
+        y0 = l->y0[i] < l->y1[i] ? l->y0[i] : l->y1[i];
+        y1 = l->y0[i] < l->y1[i] ? l->y1[i] : l->y0[i];
+        pad = pen_reach(l->style[i]);
+        break;
+    }
+    case SHAPE_CIRCLE:
+    {
+        const CircleList* l = &scene->circles;
+        int r = l->radius[i] < 0 ? -l->radius[i] : l->radius[i];
+        x0 = l->cx[i] - r;
+        x1 = l->cx[i] + r;
+        y0 = l->cy[i] - r;
+        y1 = l->cy[i] + r;
+        pad = pen_reach(l->style[i]);
+        break;
+    }
+    case SHAPE_POLYGON:
+    {
+        const PolygonList* l = &scene->polygons;
+        const int32_t* vx = &l->vx[l->first[i]];
+        const int32_t* vy = &l->vy[l->first[i]];
+        x0 = x1 = vx[0];
+        y0 = y1 = vy[0];
+        for (uint32_t v = 1; v < l->vertex_count[i]; ++v)
+        {
+            if (vx[v] < x0)
+                x0 = vx[v];
+            if (vx[v] > x1)
+                x1 = vx[v];
+            if (vy[v] < y0)
+                y0 = vy[v];
+            if (vy[v] > y1)
+                y1 = vy[v];
+        }
+        pad = pen_reach(l->style[i]);
+        break;
+    }
+    default:
+        break;
+    }
+
+    return (Rect){x0 - pad, y0 - pad, x1 + pad + 1, y1 + pad + 1};
+}
+
+void
+scene_render_range(const Scene* scene, DisplayContext* ctx, int first, int last)
+{
+    if (first < 0)
+        first = 0;
+    if (last > scene->count)
+        last = scene->count;
+
+    if (first < last)
+        scene_render_entries(scene, ctx, &scene->order[first], last - first);
+}
+
+void
+scene_render(const Scene* scene, DisplayContext* ctx)
+{
+    scene_render_range(scene, ctx, scene->first, scene->count);
+}
+
+static bool
+rects_overlap(Rect a, Rect b)
+{
+    return a.x0 < b.x1 && b.x0 < a.x1 && a.y0 < b.y1 && b.y0 < a.y1;
+}
+
+int
+scene_query(const Scene* scene, Rect area, Arena* scratch, int32_t** out)
+{
+    int n = spatial_query(&scene->grid, area, scene->count - scene->first, scratch, out);
+    int kept = 0;
+    for (int k = 0; k < n; ++k)
+    {
+        int32_t pos = (*out)[k];
+        if (pos >= scene->first && pos < scene->count &&
+            rects_overlap(scene_shape_bounds(scene, scene->order[pos]), area))
+            (*out)[kept++] = pos;
+    }
+    return n < 0 ? -1 : kept;
+}
+
+typedef struct
+{
+    int x, y;
+    int64_t best; // squared distance of (vx, vy), or above the limit while none is found
+    int vx, vy;
+} VertexSearch;
+
+static void
+consider_vertex(VertexSearch* s, int vx, int vy)
+{
+    int64_t dx = (int64_t)vx - s->x;
+    int64_t dy = (int64_t)vy - s->y;
+    int64_t d = dx * dx + dy * dy;
+    if (d < s->best)
+    {
+        s->best = d;
+        s->vx = vx;
+        s->vy = vy;
+    }
+}
+
+static void
+consider_shape(const Scene* scene, VertexSearch* s, uint32_t entry)
+{
+    int i = (int)(entry & SHAPE_INDEX_MASK);
+    switch ((ShapeKind)(entry >> SHAPE_KIND_SHIFT))
+    {
+    case SHAPE_POINT:
+        consider_vertex(s, scene->points.x[i], scene->points.y[i]);
+        break;
+    case SHAPE_LINE:
+        consider_vertex(s, scene->lines.x0[i], scene->lines.y0[i]);
+        consider_vertex(s, scene->lines.x1[i], scene->lines.y1[i]);
+        break;
+    case SHAPE_POLYGON:
+    {
+        const PolygonList* l = &scene->polygons;
+        for (uint32_t v = 0; v < l->vertex_count[i]; ++v)
+            consider_vertex(s, l->vx[l->first[i] + v], l->vy[l->first[i] + v]);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+bool
+scene_nearest_vertex(const Scene* scene, int x, int y, int max_dist, int* vx, int* vy)
+{
+    VertexSearch s = {x, y, (int64_t)max_dist * max_dist + 1, 0, 0};
+    Rect area = {x - max_dist, y - max_dist, x + max_dist + 1, y + max_dist + 1};
+
+    Arena* scratch = arena_frame();
+    ArenaMark mark = arena_mark(scratch);
+    int32_t* found;
+    int n = scene_query(scene, area, scratch, &found);
+    if (n >= 0)
+    {
+        for (int k = 0; k < n; ++k)
+            consider_shape(scene, &s, scene->order[found[k]]);
+    }
+    else
+    {
+        for (int pos = scene->first; pos < scene->count; ++pos)
+            consider_shape(scene, &s, scene->order[pos]);
+    }
+    arena_release(scratch, mark);
+
+    if (s.best > (int64_t)max_dist * max_dist)
+        return false;
+    *vx = s.vx;
+    *vy = s.vy;
+    return true;
+}
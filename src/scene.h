@@ -0,0 +1,59 @@
+#pragma once
+
+#include "types.h"
+
+// The framebuffer is a cache of the scene: every committed stroke is also recorded here so
+// it can be re-rasterized without replaying user input.
+void scene_add_point(Scene* scene, int x, int y, uint32_t color, uint16_t style);
+void scene_add_line(Scene* scene, int x0, int y0, int x1, int y1, uint32_t color, uint16_t style);
+void scene_add_circle(Scene* scene, int cx, int cy, int radius, uint32_t color, uint16_t style);
+
+// Bulk submission in one pen style: `count` lines as x0 y0 x1 y1 quadruples or circles as
+// cx cy radius triples, committed in array order with one prepacked colour each from colors,
+// or `color` for all when it is NULL. Returns how many were added (fewer when out of memory).
+int scene_add_lines(Scene* scene,
+    const int* coords,
+    const uint32_t* colors,
+    uint32_t color,
+    int count,
+    uint16_t style);
+int scene_add_circles(Scene* scene,
+    const int* coords,
+    const uint32_t* colors,
+    uint32_t color,
+    int count,
+    uint16_t style);
+
+// Polygons are built a vertex at a time while the user clicks; extending appends to the
+// most recently begun polygon.
+void scene_begin_polygon(Scene* scene, int x, int y, uint32_t color, uint16_t style);
+void scene_extend_polygon(Scene* scene, int x, int y);
+
+// Hides every shape without discarding it; scene_restore_mark can bring them back.
+void scene_clear(Scene* scene);
+void scene_free(Scene* scene);
+
+SceneMark scene_mark(const Scene* scene);
+void scene_restore_mark(Scene* scene, SceneMark mark);
+
+// Half-open pixel bounds of an `order` entry, including the pen.
+Rect scene_shape_bounds(const Scene* scene, uint32_t entry);
+void scene_render_shape(const Scene* scene, DisplayContext* ctx, uint32_t entry);
+// Draws a run of `order` entries in sequence, resolving a pen only when it changes.
+void scene_render_entries(const Scene* scene,
+    DisplayContext* ctx,
+    const uint32_t* entries,
+    int count);
+
+// Order positions of the visible shapes whose bounds overlap area, ascending, from the
+// spatial grid; *out is allocated from `scratch`. Returns how many, or -1 when scanning every
+// visible shape is as cheap (or memory ran out).
+int scene_query(const Scene* scene, Rect area, Arena* scratch, int32_t** out);
+
+// Nearest point, line endpoint or polygon vertex of the visible shapes within max_dist
+// pixels of (x, y). Returns false if there is none.
+bool scene_nearest_vertex(const Scene* scene, int x, int y, int max_dist, int* vx, int* vy);
+
+// Draws shapes [first, last) in commit order.
+void scene_render_range(const Scene* scene, DisplayContext* ctx, int first, int last);
+void scene_render(const Scene* scene, DisplayContext* ctx);
@@ -0,0 +1,253 @@
+#include "spatial.h"
+
+#include "arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define SPATIAL_MIN_SLOTS 256
+#define SPATIAL_MIN_IDS 4
+
+typedef struct
+{
+    int x0, y0, x1, y1; // inclusive cell range, empty when x1 < x0
+} CellRange;
+
+static int
+cell_of(int v)
+{
+    return v >= 0 ? v / SPATIAL_CELL : -((-(v + 1)) / SPATIAL_CELL) - 1;
+}
+
+static CellRange
+cell_range(Rect r)
+{
+    if (r.x1 <= r.x0 || r.y1 <= r.y0)
+        return (CellRange){0, 0, -1, -1};
+    return (CellRange){cell_of(r.x0), cell_of(r.y0), cell_of(r.x1 - 1), cell_of(r.y1 - 1)};
+}
+
+static int64_t
+range_cells(CellRange c)
+{
+    if (c.x1 < c.x0)
+        return 0;
+    return ((int64_t)c.x1 - c.x0 + 1) * ((int64_t)c.y1 - c.y0 + 1);
+}
+
+static bool
+range_contains(CellRange c, int cx, int cy)
+{
+    return cx >= c.x0 && cx <= c.x1 && cy >= c.y0 && cy <= c.y1;
+}
+
+static uint32_t
+cell_hash(int32_t cx, int32_t cy)
+{
+    uint32_t h = (uint32_t)cx * 0x9e3779b1u ^ (uint32_t)cy * 0x85ebca77u;
+    return h ^ (h >> 15);
+}
+
+// Slot holding (cx, cy), or the free slot where it would go.
+static SpatialCell*
+find_slot(const SpatialGrid* g, int32_t cx, int32_t cy)
+{
+    uint32_t mask = (uint32_t)g->cap - 1;
+    for (uint32_t i = cell_hash(cx, cy) & mask;; i = (i + 1) & mask)
+    {
+        SpatialCell* c = &g->cells[i];
+        if (c->cap == 0 || (c->cx == cx && c->cy == cy))
+            return c;
+    }
+}
+
+static bool
+grow_table(SpatialGrid* g, Arena* pool)
+{
+    int cap = g->cap > 0 ? g->cap * 2 : SPATIAL_MIN_SLOTS;
+    SpatialCell* old = g->cells;
+    int old_cap = g->cap;
+
+    g->cells = arena_pool_alloc(pool, (size_t)cap * sizeof(SpatialCell));
+    if (!g->cells)
+    {
+        g->cells = old;
+        return false;
+    }
+    memset(g->cells, 0, (size_t)cap * sizeof(SpatialCell));
+    g->cap = cap;
+    for (int i = 0; i < old_cap; ++i)
+    {
+        if (old[i].cap > 0)
+            *find_slot(g, old[i].cx, old[i].cy) = old[i];
+    }
+    arena_pool_free(pool, old, (size_t)old_cap * sizeof(SpatialCell));
+    return true;
+}
+
+// Inserts id into an ascending list unless it is already there.
+static bool
+list_insert(Arena* pool, int32_t** ids, int* count, int* cap, int32_t id)
+{
+    int n = *count;
+    if (n > 0 && (*ids)[n - 1] == id)
+        return true;
+    if (n == *cap)
+    {
+        int grown = *cap > 0 ? *cap * 2 : SPATIAL_MIN_IDS;
+        int32_t* p = arena_pool_resize(pool,
+            *ids,
+            (size_t)*cap * sizeof(int32_t),
+            (size_t)grown * sizeof(int32_t));
+        if (!p)
+            return false;
+        *ids = p;
+        *cap = grown;
+    }
+
+    // Ids nearly always arrive in increasing order; a grown rect may revisit older ones.
+    int i = n;
+    while (i > 0 && (*ids)[i - 1] > id)
+        --i;
+    if (i > 0 && (*ids)[i - 1] == id)
+        return true;
+    memmove(&(*ids)[i + 1], &(*ids)[i], (size_t)(n - i) * sizeof(int32_t));
+    (*ids)[i] = id;
+    *count = n + 1;
+    return true;
+}
+
+static bool
+cell_insert(SpatialGrid* g, Arena* pool, int32_t cx, int32_t cy, int32_t id)
+{
+    if ((g->count + 1) * 2 > g->cap && !grow_table(g, pool))
+        return false;
+
+    SpatialCell* c = find_slot(g, cx, cy);
+    if (c->cap == 0)
+    {
+        c->ids = arena_pool_alloc(pool, SPATIAL_MIN_IDS * sizeof(int32_t));
+        if (!c->ids)
+            return false;
+        c->cx = cx;
+        c->cy = cy;
+        c->count = 0;
+        c->cap = SPATIAL_MIN_IDS;
+        g->count++;
+    }
+    return list_insert(pool, &c->ids, &c->count, &c->cap, id);
+}
+
+bool
+spatial_insert(SpatialGrid* g, Arena* pool, int32_t id, Rect area, Rect known)
+{
+    CellRange a = cell_range(area);
+    CellRange k = cell_range(known);
+    if (range_cells(a) > SPATIAL_MAX_CELLS)
+        return list_insert(pool, &g->oversize, &g->oversize_count, &g->oversize_cap, id);
+
+    for (int cy = a.y0; cy <= a.y1; ++cy)
+    {
+        for (int cx = a.x0; cx <= a.x1; ++cx)
+        {
+            if (range_contains(k, cx, cy))
+                continue;
+            if (!cell_insert(g, pool, cx, cy, id))
+                return false;
+        }
+    }
+    return true;
+}
+
+void
+spatial_truncate(SpatialGrid* g, int32_t count)
+{
+    for (int i = 0; i < g->cap; ++i)
+    {
+        SpatialCell* c = &g->cells[i];
+        while (c->count > 0 && c->ids[c->count - 1] >= count)
+            c->count--;
+    }
+    while (g->oversize_count > 0 && g->oversize[g->oversize_count - 1] >= count)
+        g->oversize_count--;
+}
+
+static int
+compare_id(const void* a, const void* b)
+{
+    int32_t x = *(const int32_t*)a;
+    int32_t y = *(const int32_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Appends a cell's list to the scratch array; false once the total passes the limit.
+static bool
+gather(Arena* scratch, const int32_t* ids, int count, int limit, int32_t** out, int* n)
+{
+    if (count == 0)
+        return true;
+    if (*n + count > limit)
+        return false;
+
+    int32_t* p = arena_resize(scratch,
+        *out,
+        (size_t)*n * sizeof(int32_t),
+        (size_t)(*n + count) * sizeof(int32_t));
+    if (!p)
+        return false;
+    memcpy(&p[*n], ids, (size_t)count * sizeof(int32_t));
+    *out = p;
+    *n += count;
+    return true;
+}
+
+int
+spatial_query(const SpatialGrid* g, Rect area, int limit, Arena* scratch, int32_t** out)
+{
+    CellRange a = cell_range(area);
+    int n = 0;
+    int lists = 0;
+    *out = NULL;
+    if (range_cells(a) > 0 && g->count > 0)
+    {
+        // A large area has more cells than the table has entries: walk the table instead.
+        bool walk = range_cells(a) > g->count;
+        int slots = walk ? g->cap : (int)range_cells(a);
+        for (int s = 0; s < slots; ++s)
+        {
+            const SpatialCell* c;
+            if (walk)
+            {
+                c = &g->cells[s];
+                if (c->cap == 0 || !range_contains(a, c->cx, c->cy))
+                    continue;
+            }
+            else
+            {
+                int w = a.x1 - a.x0 + 1;
+                c = find_slot(g, a.x0 + s % w, a.y0 + s / w);
+                if (c->cap == 0)
+                    continue;
+            }
+            if (!gather(scratch, c->ids, c->count, limit, out, &n))
+                return -1;
+            lists += c->count > 0;
+        }
+    }
+    if (!gather(scratch, g->oversize, g->oversize_count, limit, out, &n))
+        return -1;
+    lists += g->oversize_count > 0;
+
+    if (lists > 1)
+    {
+        qsort(*out, (size_t)n, sizeof(int32_t), compare_id);
+        int kept = 0;
+        for (int i = 0; i < n; ++i)
+        {
+            if (kept == 0 || (*out)[i] != (*out)[kept - 1])
+                (*out)[kept++] = (*out)[i];
+        }
+        n = kept;
+    }
+    return n;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "types.h"
+
+// Uniform grid of SPATIAL_CELL pixel cells keyed on bounding rects, for hit-testing and
+// partial redraw without visiting every shape. Cells live in a hash table, so coordinates are
+// not bounded by any surface. Ids are small non-negative integers (scene order positions).
+#define SPATIAL_CELL 64
+
+// A rect covering more cells than this goes to the oversize list, checked by every query.
+#define SPATIAL_MAX_CELLS 256
+
+// Lists id in the cells overlapping area, except those also overlapping `known` (cells the
+// id is already in, for a rect that grew; pass an empty rect otherwise). The grid's memory
+// comes from the free lists of `pool` and goes away with it. Returns false if out of memory.
+bool spatial_insert(SpatialGrid* g, Arena* pool, int32_t id, Rect area, Rect known);
+
+// Drops every id >= count.
+void spatial_truncate(SpatialGrid* g, int32_t count);
+
+// Points *out at the ids listed in cells overlapping area, ascending and without repeats,
+// allocated from `scratch`, and returns how many. The bounds are only as fine as the cells,
+// so callers still test each one. Returns -1 if more than `limit` entries would have to be
+// gathered, where a plain scan is cheaper, or if out of memory.
+int spatial_query(const SpatialGrid* g, Rect area, int limit, Arena* scratch, int32_t** out);
@@ -0,0 +1,183 @@
+#include "tiles.h"
+
+#include "arena.h"
+#include "damage.h"
+#include "kernels.h"
+#include "parallel.h"
+#include "scene.h"
+
+#include <string.h>
+
+typedef struct
+{
+    const Scene* scene;
+    const DisplayContext* ctx;
+    int tiles_x;
+    Rect area;
+
+    // Order positions to bin, ascending; NULL bins every visible shape.
+    const int32_t* shapes;
+    int shape_count;
+
+    // CSR bins: entries of tile t are entries[start[t] .. start[t + 1]), in commit order.
+    int* start;
+    uint32_t* entries;
+} TileJob;
+
+static Rect
+tile_rect(const TileJob* job, int t)
+{
+    Rect r;
+    r.x0 = job->area.x0 + (t % job->tiles_x) * TILE_SIZE;
+    r.y0 = job->area.y0 + (t / job->tiles_x) * TILE_SIZE;
+    r.x1 = r.x0 + TILE_SIZE < job->area.x1 ? r.x0 + TILE_SIZE : job->area.x1;
+    r.y1 = r.y0 + TILE_SIZE < job->area.y1 ? r.y0 + TILE_SIZE : job->area.y1;
+    return r;
+}
+
+static void
+render_tile(void* arg, int t)
+{
+    const TileJob* job = arg;
+    if (job->start[t] == job->start[t + 1])
+        return;
+
+    // Private copy: own clip, no overlay, no write hooks (the caller reported the tile
+    // up front) and damage that nobody reads.
+    DisplayContext local = *job->ctx;
+    local.clip = tile_rect(job, t);
+    local.overlay.active = false;
+    local.damage.count = 0;
+    local.damage.coalesce_px = -1; // one growing rect: cheapest to keep up
+    local.write_hook_count = 0;
+
+    scene_render_entries(job->scene,
+        &local,
+        &job->entries[job->start[t]],
+        job->start[t + 1] - job->start[t]);
+}
+
+// First pass (fill = false) counts entries per tile into start[t + 1]; the second appends
+// each entry to every tile its bounds overlap.
+static void
+bin_shapes(TileJob* job, int tiles_y, bool fill)
+{
+    const Rect a = job->area;
+    for (int k = 0; k < job->shape_count; ++k)
+    {
+        int i = job->shapes ? job->shapes[k] : job->scene->first + k;
+        uint32_t entry = job->scene->order[i];
+        Rect b = scene_shape_bounds(job->scene, entry);
+        if (b.x1 <= a.x0 || b.x0 >= a.x1 || b.y1 <= a.y0 || b.y0 >= a.y1)
+            continue;
+
+        int tx0 = b.x0 <= a.x0 ? 0 : (b.x0 - a.x0) / TILE_SIZE;
+        int ty0 = b.y0 <= a.y0 ? 0 : (b.y0 - a.y0) / TILE_SIZE;
+        int tx1 = b.x1 >= a.x1 ? job->tiles_x - 1 : (b.x1 - 1 - a.x0) / TILE_SIZE;
+        int ty1 = b.y1 >= a.y1 ? tiles_y - 1 : (b.y1 - 1 - a.y0) / TILE_SIZE;
+
+        for (int ty = ty0; ty <= ty1; ++ty)
+        {
+            for (int tx = tx0; tx <= tx1; ++tx)
+            {
+                int t = ty * job->tiles_x + tx;
+                if (fill)
+                    job->entries[job->start[t]++] = entry;
+                else
+                    job->start[t + 1]++;
+            }
+        }
+    }
+}
+
+void
+render_scene_tiled(const Scene* scene, DisplayContext* ctx)
+{
+    Rect area = ctx->clip;
+    if (area.x1 <= area.x0 || area.y1 <= area.y0 || scene->count == scene->first)
+        return;
+
+    int tiles_x = (area.x1 - area.x0 + TILE_SIZE - 1) / TILE_SIZE;
+    int tiles_y = (area.y1 - area.y0 + TILE_SIZE - 1) / TILE_SIZE;
+    int tile_count = tiles_x * tiles_y;
+
+    // Bins and the shape list are scratch for this call.
+    Arena* scratch = arena_frame();
+    ArenaMark mark = arena_mark(scratch);
+
+    // A partial redraw only bins the shapes the spatial grid finds near the area.
+    int32_t* shapes;
+    int shape_count = scene_query(scene, area, scratch, &shapes);
+    if (shape_count < 0)
+    {
+        shapes = NULL;
+        shape_count = scene->count - scene->first;
+    }
+
+    TileJob job = {scene, ctx, tiles_x, area, shapes, shape_count, NULL, NULL};
+    job.start = arena_alloc(scratch, ((size_t)tile_count + 1) * sizeof(int));
+    if (!job.start)
+    {
+        arena_release(scratch, mark);
+        return;
+    }
+    memset(job.start, 0, ((size_t)tile_count + 1) * sizeof(int));
+
+    // Count, prefix-sum, then fill (which shifts each start to the next tile's start).
+    bin_shapes(&job, tiles_y, false);
+    for (int t = 0; t < tile_count; ++t)
+        job.start[t + 1] += job.start[t];
+
+    size_t total = job.start[tile_count] > 0 ? (size_t)job.start[tile_count] : 1;
+    job.entries = arena_alloc(scratch, total * sizeof(uint32_t));
+    if (!job.entries)
+    {
+        arena_release(scratch, mark);
+        return;
+    }
+
+    bin_shapes(&job, tiles_y, true);
+    for (int t = tile_count; t > 0; --t)
+        job.start[t] = job.start[t - 1];
+    job.start[0] = 0;
+
+    // Only tiles that get shapes are reported, so write hooks (canvas residency, history
+    // snapshots) see what is drawn rather than the whole area.
+    for (int t = 0; t < tile_count; ++t)
+    {
+        if (job.start[t] == job.start[t + 1])
+            continue;
+        Rect r = tile_rect(&job, t);
+        damage_rect(ctx, r.x0, r.y0, r.x1, r.y1);
+    }
+    parallel_for(tile_count, render_tile, &job);
+
+    arena_release(scratch, mark);
+}
+
+typedef struct
+{
+    DisplayContext* ctx;
+    uint32_t color;
+    int rows_per_band;
+} FillJob;
+
+static void
+fill_band(void* arg, int band)
+{
+    const FillJob* job = arg;
+    int y0 = band * job->rows_per_band;
+    int y1 = y0 + job->rows_per_band < job->ctx->h ? y0 + job->rows_per_band : job->ctx->h;
+    uint32_t* p = &job->ctx->fb.data[(size_t)y0 * (size_t)job->ctx->w];
+    span_fill32(p, job->color, (size_t)(y1 - y0) * (size_t)job->ctx->w);
+}
+
+void
+fill_framebuffer_parallel(DisplayContext* ctx, uint32_t color)
+{
+    damage_all(ctx);
+
+    FillJob job = {ctx, color, TILE_SIZE};
+    int bands = (ctx->h + job.rows_per_band - 1) / job.rows_per_band;
+    parallel_for(bands, fill_band, &job);
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "types.h"
+
+#define TILE_SIZE 64
+
+// Replays the scene by binning shapes into TILE_SIZE tiles and rasterizing tiles on the
+// worker pool. Each tile draws through its own clip rect, so workers write disjoint pixels
+// of fb.data without locking and overlaps still resolve in commit order.
+void render_scene_tiled(const Scene* scene, DisplayContext* ctx);
+
+// fill_framebuffer split into row bands across the worker pool.
+void fill_framebuffer_parallel(DisplayContext* ctx, uint32_t color);
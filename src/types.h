@@ -1,16 +1,78 @@
 #pragma once
 
 #include <X11/Xlib.h>
+#include <X11/extensions/XShm.h>
 #include <stdint.h>
 #include <stdbool.h>
 
 typedef struct
 {
     uint32_t* data;
-    uint32_t* saved;
 } Framebuffer;
 
+#define DAMAGE_MAX_RECTS 16
+
+typedef struct
+{
+    int x0, y0, x1, y1; // half-open
+} Rect;
+
+typedef struct
+{
+    Rect rects[DAMAGE_MAX_RECTS];
+    int count;
+    int coalesce_px; // merge rects when the union wastes at most this many pixels, <0 = always
+} Damage;
+
+typedef struct
+{
+    int y, x0, x1; // half-open
+    uint32_t color;
+    int alpha; // 1..256 (opaque), blended over the pixels below when composited
+} Span;
+
+typedef struct
+{
+    Span* spans;
+    int count;
+    int cap;
+    Rect bounds;
+    bool active; // draw calls record spans instead of writing fb.data
+
+    uint32_t* under; // committed pixels hidden while the spans are composited
+    size_t under_count;
+    size_t under_cap;
+} Overlay;
+
+struct DisplayContext;
+
+// Called with the area a writer is about to modify, before any pixel changes.
+typedef void (*WriteHook)(void* user, struct DisplayContext* ctx, Rect area);
+
+#define MAX_WRITE_HOOKS 4
+
+#define MAX_PRESENT_BUFFERS 3
+#define PRESENT_HISTORY 4
+
+// One MIT-SHM presentation buffer. After XShmPutImage the server reads it asynchronously, so
+// it is only drawn into again once its completion event has arrived.
 typedef struct
+{
+    XImage* img;
+    XShmSegmentInfo* shm; // heap-allocated: img->obdata points at it, so it must not move
+    size_t capacity;      // segment size, which may exceed the image (see display_resize)
+    bool busy;
+    uint64_t frame; // the frame whose pixels it holds, 0 = unknown
+    Rect baked;     // preview overlay composited into it when it was presented
+} PresentBuffer;
+
+typedef struct
+{
+    WriteHook fn;
+    void* user;
+} WriteHookSlot;
+
+typedef struct DisplayContext
 {
     Display* dpy;
     Window win;
@@ -19,8 +81,248 @@ typedef struct
     int w;
     int h;
     Framebuffer fb;
+    Rect clip; // rasterizers only write inside this rect
+    Damage damage;
+    Overlay overlay;
+    WriteHookSlot write_hooks[MAX_WRITE_HOOKS];
+    int write_hook_count;
+
+    // MIT-SHM presentation: fb.data is buffers[current], a segment shared with the X server.
+    // Presenting hands the current buffer to the server and continues in another one,
+    // brought up to date from the damage of the frames it missed.
+    bool use_shm;
+    PresentBuffer buffers[MAX_PRESENT_BUFFERS];
+    int buffer_count;
+    int current;
+    uint64_t frame; // frames presented so far
+    Damage presented[PRESENT_HISTORY]; // damage of frame f at f % PRESENT_HISTORY
+    int shm_completion; // event type of XShmCompletionEvent
+    size_t fb_capacity; // pooled size of fb.data without SHM
 } DisplayContext;
 
+// A drawing surface larger than the window, memory-mapped from a file (see canvas.h). The
+// window is a view of it: canvas pixel (view_x, view_y) sits at the window origin and each
+// canvas pixel covers 2^zoom window pixels.
+typedef struct
+{
+    DisplayContext ctx; // row-major over the mapping; committed strokes are drawn here
+    int fd;
+    size_t map_bytes;
+
+    // Tiles that may be resident, most recently used at lru_head. Past resident_cap the
+    // tail is dropped from memory; its pixels stay in the file.
+    int tiles_x, tiles_y;
+    uint8_t* tile_flags;
+    int32_t* lru_prev;
+    int32_t* lru_next;
+    int lru_head, lru_tail;
+    int resident, resident_cap;
+    int view_tiles; // tiles the view samples; the cap never goes below them
+
+    int view_x, view_y;
+    int zoom;          // CANVAS_ZOOM_MIN..CANVAS_ZOOM_MAX
+    bool view_changed; // the next sync recomposites the whole window
+} Canvas;
+
+#define LINE_STYLE_SOLID 0
+#define LINE_STYLE_DASHED 1
+#define LINE_STYLE_DOTTED 2
+#define LINE_STYLE_AA 3 // solid, anti-aliased
+
+#define FILL_NONE 0
+#define FILL_EVEN_ODD 1
+#define FILL_NON_ZERO 2
+
+struct Stroke;
+typedef void (*StrokeLineFn)(DisplayContext* ctx,
+    const struct Stroke* s,
+    int x0,
+    int y0,
+    int x1,
+    int y1);
+
+// A pen resolved once per stroke: colour, half width and on/off run lengths (off_len == 0 is
+// solid), plus the line routine specialized for that combination.
+typedef struct Stroke
+{
+    uint32_t color;
+    int thickness;
+    int half;
+    int reach; // farthest a written pixel gets from the skeleton, for damage and bounds
+    int on_len, off_len;
+    bool dashed_circle;
+    bool aa;
+    StrokeLineFn line;
+} Stroke;
+
+// Committed shapes, one struct-of-arrays list per primitive type. `order` keeps the global
+// commit order as (kind << SHAPE_KIND_SHIFT | index) so replay stays faithful to overlaps.
+typedef enum
+{
+    SHAPE_POINT,
+    SHAPE_LINE,
+    SHAPE_CIRCLE,
+    SHAPE_POLYGON,
+    SHAPE_KIND_COUNT
+} ShapeKind;
+
+#define SHAPE_KIND_SHIFT 28
+#define SHAPE_INDEX_MASK ((1u << SHAPE_KIND_SHIFT) - 1)
+
+// Style word: bits 0-7 thickness, bits 8-9 line style, bits 10-11 fill rule (polygons, circles).
+#define SHAPE_STYLE(thickness, line_style)                                                        \
+    ((uint16_t)(((thickness) & 0xff) | (((line_style) & 3) << 8)))
+#define SHAPE_WITH_FILL(style, fill_rule) ((uint16_t)((style) | (((fill_rule) & 3) << 10)))
+#define SHAPE_THICKNESS(style) ((int)((style) & 0xff))
+#define SHAPE_LINE_STYLE(style) ((int)(((style) >> 8) & 3))
+#define SHAPE_FILL_RULE(style) ((int)(((style) >> 10) & 3))
+
+typedef struct
+{
+    int count, cap;
+    int32_t* x;
+    int32_t* y;
+    uint32_t* color;
+    uint16_t* style;
+} PointList;
+
+typedef struct
+{
+    int count, cap;
+    int32_t* x0;
+    int32_t* y0;
+    int32_t* x1;
+    int32_t* y1;
+    uint32_t* color;
+    uint16_t* style;
+} LineList;
+
+typedef struct
+{
+    int count, cap;
+    int32_t* cx;
+    int32_t* cy;
+    int32_t* radius;
+    uint32_t* color;
+    uint16_t* style;
+} CircleList;
+
+// Polygons are polylines over a shared vertex pool; each edge connects consecutive vertices.
+// Filled ones are closed implicitly from the last vertex back to the first.
+typedef struct
+{
+    int count, cap;
+    uint32_t* first;
+    uint32_t* vertex_count;
+    uint32_t* color;
+    uint16_t* style;
+
+    int vcount, vcap;
+    int32_t* vx;
+    int32_t* vy;
+} PolygonList;
+
+// Bump allocator over a chain of heap blocks (see arena.h).
+typedef struct ArenaBlock
+{
+    struct ArenaBlock* next;
+    size_t size; // usable bytes after the header
+    size_t used;
+} ArenaBlock;
+
+#define ARENA_POOL_CLASSES 32
+
+typedef struct
+{
+    ArenaBlock* first;
+    ArenaBlock* current; // NULL: nothing allocated since the last reset
+    void* free_lists[ARENA_POOL_CLASSES]; // pooled chunks of 16 << class bytes
+} Arena;
+
+typedef struct
+{
+    ArenaBlock* block;
+    size_t used;
+} ArenaMark;
+
+// Uniform grid over shape bounds (see spatial.h). Each cell lists the ids overlapping it in
+// ascending order; shapes spanning too many cells are kept in one list instead.
+typedef struct
+{
+    int32_t cx, cy;
+    int count, cap; // cap == 0: free slot
+    int32_t* ids;
+} SpatialCell;
+
+typedef struct
+{
+    SpatialCell* cells; // open addressing on (cx, cy), cap a power of two
+    int count, cap;
+    int32_t* oversize;
+    int oversize_count, oversize_cap;
+} SpatialGrid;
+
+typedef struct
+{
+    PointList points;
+    LineList lines;
+    CircleList circles;
+    PolygonList polygons;
+
+    uint32_t* order;
+    int count, cap;
+    int first; // order entries before this were cleared but are kept so the clear can be undone
+
+    // Order positions by bounds. The newest polygon grows after it is indexed: tail_order is
+    // its position (-1 = look it up again) and tail_bounds the area already indexed for it.
+    SpatialGrid grid;
+    int tail_order;
+    Rect tail_bounds;
+
+    Arena arena; // per-document memory of the grid, freed with the scene
+} Scene;
+
+// Scene list lengths at some point in time; restoring one drops everything recorded since.
+typedef struct
+{
+    int first, order, points, lines, circles, polygons, vertices;
+    uint32_t last_polygon_vertices;
+} SceneMark;
+
+// Undo/redo journal. While an action is open, the first write into each tile copies the
+// tile aside; closing the action stores (before XOR after) per changed tile, run-length
+// encoded, so the same record both undoes and redoes it.
+typedef struct
+{
+    uint8_t* data;
+    size_t size;
+    Rect area;
+    SceneMark before, after;
+    uint32_t geometry; // History.geometry when recorded
+} HistoryEntry;
+
+#define HISTORY_MAX_ENTRIES 1024
+
+typedef struct
+{
+    HistoryEntry entries[HISTORY_MAX_ENTRIES]; // ring, oldest at `first`
+    int first;
+    int count;  // recorded actions
+    int cursor; // actions currently applied, <= count
+    size_t bytes;
+    size_t budget;
+
+    bool recording;
+    Rect area; // writes outside it (e.g. the UI bar) are not part of the action
+    int tiles_x, tiles_y;
+    uint32_t geometry; // bumped by every resize; older entries no longer match the tile grid
+    uint8_t* touched;
+    int* snap_tiles;
+    uint32_t* snap_pixels;
+    int snap_count, snap_cap;
+    SceneMark mark;
+} History;
+
 typedef struct
 {
     bool running;
@@ -30,18 +332,69 @@ typedef struct
 
     uint8_t color_r, color_g, color_b;
     int thickness;
-    int line_style; // 0=solid, 1=dashed, 2=dotted
+    int line_style; // LINE_STYLE_*
+
+    int tool; // 0=brush, 1=line, 2=circle, 3=polygon, 4=bucket
+    int fill_rule; // FILL_*, for polygons and circles
+    int fill_tolerance; // per-channel colour difference the bucket still fills across
 
-    int tool; // 0=point, 1=line, 2=circle, 3=polygon
-    int poly_count;
-    int poly_x[256];
-    int poly_y[256];
+    // Vertices of the polygon being drawn; poly_cap leaves room for the cursor in previews.
+    int poly_count, poly_cap;
+    int32_t* poly_x;
+    int32_t* poly_y;
 
     int snap_mode; // -1=none, 0=horizontal, 1=vertical, 2=diag45
+
+    Scene scene;
+    History history;
+
+    Canvas* canvas; // NULL draws straight into the window
+    int pan_x, pan_y; // canvas pixel held under the pointer by a middle-button drag
 } InputState;
 
+// Channel order of 32-bit pixels, matched to the visual by init_display before anything is
+// drawn. Offscreen rendering keeps PIXEL_XRGB; files always store 0x00RRGGBB.
+typedef enum
+{
+    PIXEL_XRGB, // 0x00RRGGBB
+    PIXEL_XBGR  // 0x00BBGGRR
+} PixelOrder;
+
+extern PixelOrder pixel_order;
+
 static inline uint32_t
 pack_rgb(uint8_t r, uint8_t g, uint8_t b)
 {
+    if (pixel_order == PIXEL_XBGR)
+        return ((uint32_t)b << 16) | ((uint32_t)g << 8) | (uint32_t)r;
     return ((uint32_t)r << 16) | ((uint32_t)g << 8) | (uint32_t)b;
 }
+
+static inline void
+unpack_rgb(uint32_t pixel, uint8_t* r, uint8_t* g, uint8_t* b)
+{
+    *g = (uint8_t)(pixel >> 8);
+    if (pixel_order == PIXEL_XBGR)
+    {
+        *r = (uint8_t)pixel;
+        *b = (uint8_t)(pixel >> 16);
+        return;
+    }
+    *r = (uint8_t)(pixel >> 16);
+    *b = (uint8_t)pixel;
+}
+
+// Between native pixels and 0x00RRGGBB; swapping red and blue is its own inverse.
+static inline uint32_t
+pixel_to_xrgb(uint32_t pixel)
+{
+    if (pixel_order == PIXEL_XBGR)
+        return (pixel & 0xff00ff00u) | ((pixel >> 16) & 0xff) | ((pixel & 0xff) << 16);
+    return pixel;
+}
+
+static inline uint32_t
+pixel_from_xrgb(uint32_t xrgb)
+{
+    return pixel_to_xrgb(xrgb);
+}
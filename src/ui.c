@@ -1,7 +1,46 @@
 #include "ui.h"
 
-#include "display.h"
+#include "damage.h"
 #include "draw.h"
+#include "framebuffer.h"
+#include "kernels.h"
+#include "overlay.h"
+#include "polyfill.h"
+#include "profile.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FONT_SCALE 2
+#define GLYPH_ADVANCE (4 * FONT_SCALE)
+#define TOLERANCE_LABEL_W (7 * GLYPH_ADVANCE) // "TOL 255", right of the tool button
+
+// The bar only changes with these fields, so it is rasterized into an offscreen strip once
+// per combination and copied into the framebuffer, or not touched at all while the copy
+// already there is intact.
+typedef struct
+{
+    uint8_t color_r, color_g, color_b;
+    int line_style;
+    int thickness;
+    int tool;
+    int fill_rule;
+    int fill_tolerance;
+} UiKey;
+
+typedef struct
+{
+    DisplayContext strip; // owner->w x UI_BAR_H
+    const DisplayContext* owner;
+    bool ready;
+    bool strip_valid;
+    UiKey key;
+    bool fb_stale; // something other than the UI wrote into the bar rows
+    bool writing;
+} UiCache;
+
+static UiCache cache;
 
 static void
 ui_fill_rect(DisplayContext* ctx, int x, int y, int w, int h, uint8_t r, uint8_t g, uint8_t b)
@@ -18,13 +57,13 @@ ui_fill_rect(DisplayContext* ctx, int x, int y, int w, int h, uint8_t r, uint8_t
     if (y1 > ctx->h)
         y1 = ctx->h;
 
+    damage_rect(ctx, x0, y0, x1, y1);
+    if (x1 <= x0)
+        return;
+
     uint32_t color = pack_rgb(r, g, b);
     for (int yy = y0; yy < y1; ++yy)
-    {
-        uint32_t* row = &ctx->fb.data[yy * ctx->w];
-        for (int xx = x0; xx < x1; ++xx)
-            row[xx] = color;
-    }
+        span_fill32(&ctx->fb.data[yy * ctx->w + x0], color, (size_t)(x1 - x0));
 }
 
 static void
@@ -50,6 +89,54 @@ ui_draw_border(DisplayContext* ctx, int x, int y, int w, int h, uint8_t r, uint8
     }
 }
 
+// 3x5 glyphs, one octal digit per row, most significant bit on the left.
+static uint16_t
+glyph(char c)
+{
+    static const uint16_t digits[10] = {
+        075557, 026227, 071747, 071717, 055711, 074717, 074757, 071111, 075757, 075717,
+    };
+    static const uint16_t letters[26] = {
+        025755, 065656, 034443, 065556, 074647, 074644, 034553, 055755, 072227,
+        011152, 055655, 044447, 057755, 065555, 025552, 065644, 025563, 065655,
+        034216, 072222, 055557, 055552, 055775, 055255, 055222, 071247,
+    };
+
+    if (c >= '0' && c <= '9')
+        return digits[c - '0'];
+    if (c >= 'A' && c <= 'Z')
+        return letters[c - 'A'];
+    if (c == '.')
+        return 000002;
+    if (c == '-')
+        return 000700;
+    if (c == '/')
+        return 011244;
+    if (c == ':')
+        return 002020;
+    return 0;
+}
+
+static void
+ui_draw_text(DisplayContext* ctx, int x, int y, const char* text, uint8_t r, uint8_t g, uint8_t b)
+{
+    for (; *text; ++text, x += GLYPH_ADVANCE)
+    {
+        uint16_t bits = glyph(*text);
+        for (int row = 0; row < 5; ++row)
+            for (int col = 0; col < 3; ++col)
+                if (bits & (1u << ((4 - row) * 3 + (2 - col))))
+                    ui_fill_rect(ctx,
+                        x + col * FONT_SCALE,
+                        y + row * FONT_SCALE,
+                        FONT_SCALE,
+                        FONT_SCALE,
+                        r,
+                        g,
+                        b);
+    }
+}
+
 static void
 cycle_color(InputState* state)
 {
@@ -87,7 +174,7 @@ cycle_thickness(InputState* state)
 static void
 cycle_line_style(InputState* state)
 {
-    state->line_style = (state->line_style + 1) % 3;
+    state->line_style = (state->line_style + 1) % 4;
 }
 
 static void
@@ -113,14 +200,17 @@ ui_layout(int* sx, int* sy, int* sw, int* bx, int* by, int* tx, int* ty, int* mx
 static void
 cycle_tool(InputState* state)
 {
-    state->tool = (state->tool + 1) % 4;
+    state->tool = (state->tool + 1) % 5;
     state->have_first = false;
-    state->poly_count = 0;
 }
 
-void
-render_ui(DisplayContext* ctx, const InputState* state)
+static void
+rasterize_bar(DisplayContext* ctx, const InputState* state)
 {
+    // The canvas clip keeps strokes out of the bar; the bar itself draws everywhere.
+    Rect canvas_clip = ctx->clip;
+    ctx->clip = (Rect){0, 0, ctx->w, ctx->h};
+
     ui_fill_rect(ctx, 0, 0, ctx->w, UI_BAR_H, 32, 32, 32);
     ui_draw_border(ctx, 0, UI_BAR_H - 1, ctx->w, 1, 80, 80, 80);
 
@@ -135,7 +225,13 @@ render_ui(DisplayContext* ctx, const InputState* state)
     int cy = by + sw / 2;
     int x_start = bx + 4;
     int x_end = bx + sw - 5;
-    if (state->line_style == 2)
+    if (state->line_style == LINE_STYLE_AA)
+    {
+        // anti-aliased icon: a shallow slope shows the blended edges
+        Stroke pen = stroke_make(pack_rgb(230, 230, 230), 1, LINE_STYLE_AA);
+        stroke_line(ctx, &pen, x_start, cy + 4, x_end, cy - 4);
+    }
+    else if (state->line_style == 2)
     {
         // dotted icon
         draw_dotted_line(ctx, x_start, cy, x_end, cy, 230, 230, 230);
@@ -163,14 +259,19 @@ render_ui(DisplayContext* ctx, const InputState* state)
     int sel_y = (state->thickness <= 1) ? y1 : (state->thickness <= 3 ? y2 : y3);
     ui_fill_rect(ctx, tx + sw - 7, sel_y - 2, 3, 5, 0, 180, 255);
 
-    // Tool button (point/line/circle/polygon)
+    // Tool button (brush/line/circle/polygon/bucket)
     ui_fill_rect(ctx, mx, my, sw, sw, 48, 48, 48);
     ui_draw_border(ctx, mx, my, sw, sw, 220, 220, 220);
     int cx = mx + sw / 2;
     int cy2 = my + sw / 2;
     if (state->tool == 0)
     {
-        put_pixel_thick(ctx, cx, cy2, 3, 230, 230, 230);
+        // brush icon: a wavy freehand stroke
+        int q = (sw - 10) / 4;
+        draw_line_thick(ctx, mx + 5, cy2 + 3, mx + 5 + q, cy2 - 3, 2, 230, 230, 230);
+        draw_line_thick(ctx, mx + 5 + q, cy2 - 3, mx + 5 + 2 * q, cy2 + 3, 2, 230, 230, 230);
+        draw_line_thick(ctx, mx + 5 + 2 * q, cy2 + 3, mx + 5 + 3 * q, cy2 - 3, 2, 230, 230, 230);
+        draw_line_thick(ctx, mx + 5 + 3 * q, cy2 - 3, mx + sw - 5, cy2 + 3, 2, 230, 230, 230);
     }
     else if (state->tool == 1)
     {
@@ -178,7 +279,32 @@ render_ui(DisplayContext* ctx, const InputState* state)
     }
     else if (state->tool == 2)
     {
-        draw_circle(ctx, cx, cy2, sw / 3, 1, false, 230, 230, 230);
+        if (state->fill_rule != FILL_NONE)
+            fill_circle(ctx, cx, cy2, sw / 3, pack_rgb(230, 230, 230));
+        else
+            draw_circle(ctx, cx, cy2, sw / 3, 1, false, 230, 230, 230);
+    }
+    else if (state->tool == 4)
+    {
+        // bucket icon: a pail tipping out a drop
+        int32_t vx[4] = {mx + 6, mx + sw - 10, mx + sw - 13, mx + 9};
+        int32_t vy[4] = {my + 8, my + 8, my + sw - 6, my + sw - 6};
+        fill_polygon(ctx, vx, vy, 4, FILL_NON_ZERO, pack_rgb(230, 230, 230));
+        fill_circle(ctx, mx + sw - 6, my + sw - 9, 2, pack_rgb(0, 180, 255));
+    }
+    else if (state->fill_rule != FILL_NONE)
+    {
+        // pentagram filled with the current rule: even-odd leaves the centre open
+        static const int star_x[5] = {0, 59, -95, 95, -59};
+        static const int star_y[5] = {-100, 81, -31, -31, 81};
+        int radius = sw / 2 - 4;
+        int32_t vx[5], vy[5];
+        for (int i = 0; i < 5; ++i)
+        {
+            vx[i] = cx + star_x[i] * radius / 100;
+            vy[i] = cy2 + 1 + star_y[i] * radius / 100;
+        }
+        fill_polygon(ctx, vx, vy, 5, state->fill_rule, pack_rgb(230, 230, 230));
     }
     else
     {
@@ -187,6 +313,134 @@ render_ui(DisplayContext* ctx, const InputState* state)
         draw_line_thick(ctx, mx + 6, my + sw - 6, mx + sw - 6, my + sw - 10, 1, 230, 230, 230);
         draw_line_thick(ctx, mx + sw - 6, my + sw - 10, cx, my + 6, 1, 230, 230, 230);
     }
+
+    // The bucket's tolerance, stepped with T.
+    char tolerance[16];
+    snprintf(tolerance, sizeof(tolerance), "TOL %d", state->fill_tolerance);
+    ui_draw_text(ctx, mx + sw + sy, (UI_BAR_H - 5 * FONT_SCALE) / 2, tolerance, 200, 200, 200);
+
+    ctx->clip = canvas_clip;
+}
+
+static void
+watch_bar(void* user, DisplayContext* ctx, Rect area)
+{
+    (void)user;
+    (void)ctx;
+    if (!cache.writing && area.y0 < UI_BAR_H)
+        cache.fb_stale = true;
+}
+
+void
+ui_init(DisplayContext* ctx)
+{
+    memset(&cache, 0, sizeof(cache));
+    if (!framebuffer_attach(&cache.strip, ctx->w, UI_BAR_H, NULL))
+        return;
+    cache.owner = ctx;
+    cache.ready = true;
+    cache.fb_stale = true;
+    damage_add_hook(ctx, watch_bar, NULL);
+}
+
+void
+ui_resize(DisplayContext* ctx)
+{
+    if (!cache.ready || cache.owner != ctx || cache.strip.w == ctx->w)
+        return;
+
+    // A strip that cannot be reallocated leaves render_ui drawing the bar directly.
+    free(cache.strip.fb.data);
+    if (!framebuffer_attach(&cache.strip, ctx->w, UI_BAR_H, NULL))
+        return;
+    cache.strip_valid = false;
+    cache.fb_stale = true;
+}
+
+void
+ui_free(DisplayContext* ctx)
+{
+    if (!cache.ready)
+        return;
+    damage_remove_hook(ctx, watch_bar, NULL);
+    free(cache.strip.fb.data);
+    memset(&cache, 0, sizeof(cache));
+}
+
+static bool
+key_equal(const UiKey* a, const UiKey* b)
+{
+    return a->color_r == b->color_r && a->color_g == b->color_g && a->color_b == b->color_b &&
+           a->line_style == b->line_style && a->thickness == b->thickness && a->tool == b->tool &&
+           a->fill_rule == b->fill_rule && a->fill_tolerance == b->fill_tolerance;
+}
+
+void
+render_ui(DisplayContext* ctx, const InputState* state)
+{
+    int64_t t = profile_begin();
+
+    if (!cache.ready || cache.owner != ctx || cache.strip.w != ctx->w)
+    {
+        rasterize_bar(ctx, state);
+        render_stats(ctx);
+        profile_end("render_ui", t);
+        return;
+    }
+
+    UiKey key = {
+        state->color_r,
+        state->color_g,
+        state->color_b,
+        state->line_style,
+        state->thickness,
+        state->tool,
+        state->fill_rule,
+        state->fill_tolerance,
+    };
+    if (!cache.strip_valid || !key_equal(&key, &cache.key))
+    {
+        rasterize_bar(&cache.strip, state);
+        damage_reset(&cache.strip);
+        cache.key = key;
+        cache.strip_valid = true;
+        cache.fb_stale = true;
+    }
+
+    if (cache.fb_stale)
+    {
+        int rows = UI_BAR_H < ctx->h ? UI_BAR_H : ctx->h;
+        cache.writing = true;
+        damage_rect(ctx, 0, 0, ctx->w, rows);
+        memcpy(ctx->fb.data, cache.strip.fb.data, (size_t)ctx->w * rows * sizeof(uint32_t));
+        render_stats(ctx);
+        cache.writing = false;
+        cache.fb_stale = false;
+    }
+
+    profile_end("render_ui", t);
+}
+
+void
+render_stats(DisplayContext* ctx)
+{
+    if (!profile_stats_visible())
+        return;
+
+    int sx, sy, sw, bx, by, tx, ty, mx, my;
+    ui_layout(&sx, &sy, &sw, &bx, &by, &tx, &ty, &mx, &my);
+    int x = mx + sw + 2 * sy + TOLERANCE_LABEL_W;
+
+    char timing[64];
+    char traffic[64];
+    profile_format(timing, sizeof(timing), traffic, sizeof(traffic));
+
+    bool writing = cache.writing;
+    cache.writing = true;
+    ui_fill_rect(ctx, x, 0, ctx->w - x, UI_BAR_H - 1, 32, 32, 32);
+    ui_draw_text(ctx, x, 10, timing, 200, 200, 120);
+    ui_draw_text(ctx, x, 10 + 8 * FONT_SCALE, traffic, 200, 200, 120);
+    cache.writing = writing;
 }
 
 bool
@@ -210,11 +464,13 @@ ui_handle_click(int x, int y, DisplayContext* ctx, InputState* state)
     else if (in_thick)
         cycle_thickness(state);
     else if (in_tool)
+    {
         cycle_tool(state);
+        overlay_clear(ctx);
+    }
     else
         return true;
 
     render_ui(ctx, state);
-    render_frame(ctx);
     return true;
 }
@@ -4,6 +4,17 @@
 
 #define UI_BAR_H 48
 
+// The bar is cached per tool/fill/colour/style/thickness; render_ui copies it into fb.data only
+// when the cached look changed or something else overwrote the bar rows.
+void ui_init(DisplayContext* ctx);
+void ui_free(DisplayContext* ctx);
+
+// Reallocates the cached bar for a new framebuffer width.
+void ui_resize(DisplayContext* ctx);
+
 void render_ui(DisplayContext* ctx, const InputState* state);
 
+// Redraws only the frame statistics at the right of the bar (when profiling shows them).
+void render_stats(DisplayContext* ctx);
+
 bool ui_handle_click(int x, int y, DisplayContext* ctx, InputState* state);